@@ -0,0 +1,214 @@
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "batch_simulation.hpp"
+#include "fmm_gravity.hpp"
+#include "gravity.hpp"
+#include "pm_gravity.hpp"
+#include "quadtree.hpp"
+#include "simd_gravity.hpp"
+#include "system.hpp"
+#include "thread_pool.hpp"
+
+// every system is generated from the same seed so runs compare like for like
+constexpr std::uint64_t BENCH_SEED = 0x6e626f6479;
+constexpr Vector2 BENCH_AREA = {1000.0f, 1000.0f};
+constexpr float BENCH_DT = 1.0f / 60.0f;
+
+// one sun plus n - 1 planets, cached per size since large systems take a while to generate
+static const std::vector<Body>& get_system(std::int64_t n) {
+    static std::map<std::int64_t, std::vector<Body>> systems;
+    auto it = systems.find(n);
+    if (it == systems.end()) {
+        std::default_random_engine e(BENCH_SEED);
+        const int planets = static_cast<int>(n) - 1;
+        it = systems.emplace(n, get_random_system(e, planets, planets, BENCH_AREA)).first;
+    }
+    return it->second;
+}
+
+static ThreadPool* get_pool(std::int64_t threads) {
+    static std::map<std::int64_t, std::unique_ptr<ThreadPool>> pools;
+    auto& pool = pools[threads];
+    if (!pool) {
+        pool = std::make_unique<ThreadPool>(static_cast<unsigned>(threads));
+    }
+    return pool.get();
+}
+
+// args: body count, thread count
+static void run_engine(benchmark::State& state, ForceEngine& engine) {
+    const auto& bodies = get_system(state.range(0));
+    std::vector<Vector2> acc(bodies.size());
+    engine.pool = get_pool(state.range(1));
+
+    std::uint64_t interactions = 0;
+    for (auto _ : state) {
+        engine.compute(bodies, acc, BENCH_DT);
+        benchmark::DoNotOptimize(acc.data());
+        benchmark::ClobberMemory();
+        interactions += engine.interactions;
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(interactions));
+    state.counters["bodies"] = static_cast<double>(bodies.size());
+}
+
+static void BM_Pairwise(benchmark::State& state) {
+    PairwiseEngine engine;
+    run_engine(state, engine);
+}
+
+static void BM_PairwiseSymmetric(benchmark::State& state) {
+    SymmetricPairwiseEngine engine;
+    run_engine(state, engine);
+}
+
+static void BM_PairwiseSimd(benchmark::State& state) {
+    SimdPairwiseEngine engine;
+    run_engine(state, engine);
+    state.SetLabel(simd_kernel_isa());
+}
+
+// the tree engines build their tree on every evaluation here; BM_QuadTree times the refit
+static void BM_BarnesHut(benchmark::State& state) {
+    BarnesHutEngine engine;
+    engine.max_drift = 0.0f;
+    run_engine(state, engine);
+}
+
+static void BM_Fmm(benchmark::State& state) {
+    FmmEngine engine;
+    engine.max_drift = 0.0f;
+    run_engine(state, engine);
+}
+
+static void BM_P3m(benchmark::State& state) {
+    PmEngine engine;
+    run_engine(state, engine);
+}
+
+// tree over bodies drifting along their velocities, built every step (arg 1 = 0) or refitted
+// (arg 1 = 1)
+static void BM_QuadTree(benchmark::State& state) {
+    std::vector<Body> bodies = get_system(state.range(0));
+    const float max_drift = state.range(1) ? 0.25f : 0.0f;
+    QuadTree tree;
+    tree.update(bodies, 8, max_drift);
+
+    std::int64_t refits = 0;
+    for (auto _ : state) {
+        for (auto& body : bodies) {
+            body.pos += body.vel * (BENCH_DT / 16.0f);
+        }
+        tree.update(bodies, 8, max_drift);
+        benchmark::DoNotOptimize(tree.root());
+        refits += tree.refitted();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * bodies.size()));
+    state.counters["refits"] =
+        benchmark::Counter(static_cast<double>(refits), benchmark::Counter::kAvgIterations);
+}
+
+// exact kernel with every pair overlapping (arg 1 = 1) or none (arg 1 = 0), isolating the cost
+// of the elastic collision branch
+static void BM_CollisionPath(benchmark::State& state) {
+    std::vector<Body> bodies = get_system(state.range(0));
+    for (auto& body : bodies) {
+        body.radius = state.range(1) ? 2.0f * BENCH_AREA.x : 0.0f;
+    }
+    std::vector<Vector2> acc(bodies.size());
+    PairwiseEngine engine;
+
+    for (auto _ : state) {
+        engine.compute(bodies, acc, BENCH_DT);
+        benchmark::DoNotOptimize(acc.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * engine.interactions));
+}
+
+// args: body count, thread count
+static void BM_DiskGalaxy(benchmark::State& state) {
+    ThreadPool* pool = get_pool(state.range(1));
+    for (auto _ : state) {
+        auto bodies =
+            get_disk_galaxy(BENCH_SEED, static_cast<int>(state.range(0)), BENCH_AREA, pool);
+        benchmark::DoNotOptimize(bodies.data());
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * state.range(0)));
+}
+
+static void BM_BodyUpdate(benchmark::State& state) {
+    std::vector<Body> bodies = get_system(state.range(0));
+    const Vector2 acc = {1.0f, -1.0f};
+
+    for (auto _ : state) {
+        for (auto& body : bodies) {
+            body.update(acc, BENCH_DT);
+        }
+        benchmark::DoNotOptimize(bodies.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * bodies.size()));
+}
+
+// args: system count, thread count; systems of 3 to 16 bodies, as in a parameter sweep
+static void BM_Batch(benchmark::State& state) {
+    std::default_random_engine e(BENCH_SEED);
+    std::vector<std::vector<Body>> systems(state.range(0));
+    for (auto& system : systems) {
+        system = get_random_system(e, 2, 15, BENCH_AREA);
+    }
+    BatchSimulation batch;
+    batch.reset(systems);
+    batch.pool = get_pool(state.range(1));
+
+    std::uint64_t interactions = 0;
+    for (auto _ : state) {
+        batch.step(BENCH_DT);
+        interactions += batch.interactions();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(interactions));
+    state.counters["systems"] = static_cast<double>(systems.size());
+}
+
+// the O(N^2) engines stop at 64k bodies, where a single evaluation already takes seconds
+static void direct_args(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"bodies", "threads"})->RangeMultiplier(4)->Ranges({{16, 1 << 16}, {1, 1}});
+    b->Args({1 << 14, static_cast<std::int64_t>(std::thread::hardware_concurrency())});
+}
+
+static void tree_args(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"bodies", "threads"})->RangeMultiplier(4)->Ranges({{16, 1 << 20}, {1, 1}});
+    b->Args({1 << 20, static_cast<std::int64_t>(std::thread::hardware_concurrency())});
+}
+
+BENCHMARK(BM_Pairwise)->Apply(direct_args)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_PairwiseSymmetric)->Apply(direct_args)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_PairwiseSimd)->Apply(direct_args)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_BarnesHut)->Apply(tree_args)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Fmm)->Apply(tree_args)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_P3m)->Apply(tree_args)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_QuadTree)
+    ->ArgNames({"bodies", "refit"})
+    ->ArgsProduct({{1 << 14, 1 << 17, 1 << 20}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_CollisionPath)
+    ->ArgNames({"bodies", "overlap"})
+    ->ArgsProduct({{256, 1024, 4096}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_DiskGalaxy)->Apply(tree_args)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_BodyUpdate)->ArgName("bodies")->RangeMultiplier(8)->Range(16, 1 << 20);
+BENCHMARK(BM_Batch)
+    ->ArgNames({"systems", "threads"})
+    ->ArgsProduct({{64, 1024, 16384}, {1}})
+    ->Args({16384, static_cast<std::int64_t>(std::thread::hardware_concurrency())})
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,9 @@
+# merges the raw profiles Clang wrote into DIR into DIR/nbody.profdata, for NBODY_PGO=USE
+file(GLOB raw_profiles "${DIR}/*.profraw")
+if (NOT raw_profiles)
+  message(FATAL_ERROR "no profiles in ${DIR}")
+endif()
+execute_process(
+  COMMAND ${PROFDATA} merge -output=${DIR}/nbody.profdata ${raw_profiles}
+  COMMAND_ERROR_IS_FATAL ANY
+)
@@ -0,0 +1,584 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "src/allocation_counter.hpp"
+#include "src/batch_simulation.hpp"
+#include "src/checkpoint.hpp"
+#include "src/cpu_features.hpp"
+#include "src/fmm_gravity.hpp"
+#include "src/gravity.hpp"
+#include "src/pm_gravity.hpp"
+#include "src/profiler.hpp"
+#include "src/simulation.hpp"
+#include "src/system.hpp"
+#include "src/thread_pool.hpp"
+#include "src/trajectory_writer.hpp"
+
+// headless batch runner: N fixed-dt steps as fast as possible, reporting throughput
+
+struct Options {
+    std::string engine = "barnes-hut";
+    std::string system = "solar";
+    int bodies = 1000;
+    std::uint64_t steps = 1000;
+    float dt = 1.0f / 60.0f;
+    float theta = 0.5f;
+    int order = 4;
+    int mesh = 256;
+    float max_drift = 0.25f;
+    Precision precision = Precision::FLOAT;
+    Softening softening = Softening::NONE;
+    unsigned threads = std::thread::hardware_concurrency();
+    std::uint64_t seed = 0;
+    float size = 1000.0f;
+    bool bounded = false;
+    bool accuracy = false;
+    bool deterministic = false;
+    // unset: broadphase and euler, or whatever a loaded checkpoint was saved with
+    std::optional<CollisionMode> collisions;
+    std::optional<Integrator> integrator;
+    std::optional<SimdIsa> isa;
+    std::string load;
+    std::string checkpoint;
+    std::uint64_t checkpoint_every = 0;
+    std::optional<std::uint64_t> reorder_every;
+    std::uint64_t diagnostics_every = 0;
+    std::string trajectory;
+    TrajectoryOptions trajectory_options;
+    std::string profile;
+    // --batch: independent systems of min_bodies (default `bodies`) to `bodies` bodies
+    std::size_t batch = 0;
+    std::optional<int> min_bodies;
+    std::string batch_output;
+};
+
+static void print_usage(const char* argv0) {
+    std::cerr << std::format("usage: {} [options]\n", argv0)
+              << "  --engine NAME   force engine, one of:";
+    for (auto name : force_engine_names()) {
+        std::cerr << ' ' << name;
+    }
+    std::cerr << "\n"
+                 "  --system NAME   initial conditions, one of:";
+    for (auto name : system_names()) {
+        std::cerr << ' ' << name;
+    }
+    std::cerr << "\n"
+                 "                  (default solar, one sun plus N - 1 planets)\n"
+                 "  --bodies N      body count (default 1000)\n"
+                 "  --steps N       steps to run (default 1000)\n"
+                 "  --dt S          fixed timestep in seconds (default 1/60)\n"
+                 "  --theta T       Barnes-Hut and FMM opening angle (default 0.5, at most 1 for\n"
+                 "                  FMM)\n"
+                 "  --order P       FMM expansion order, 1 to 12 (default 4)\n"
+                 "  --mesh N        PM/P3M mesh cells per side, a power of two from 16 to 2048\n"
+                 "                  (default 256)\n"
+                 "  --max-drift F   share of the bodies that may change tree cells before the\n"
+                 "                  Barnes-Hut/FMM tree is rebuilt rather than refitted, 0 to\n"
+                 "                  rebuild every step (default 0.25)\n"
+                 "  --precision P   pairwise kernel precision, float or double (default float)\n"
+                 "  --softening S   pairwise softening, none or plummer (default none)\n"
+                 "  --threads N     worker threads including the main one (default: all)\n"
+                 "  --seed N        seed for the initial conditions (default 0)\n"
+                 "  --size S        side of the square the system is generated in (default 1000)\n"
+                 "  --collisions M  none, kernel, broadphase or merge (default broadphase)\n"
+                 "  --integrator I  euler, leapfrog, yoshida4 or block (default euler)\n"
+                 "  --bounded       remove bodies that leave the square, like the windowed app\n"
+                 "  --reorder-every N\n"
+                 "                  steps between Morton sorts of the bodies, 0 for never\n"
+                 "                  (default 64)\n"
+                 "  --diagnostics-every N\n"
+                 "                  sample the energy and momenta every N steps and report their\n"
+                 "                  drift (default 0: never)\n"
+                 "  --accuracy      compare the engine against the exact pairwise sum in double\n"
+                 "                  precision on the initial system before running\n"
+                 "  --deterministic sum forces in an order independent of --threads, so runs are\n"
+                 "                  bitwise reproducible (see the state hash at the end)\n"
+                 "  --isa NAME      run the SIMD kernels with scalar, sse2, avx2, avx512 or neon\n"
+                 "                  code rather than the best the CPU supports\n"
+                 "  --load PATH     start from a checkpoint instead of a generated system\n"
+                 "  --checkpoint PATH\n"
+                 "                  write a checkpoint at the end of the run\n"
+                 "  --checkpoint-every N\n"
+                 "                  ... and every N steps (default 0: only at the end)\n"
+                 "  --trajectory PATH\n"
+                 "                  stream positions and velocities to a trajectory file\n"
+                 "  --trajectory-every N\n"
+                 "                  ... of every Nth step (default 1)\n"
+                 "  --trajectory-precision P\n"
+                 "                  f32, f16 or q16 (16 bit fixed point, default f32)\n"
+                 "  --trajectory-compression C\n"
+                 "                  none, lz4 or zstd (default none)\n"
+                 "  --profile PATH  write the time and work of every step's phases, as CSV (or\n"
+                 "                  JSON if PATH ends in .json)\n"
+                 "  --batch N       run N independent systems side by side instead of one, the\n"
+                 "                  kth from seed + k; collisions none or kernel (the default),\n"
+                 "                  and the engine and output options above do not apply\n"
+                 "  --min-bodies N  ... of between N and --bodies bodies each (default --bodies)\n"
+                 "  --batch-output PATH\n"
+                 "                  write the energy and momentum drift of every system as CSV\n";
+}
+
+template<class T>
+static bool parse_number(std::string_view text, T& out) {
+    const auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), out);
+    return ec == std::errc {} && ptr == text.data() + text.size();
+}
+
+// FNV-1a over the bodies and their ids, to compare the end states of two runs bit for bit
+static std::uint64_t state_hash(const Simulation& sim) {
+    std::uint64_t hash = 0xCBF29CE484222325;
+    const auto add = [&](std::span<const std::byte> bytes) {
+        for (std::byte b : bytes) {
+            hash = (hash ^ static_cast<std::uint64_t>(b)) * 0x100000001B3;
+        }
+    };
+    add(std::as_bytes(sim.bodies()));
+    add(std::as_bytes(sim.ids()));
+    return hash;
+}
+
+static bool parse_options(int argc, char** argv, Options& opts) {
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        if (arg == "--bounded") {
+            opts.bounded = true;
+            continue;
+        }
+        if (arg == "--accuracy") {
+            opts.accuracy = true;
+            continue;
+        }
+        if (arg == "--deterministic") {
+            opts.deterministic = true;
+            continue;
+        }
+        if (i + 1 == argc) {
+            return false;
+        }
+        const std::string_view value = argv[++i];
+        bool ok = true;
+        if (arg == "--engine") {
+            opts.engine = value;
+        } else if (arg == "--system") {
+            opts.system = value;
+            ok = std::ranges::find(system_names(), value) != system_names().end();
+        } else if (arg == "--bodies") {
+            ok = parse_number(value, opts.bodies) && opts.bodies >= 2;
+        } else if (arg == "--min-bodies") {
+            opts.min_bodies.emplace();
+            ok = parse_number(value, *opts.min_bodies) && *opts.min_bodies >= 2;
+        } else if (arg == "--batch") {
+            ok = parse_number(value, opts.batch);
+        } else if (arg == "--batch-output") {
+            opts.batch_output = value;
+        } else if (arg == "--steps") {
+            ok = parse_number(value, opts.steps);
+        } else if (arg == "--dt") {
+            ok = parse_number(value, opts.dt) && opts.dt > 0.0f;
+        } else if (arg == "--theta") {
+            ok = parse_number(value, opts.theta) && opts.theta >= 0.0f;
+        } else if (arg == "--order") {
+            ok = parse_number(value, opts.order) && opts.order >= 1 &&
+                 opts.order <= FmmEngine::MAX_ORDER;
+        } else if (arg == "--mesh") {
+            ok = parse_number(value, opts.mesh) && opts.mesh >= PmEngine::MIN_MESH &&
+                 opts.mesh <= PmEngine::MAX_MESH &&
+                 std::has_single_bit(static_cast<unsigned>(opts.mesh));
+        } else if (arg == "--max-drift") {
+            ok = parse_number(value, opts.max_drift) && opts.max_drift >= 0.0f;
+        } else if (arg == "--precision") {
+            ok = false;
+            for (auto precision : {Precision::FLOAT, Precision::DOUBLE}) {
+                if (value == precision_name(precision)) {
+                    opts.precision = precision;
+                    ok = true;
+                }
+            }
+        } else if (arg == "--softening") {
+            ok = false;
+            for (auto softening : {Softening::NONE, Softening::PLUMMER}) {
+                if (value == softening_name(softening)) {
+                    opts.softening = softening;
+                    ok = true;
+                }
+            }
+        } else if (arg == "--threads") {
+            ok = parse_number(value, opts.threads) && opts.threads >= 1;
+        } else if (arg == "--seed") {
+            ok = parse_number(value, opts.seed);
+        } else if (arg == "--size") {
+            ok = parse_number(value, opts.size) && opts.size > 0.0f;
+        } else if (arg == "--collisions") {
+            ok = false;
+            for (auto mode : {CollisionMode::NONE, CollisionMode::KERNEL,
+                              CollisionMode::BROADPHASE, CollisionMode::MERGE}) {
+                if (value == collision_mode_name(mode)) {
+                    opts.collisions = mode;
+                    ok = true;
+                }
+            }
+        } else if (arg == "--isa") {
+            ok = false;
+            for (auto isa : simd_isas()) {
+                if (value == simd_isa_name(isa)) {
+                    opts.isa = isa;
+                    ok = true;
+                }
+            }
+        } else if (arg == "--load") {
+            opts.load = value;
+        } else if (arg == "--checkpoint") {
+            opts.checkpoint = value;
+        } else if (arg == "--checkpoint-every") {
+            ok = parse_number(value, opts.checkpoint_every);
+        } else if (arg == "--reorder-every") {
+            opts.reorder_every.emplace();
+            ok = parse_number(value, *opts.reorder_every);
+        } else if (arg == "--diagnostics-every") {
+            ok = parse_number(value, opts.diagnostics_every);
+        } else if (arg == "--profile") {
+            opts.profile = value;
+        } else if (arg == "--trajectory") {
+            opts.trajectory = value;
+        } else if (arg == "--trajectory-every") {
+            ok = parse_number(value, opts.trajectory_options.decimation) &&
+                 opts.trajectory_options.decimation >= 1;
+        } else if (arg == "--trajectory-precision") {
+            ok = false;
+            for (auto precision : {TrajectoryPrecision::FLOAT32, TrajectoryPrecision::FLOAT16,
+                                   TrajectoryPrecision::QUANTIZED16}) {
+                if (value == trajectory_precision_name(precision)) {
+                    opts.trajectory_options.precision = precision;
+                    ok = true;
+                }
+            }
+        } else if (arg == "--trajectory-compression") {
+            ok = false;
+            for (auto compression : {TrajectoryCompression::NONE, TrajectoryCompression::LZ4,
+                                     TrajectoryCompression::ZSTD}) {
+                if (value == trajectory_compression_name(compression)) {
+                    opts.trajectory_options.compression = compression;
+                    ok = true;
+                }
+            }
+        } else if (arg == "--integrator") {
+            ok = false;
+            for (auto integrator : {Integrator::EULER, Integrator::LEAPFROG, Integrator::YOSHIDA4,
+                                    Integrator::BLOCK}) {
+                if (value == integrator_name(integrator)) {
+                    opts.integrator = integrator;
+                    ok = true;
+                }
+            }
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// --batch: many small systems stepped side by side, with one line of results per system
+static int run_batch(const Options& opts) {
+    const CollisionMode collisions = opts.collisions.value_or(CollisionMode::KERNEL);
+    if (collisions != CollisionMode::NONE && collisions != CollisionMode::KERNEL) {
+        std::cerr << "--batch resolves collisions in the kernel or not at all\n";
+        return EXIT_FAILURE;
+    }
+    if (opts.integrator == Integrator::BLOCK) {
+        std::cerr << "--batch cannot use the block integrator\n";
+        return EXIT_FAILURE;
+    }
+    const int min_bodies = opts.min_bodies.value_or(opts.bodies);
+    if (min_bodies > opts.bodies) {
+        std::cerr << "--min-bodies is above --bodies\n";
+        return EXIT_FAILURE;
+    }
+    ThreadPool pool(opts.threads);
+    std::default_random_engine sizes(opts.seed);
+    std::uniform_int_distribution<int> size(min_bodies, opts.bodies);
+    std::vector<std::vector<Body>> systems(opts.batch);
+    for (std::size_t k = 0; k < systems.size(); k++) {
+        systems[k] = make_system(opts.system, opts.seed + k, size(sizes), {opts.size, opts.size});
+    }
+    BatchSimulation batch;
+    batch.reset(systems);
+    batch.pool = &pool;
+    batch.collisions = collisions == CollisionMode::KERNEL;
+    batch.integrator = opts.integrator.value_or(Integrator::EULER);
+    std::cout << std::format("{} systems of {} to {} bodies, {} {} steps of {} s, {} collisions, "
+                             "{} threads\n",
+                             batch.size(), min_bodies, opts.bodies, opts.steps,
+                             integrator_name(batch.integrator), opts.dt,
+                             collision_mode_name(collisions), pool.size());
+
+    const auto sampled = batch.sample(opts.dt);
+    const std::vector<Diagnostics> initial(sampled.begin(), sampled.end());
+    std::uint64_t interactions = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (std::uint64_t s = 0; s < opts.steps; s++) {
+        batch.step(opts.dt);
+        interactions += batch.interactions();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const auto last = batch.sample(opts.dt);
+
+    const double seconds = elapsed.count();
+    std::cout << std::format("{:.3f} s, {:.1f} steps/s, {:.3e} system steps/s, "
+                             "{:.3e} interactions/s\n",
+                             seconds, opts.steps / seconds, batch.size() * opts.steps / seconds,
+                             interactions / seconds);
+    std::vector<DiagnosticsDrift> drifts(batch.size());
+    std::vector<double> energy_drifts(batch.size());
+    for (std::size_t k = 0; k < batch.size(); k++) {
+        drifts[k] = diagnostics_drift(initial[k], last[k]);
+        energy_drifts[k] = std::abs(drifts[k].energy);
+    }
+    if (!energy_drifts.empty()) {
+        std::ranges::sort(energy_drifts);
+        const auto quantile = [&](double q) {
+            return energy_drifts[static_cast<std::size_t>(q * (energy_drifts.size() - 1))];
+        };
+        std::cout << std::format("energy drift over the systems: median {:.3e}, p99 {:.3e}, "
+                                 "largest {:.3e}\n",
+                                 quantile(0.5), quantile(0.99), energy_drifts.back());
+    }
+    std::uint64_t hash = 0xCBF29CE484222325;
+    for (std::size_t k = 0; k < batch.size(); k++) {
+        const std::vector<Body> bodies = batch.bodies(k);
+        for (std::byte b : std::as_bytes(std::span(bodies))) {
+            hash = (hash ^ static_cast<std::uint64_t>(b)) * 0x100000001B3;
+        }
+    }
+    std::cout << std::format("state hash {:016x}\n", hash);
+
+    if (!opts.batch_output.empty()) {
+        std::ofstream out(opts.batch_output, std::ios::trunc);
+        out << "system,seed,bodies,kinetic,potential,energy_drift,momentum_drift,"
+               "angular_momentum_drift\n";
+        for (std::size_t k = 0; k < batch.size(); k++) {
+            out << std::format("{},{},{},{:.9e},{:.9e},{:.6e},{:.6e},{:.6e}\n", k, opts.seed + k,
+                               batch.body_count(k), last[k].kinetic, last[k].potential,
+                               drifts[k].energy, drifts[k].momentum, drifts[k].angular_momentum);
+        }
+        if (!out.flush()) {
+            std::cerr << std::format("cannot write {}\n", opts.batch_output);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (opts.system == "galaxy-pair" && opts.min_bodies.value_or(opts.bodies) < 4) {
+        std::cerr << "galaxy-pair needs at least 4 bodies\n";
+        return EXIT_FAILURE;
+    }
+    if (opts.isa && !set_simd_isa(*opts.isa)) {
+        std::cerr << std::format("this CPU cannot run {} kernels\n", simd_isa_name(*opts.isa));
+        return EXIT_FAILURE;
+    }
+    if (opts.batch != 0) {
+        return run_batch(opts);
+    }
+    auto engine = make_force_engine(opts.engine);
+    if (!engine) {
+        std::cerr << std::format("unknown engine '{}'\n", opts.engine);
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (auto* barnes_hut = dynamic_cast<BarnesHutEngine*>(engine.get())) {
+        barnes_hut->theta = opts.theta;
+        barnes_hut->max_drift = opts.max_drift;
+    } else if (auto* fmm = dynamic_cast<FmmEngine*>(engine.get())) {
+        if (opts.theta > 1.0f) {
+            std::cerr << "--theta above 1 would accept overlapping cells for fmm\n";
+            return EXIT_FAILURE;
+        }
+        fmm->theta = opts.theta;
+        fmm->order = opts.order;
+        fmm->max_drift = opts.max_drift;
+    } else if (auto* pm = dynamic_cast<PmEngine*>(engine.get())) {
+        pm->mesh = opts.mesh;
+    } else if (auto* pairwise = dynamic_cast<PairwiseEngine*>(engine.get())) {
+        pairwise->precision = opts.precision;
+        pairwise->softening = opts.softening;
+    }
+
+    ThreadPool pool(opts.threads);
+    engine->pool = &pool;
+    engine->deterministic = opts.deterministic;
+
+    Simulation sim;
+    if (opts.load.empty()) {
+        sim.reset(make_system(opts.system, opts.seed, opts.bodies, {opts.size, opts.size}, &pool));
+    } else {
+        const auto checkpoint = Checkpoint::open(opts.load);
+        if (!checkpoint) {
+            std::cerr << checkpoint.error() << '\n';
+            return EXIT_FAILURE;
+        }
+        checkpoint->restore(sim);
+    }
+    sim.set_engine(engine.get());
+    sim.pool = &pool;
+    sim.collisions = opts.collisions.value_or(opts.load.empty() ? CollisionMode::BROADPHASE
+                                                                : sim.collisions);
+    sim.integrator = opts.integrator.value_or(opts.load.empty() ? Integrator::EULER
+                                                                : sim.integrator);
+    sim.reorder_every = opts.reorder_every.value_or(sim.reorder_every);
+    sim.diagnostics_every = opts.diagnostics_every;
+    if (opts.bounded) {
+        sim.bounds = Rectangle {0.0f, 0.0f, opts.size, opts.size};
+    }
+
+    std::cout << std::format("{} bodies, {} {} steps of {} s, engine {}, {} collisions, "
+                             "{} threads\n",
+                             sim.bodies().size(), opts.steps, integrator_name(sim.integrator),
+                             opts.dt, engine->name(), collision_mode_name(sim.collisions),
+                             pool.size());
+
+    if (opts.accuracy) {
+        const auto bodies = sim.bodies();
+        std::vector<Vector2> reference(bodies.size()), approx(bodies.size());
+        PairwiseEngine pairwise(Precision::DOUBLE);
+        pairwise.pool = &pool;
+        // as the simulation will set it for the steps
+        pairwise.collisions = engine->collisions = sim.collisions == CollisionMode::KERNEL;
+        pairwise.compute(bodies, reference, opts.dt);
+        engine->compute(bodies, approx, opts.dt);
+        const AccuracyReport report = compare_accelerations(reference, approx);
+        std::cout << std::format("max err {:.2e}, rms err {:.2e} against pairwise in double\n",
+                                 report.max_rel_err, report.rms_rel_err);
+    }
+
+    std::unique_ptr<TrajectoryWriter> trajectory;
+    if (!opts.trajectory.empty()) {
+        auto writer = TrajectoryWriter::open(opts.trajectory, opts.trajectory_options);
+        if (!writer) {
+            std::cerr << writer.error() << '\n';
+            return EXIT_FAILURE;
+        }
+        trajectory = std::move(*writer);
+    }
+
+    std::optional<TelemetryWriter> telemetry;
+    if (!opts.profile.empty()) {
+        auto writer = TelemetryWriter::open(opts.profile, opts.diagnostics_every != 0);
+        if (!writer) {
+            std::cerr << writer.error() << '\n';
+            return EXIT_FAILURE;
+        }
+        telemetry = std::move(*writer);
+    }
+    PhaseProfile profile;
+    std::array<DurationHistogram, PHASE_COUNT> phase_times;
+
+    std::uint64_t interactions = 0;
+    // the largest energy drift of any sample
+    double max_energy_drift = 0.0;
+    // with NBODY_COUNT_ALLOCATIONS: allocations made while stepping once the buffers have grown
+    const std::uint64_t warmup = std::max<std::uint64_t>(opts.steps / 10, 2);
+    std::uint64_t steady_allocations = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (std::uint64_t s = 0; s < opts.steps; s++) {
+        const std::uint64_t allocations = heap_allocations();
+        sim.step(opts.dt);
+        interactions += sim.interactions();
+        profile += sim.profile();
+        for (Phase phase : STEP_PHASES) {
+            phase_times[static_cast<std::size_t>(phase)].add(sim.profile().time(phase));
+        }
+        const Diagnostics* sample = nullptr;
+        if (sim.diagnostics() && sim.diagnostics()->step == sim.step_count()) {
+            sample = &*sim.diagnostics();
+            const double drift =
+                diagnostics_drift(*sim.initial_diagnostics(), *sample).energy;
+            max_energy_drift = std::max(max_energy_drift, std::abs(drift));
+        }
+        if (telemetry) {
+            telemetry->write(sim.step_count(), sim.time(), sim.profile(), sample,
+                             sample ? &*sim.initial_diagnostics() : nullptr);
+        }
+        if (trajectory) {
+            trajectory->record(sim.step_count(), sim.time(), sim.bodies(), sim.ids());
+        }
+        if (s >= warmup) {
+            steady_allocations += heap_allocations() - allocations;
+        }
+        const bool last = s + 1 == opts.steps;
+        if (!opts.checkpoint.empty() &&
+            (last || (opts.checkpoint_every != 0 && (s + 1) % opts.checkpoint_every == 0))) {
+            if (const auto saved = save_checkpoint(opts.checkpoint, sim); !saved) {
+                std::cerr << saved.error() << '\n';
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    const double seconds = elapsed.count();
+    std::cout << std::format("{:.3f} s, {:.1f} steps/s, {:.3e} interactions/s, {} bodies left\n",
+                             seconds, opts.steps / seconds, interactions / seconds,
+                             sim.bodies().size());
+    std::cout << std::format("state hash {:016x}\n", state_hash(sim));
+    if (sim.diagnostics() && sim.initial_diagnostics()) {
+        const DiagnosticsDrift drift =
+            diagnostics_drift(*sim.initial_diagnostics(), *sim.diagnostics());
+        std::cout << std::format("energy drift {:+.3e} (largest {:.3e}), momentum drift {:.3e}, "
+                                 "angular momentum drift {:+.3e} since step {}\n",
+                                 drift.energy, max_energy_drift, drift.momentum,
+                                 drift.angular_momentum, sim.initial_diagnostics()->step);
+    }
+    for (Phase phase : STEP_PHASES) {
+        const DurationHistogram& times = phase_times[static_cast<std::size_t>(phase)];
+        std::cout << std::format("  {:<12}{:8.3f} s {:5.1f}%, p50 {:.3e} s, p99 {:.3e} s, {} {}\n",
+                                 phase_name(phase), profile.time(phase),
+                                 100.0 * profile.time(phase) / seconds, times.percentile(0.5),
+                                 times.percentile(0.99), profile.count(phase),
+                                 phase_count_name(phase));
+    }
+    if (telemetry) {
+        if (const auto closed = telemetry->close(); !closed) {
+            std::cerr << closed.error() << '\n';
+            return EXIT_FAILURE;
+        }
+    }
+    if (COUNTING_ALLOCATIONS && opts.steps > warmup) {
+        std::cout << std::format("{} heap allocations in the last {} steps\n", steady_allocations,
+                                 opts.steps - warmup);
+    }
+    if (trajectory) {
+        if (const auto closed = trajectory->close(); !closed) {
+            std::cerr << closed.error() << '\n';
+            return EXIT_FAILURE;
+        }
+        std::cout << std::format("{} trajectory frames written, {} dropped\n",
+                                 trajectory->frames_written(), trajectory->frames_dropped());
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,379 @@
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <mpi.h>
+
+#include "src/checkpoint.hpp"
+#include "src/distributed.hpp"
+#include "src/gravity.hpp"
+#include "src/simulation.hpp"
+#include "src/system.hpp"
+#include "src/thread_pool.hpp"
+
+// headless runner for one system spread over the ranks of an MPI job: every rank simulates the
+// bodies of its stretch of the Z-order curve and rank 0 reports for all of them
+
+struct Options {
+    std::string engine = "barnes-hut";
+    std::string system = "solar";
+    int bodies = 1000;
+    std::uint64_t steps = 1000;
+    float dt = 1.0f / 60.0f;
+    float theta = 0.5f;
+    unsigned threads = 1;
+    std::uint64_t seed = 0;
+    float size = 1000.0f;
+    std::optional<CollisionMode> collisions;
+    std::optional<Integrator> integrator;
+    std::uint64_t rebalance_every = 16;
+    std::uint64_t diagnostics_every = 0;
+    std::string load;
+    std::string checkpoint;
+};
+
+// the engines whose compute_subset sums just the targets, which is what this rank's bodies are
+// among the ones it received
+static constexpr std::string_view LOCAL_ENGINES[] = {"pairwise", "pairwise-simd", "barnes-hut"};
+
+static void print_usage(const char* argv0) {
+    std::cerr << std::format("usage: mpirun -np RANKS {} [options]\n", argv0)
+              << "  --engine NAME   force engine of every rank, one of:";
+    for (auto name : LOCAL_ENGINES) {
+        std::cerr << ' ' << name;
+    }
+    std::cerr << "\n"
+                 "  --system NAME   initial conditions, one of:";
+    for (auto name : system_names()) {
+        std::cerr << ' ' << name;
+    }
+    std::cerr << "\n"
+                 "                  (default solar, one sun plus N - 1 planets)\n"
+                 "  --bodies N      body count over all ranks (default 1000)\n"
+                 "  --steps N       steps to run (default 1000)\n"
+                 "  --dt S          fixed timestep in seconds (default 1/60)\n"
+                 "  --theta T       opening angle of the cells sent to the other ranks, and of\n"
+                 "                  the local Barnes-Hut engine; 0 sends every body (default 0.5)\n"
+                 "  --threads N     worker threads per rank including the main one (default 1)\n"
+                 "  --seed N        seed for the initial conditions (default 0)\n"
+                 "  --size S        side of the square the system is generated in (default 1000)\n"
+                 "  --collisions M  none or kernel (default kernel)\n"
+                 "  --integrator I  euler, leapfrog or yoshida4 (default euler)\n"
+                 "  --rebalance-every N\n"
+                 "                  steps between redistributions of the bodies by the measured\n"
+                 "                  force time of each rank, 0 for never (default 16)\n"
+                 "  --diagnostics-every N\n"
+                 "                  sample the energy and momenta every N steps and report their\n"
+                 "                  drift (default 0: never)\n"
+                 "  --load PATH     start from a checkpoint instead of a generated system\n"
+                 "  --checkpoint PATH\n"
+                 "                  write a checkpoint from rank 0 at the end of the run\n";
+}
+
+template<class T>
+static bool parse_number(std::string_view text, T& out) {
+    const auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), out);
+    return ec == std::errc {} && ptr == text.data() + text.size();
+}
+
+static bool parse_options(int argc, char** argv, Options& opts) {
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        if (i + 1 == argc) {
+            return false;
+        }
+        const std::string_view value = argv[++i];
+        bool ok = true;
+        if (arg == "--engine") {
+            opts.engine = value;
+            ok = std::ranges::find(LOCAL_ENGINES, value) != std::end(LOCAL_ENGINES);
+        } else if (arg == "--system") {
+            opts.system = value;
+            ok = std::ranges::find(system_names(), value) != system_names().end();
+        } else if (arg == "--bodies") {
+            ok = parse_number(value, opts.bodies) && opts.bodies >= 2;
+        } else if (arg == "--steps") {
+            ok = parse_number(value, opts.steps);
+        } else if (arg == "--dt") {
+            ok = parse_number(value, opts.dt) && opts.dt > 0.0f;
+        } else if (arg == "--theta") {
+            ok = parse_number(value, opts.theta) && opts.theta >= 0.0f;
+        } else if (arg == "--threads") {
+            ok = parse_number(value, opts.threads) && opts.threads >= 1;
+        } else if (arg == "--seed") {
+            ok = parse_number(value, opts.seed);
+        } else if (arg == "--size") {
+            ok = parse_number(value, opts.size) && opts.size > 0.0f;
+        } else if (arg == "--collisions") {
+            // the broadphase and merging would only see the bodies of one rank
+            ok = false;
+            for (auto mode : {CollisionMode::NONE, CollisionMode::KERNEL}) {
+                if (value == collision_mode_name(mode)) {
+                    opts.collisions = mode;
+                    ok = true;
+                }
+            }
+        } else if (arg == "--integrator") {
+            // the block integrator picks its evaluations from the bodies of each rank
+            ok = false;
+            for (auto integrator :
+                 {Integrator::EULER, Integrator::LEAPFROG, Integrator::YOSHIDA4}) {
+                if (value == integrator_name(integrator)) {
+                    opts.integrator = integrator;
+                    ok = true;
+                }
+            }
+        } else if (arg == "--rebalance-every") {
+            ok = parse_number(value, opts.rebalance_every);
+        } else if (arg == "--diagnostics-every") {
+            ok = parse_number(value, opts.diagnostics_every);
+        } else if (arg == "--load") {
+            opts.load = value;
+        } else if (arg == "--checkpoint") {
+            opts.checkpoint = value;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the sample of every rank added up into that of the whole system
+static Diagnostics reduce_diagnostics(MPI_Comm comm, const Diagnostics& local) {
+    double sums[] = {local.kinetic,          local.potential,
+                     local.momentum_x,       local.momentum_y,
+                     local.angular_momentum, local.momentum_scale,
+                     local.angular_momentum_scale};
+    MPI_Allreduce(MPI_IN_PLACE, sums, std::size(sums), MPI_DOUBLE, MPI_SUM, comm);
+    Diagnostics total = local;
+    total.kinetic = sums[0];
+    total.potential = sums[1];
+    total.momentum_x = sums[2];
+    total.momentum_y = sums[3];
+    total.angular_momentum = sums[4];
+    total.momentum_scale = sums[5];
+    total.angular_momentum_scale = sums[6];
+    return total;
+}
+
+// FNV-1a over the bodies and their ids in id order, which does not depend on the rank count
+// the way the order of the bodies does
+static std::uint64_t state_hash(std::span<const Body> bodies, std::span<const std::uint32_t> ids) {
+    std::vector<std::uint32_t> order(bodies.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::ranges::sort(order, {}, [&](std::uint32_t i) { return ids[i]; });
+    std::uint64_t hash = 0xCBF29CE484222325;
+    const auto add = [&](std::span<const std::byte> bytes) {
+        for (std::byte b : bytes) {
+            hash = (hash ^ static_cast<std::uint64_t>(b)) * 0x100000001B3;
+        }
+    };
+    for (std::uint32_t i : order) {
+        add(std::as_bytes(bodies.subspan(i, 1)));
+        add(std::as_bytes(ids.subspan(i, 1)));
+    }
+    return hash;
+}
+
+// every rank's bodies and ids, concatenated in rank order on rank 0 and empty elsewhere
+static void gather_bodies(MPI_Comm comm, const Simulation& sim, std::vector<Body>& bodies,
+                          std::vector<std::uint32_t>& ids) {
+    int rank = 0, ranks = 1;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+    const int count = static_cast<int>(sim.bodies().size());
+    std::vector<int> counts(ranks), displs(ranks);
+    MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, comm);
+    std::exclusive_scan(counts.begin(), counts.end(), displs.begin(), 0);
+    const int total = rank == 0 ? displs.back() + counts.back() : 0;
+    bodies.resize(total);
+    ids.resize(total);
+    MPI_Gatherv(sim.ids().data(), count, MPI_UINT32_T, ids.data(), counts.data(), displs.data(),
+                MPI_UINT32_T, 0, comm);
+    for (int& c : counts) {
+        c *= sizeof(Body);
+    }
+    for (int& d : displs) {
+        d *= sizeof(Body);
+    }
+    MPI_Gatherv(sim.bodies().data(), count * static_cast<int>(sizeof(Body)), MPI_BYTE,
+                bodies.data(), counts.data(), displs.data(), MPI_BYTE, 0, comm);
+}
+
+static int run(int argc, char** argv) {
+    const MPI_Comm comm = MPI_COMM_WORLD;
+    int rank = 0, ranks = 1;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+    const bool root = rank == 0;
+
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        if (root) {
+            print_usage(argv[0]);
+        }
+        return EXIT_FAILURE;
+    }
+    if (opts.system == "galaxy-pair" && opts.bodies < 4) {
+        if (root) {
+            std::cerr << "galaxy-pair needs at least 4 bodies\n";
+        }
+        return EXIT_FAILURE;
+    }
+    auto local = make_force_engine(opts.engine);
+    if (auto* barnes_hut = dynamic_cast<BarnesHutEngine*>(local.get())) {
+        barnes_hut->theta = opts.theta;
+    }
+    ThreadPool pool(opts.threads);
+    DistributedEngine engine(comm, *local);
+    engine.theta = opts.theta;
+    engine.pool = &pool;
+
+    // every rank makes or loads the whole system and starts from an even share of it, which the
+    // first rebalance turns into its stretch of the curve; dropped once the share is taken
+    auto whole = std::make_unique<Simulation>();
+    if (opts.load.empty()) {
+        whole->reset(
+            make_system(opts.system, opts.seed, opts.bodies, {opts.size, opts.size}, &pool));
+    } else {
+        const auto checkpoint = Checkpoint::open(opts.load);
+        if (!checkpoint) {
+            if (root) {
+                std::cerr << checkpoint.error() << '\n';
+            }
+            return EXIT_FAILURE;
+        }
+        checkpoint->restore(*whole);
+    }
+    const std::size_t n = whole->bodies().size();
+    const std::size_t first = rank * n / ranks;
+    const std::size_t last = (rank + 1) * n / ranks;
+    Simulation sim;
+    sim.restore({whole->bodies().begin() + first, whole->bodies().begin() + last},
+                whole->step_count(), whole->time(), {}, {},
+                whole->ids().subspan(first, last - first));
+    sim.set_engine(&engine);
+    sim.pool = &pool;
+    sim.collisions = opts.collisions.value_or(
+        opts.load.empty() || whole->collisions != CollisionMode::NONE ? CollisionMode::KERNEL
+                                                                      : CollisionMode::NONE);
+    sim.integrator = opts.integrator.value_or(
+        opts.load.empty() || whole->integrator == Integrator::BLOCK ? Integrator::EULER
+                                                                    : whole->integrator);
+    sim.diagnostics_every = opts.diagnostics_every;
+    whole.reset();
+    rebalance(comm, sim, 0.0);
+
+    if (root) {
+        std::cout << std::format("{} bodies on {} ranks, {} {} steps of {} s, engine {}, "
+                                 "{} collisions, {} threads per rank\n",
+                                 n, ranks, opts.steps, integrator_name(sim.integrator), opts.dt,
+                                 engine.name(), collision_mode_name(sim.collisions), pool.size());
+    }
+
+    // rebalancing resets the simulation's own baseline, so the drift is measured from here instead
+    std::optional<Diagnostics> initial, latest;
+    double max_energy_drift = 0.0;
+    std::uint64_t interactions = 0;
+    std::uint64_t received = 0;
+    double force_seconds = 0.0, exchange_seconds = 0.0;
+    MPI_Barrier(comm);
+    const double start = MPI_Wtime();
+    for (std::uint64_t s = 0; s < opts.steps; s++) {
+        sim.step(opts.dt);
+        interactions += sim.interactions();
+        received += engine.received();
+        if (!initial && sim.initial_diagnostics()) {
+            initial = reduce_diagnostics(comm, *sim.initial_diagnostics());
+        }
+        if (sim.diagnostics() && sim.diagnostics()->step == sim.step_count()) {
+            latest = reduce_diagnostics(comm, *sim.diagnostics());
+            max_energy_drift =
+                std::max(max_energy_drift, std::abs(diagnostics_drift(*initial, *latest).energy));
+        }
+        if (opts.rebalance_every != 0 && (s + 1) % opts.rebalance_every == 0 &&
+            s + 1 != opts.steps) {
+            force_seconds += engine.force_seconds();
+            exchange_seconds += engine.exchange_seconds();
+            rebalance(comm, sim, engine.force_seconds());
+            engine.reset_timers();
+        }
+    }
+    MPI_Barrier(comm);
+    const double seconds = MPI_Wtime() - start;
+    force_seconds += engine.force_seconds();
+    exchange_seconds += engine.exchange_seconds();
+
+    // how evenly the work came out: the slowest rank's force time against the mean
+    double force_max = force_seconds, force_sum = force_seconds, exchange_sum = exchange_seconds;
+    MPI_Allreduce(MPI_IN_PLACE, &force_max, 1, MPI_DOUBLE, MPI_MAX, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &force_sum, 1, MPI_DOUBLE, MPI_SUM, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &exchange_sum, 1, MPI_DOUBLE, MPI_SUM, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &interactions, 1, MPI_UINT64_T, MPI_SUM, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &received, 1, MPI_UINT64_T, MPI_SUM, comm);
+    std::uint64_t counts[] = {sim.bodies().size(), sim.bodies().size()};
+    MPI_Allreduce(MPI_IN_PLACE, &counts[0], 1, MPI_UINT64_T, MPI_MIN, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &counts[1], 1, MPI_UINT64_T, MPI_MAX, comm);
+
+    std::vector<Body> bodies;
+    std::vector<std::uint32_t> ids;
+    gather_bodies(comm, sim, bodies, ids);
+    if (!root) {
+        return EXIT_SUCCESS;
+    }
+    std::cout << std::format("{:.3f} s, {:.1f} steps/s, {:.3e} interactions/s, {} bodies left\n",
+                             seconds, opts.steps / seconds, interactions / seconds,
+                             bodies.size());
+    const double force_mean = force_sum / ranks;
+    const double received_per_step =
+        static_cast<double>(received) / ranks / std::max<std::uint64_t>(opts.steps, 1);
+    std::cout << std::format("force time per rank: mean {:.3f} s, max {:.3f} s ({:.2f}x), "
+                             "exchange {:.1f}% of force+exchange, {:.0f} bodies and cells "
+                             "received per rank and step\n",
+                             force_mean, force_max, force_mean > 0.0 ? force_max / force_mean : 1.0,
+                             100.0 * exchange_sum / std::max(exchange_sum + force_sum, 1e-12),
+                             received_per_step);
+    std::cout << std::format("bodies per rank: {} to {}\n", counts[0], counts[1]);
+    std::cout << std::format("state hash {:016x}\n", state_hash(bodies, ids));
+    if (initial && latest) {
+        const DiagnosticsDrift drift = diagnostics_drift(*initial, *latest);
+        std::cout << std::format("energy drift {:+.3e} (largest {:.3e}), momentum drift {:.3e}, "
+                                 "angular momentum drift {:+.3e} since step {}\n",
+                                 drift.energy, max_energy_drift, drift.momentum,
+                                 drift.angular_momentum, initial->step);
+    }
+    if (!opts.checkpoint.empty()) {
+        // the integrator state stays behind on the ranks, so a run from it starts the next step
+        // with fresh accelerations
+        Simulation saved;
+        saved.restore(std::move(bodies), sim.step_count(), sim.time(), {}, {}, ids);
+        saved.collisions = sim.collisions;
+        saved.integrator = sim.integrator;
+        if (const auto written = save_checkpoint(opts.checkpoint, saved); !written) {
+            std::cerr << written.error() << '\n';
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    MPI_Init(&argc, &argv);
+    const int status = run(argc, argv);
+    MPI_Finalize();
+    return status;
+}
@@ -1,93 +1,288 @@
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <format>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
 #include <optional>
 #include <random>
-#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include <raylib.h>
 #include <raymath.h>
 
-namespace stdv = std::views;
-
-constexpr float GRAVITY = 3e2f;
-constexpr float DIST_EPS = 1e-4f;
-constexpr float COLL_EPS = 1.0f;
+#include "src/allocation_counter.hpp"
+#include "src/body.hpp"
+#include "src/body_culler.hpp"
+#include "src/body_renderer.hpp"
+#include "src/checkpoint.hpp"
+#include "src/fixed_timestep.hpp"
+#include "src/fmm_gravity.hpp"
+#ifdef NBODY_GPU
+#include "src/gpu_gravity.hpp"
+#endif
+#include "src/gravity.hpp"
+#include "src/pm_gravity.hpp"
+#include "src/profiler.hpp"
+#include "src/simd_gravity.hpp"
+#include "src/simulation.hpp"
+#include "src/simulation_thread.hpp"
+#include "src/system.hpp"
+#include "src/thread_pool.hpp"
+#include "src/trajectory_writer.hpp"
 
 constexpr int WIDTH = 960;
 constexpr int HEIGHT = 540;
+constexpr int FPS = 60;
+// saved with F5 and loaded with F9
+constexpr const char* CHECKPOINT_PATH = "nbody.ckpt";
+// bodies the simulation and its snapshots have room for before adding one allocates
+constexpr std::size_t BODY_CAPACITY = 4096;
+// steps between samples of the energy and momenta while E shows their drift
+constexpr std::uint64_t DIAGNOSTICS_EVERY = 30;
 
-struct Body {
-    float mass;
-    float radius;
-    Vector2 pos;
-    Vector2 vel;
-    Color color;
+// mass per unit area that get_random_system gives the planets around `sun`
+static float planet_density(const Body& sun) {
+    return sun.mass / (sun.radius * sun.radius) * 1e-2f;
+}
 
-    void update(Vector2 acc, float dt) {
-        vel += acc * dt;
-        pos += vel * dt;
-    }
-};
+// formats into `buf`, truncating what does not fit, so that the per-frame text never allocates
+template<std::size_t N, class... Args>
+static const char* format_text(std::array<char, N>& buf, std::format_string<Args...> fmt,
+                               Args&&... args) {
+    const auto result = std::format_to_n(buf.data(), N - 1, fmt, std::forward<Args>(args)...);
+    *result.out = '\0';
+    return buf.data();
+}
 
-static Color get_random_color(std::default_random_engine& eng) {
-    std::uniform_int_distribution color_dist(0, 0xFFFFFF);
-    return GetColor((color_dist(eng) << 8) + 0xFF);
+static float seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
 }
 
-static std::vector<Body> get_random_system(std::default_random_engine& eng, int min_planets,
-                                           int max_planets) {
-    assert(1 <= min_planets && min_planets <= max_planets);
-    std::binomial_distribution planet_num_dist(max_planets - min_planets);
-    int n_planets = planet_num_dist(eng) + min_planets;
-
-    const float max_rad = std::min(WIDTH, HEIGHT) / 2.0f;
-    // outermost orbit approaches max_rad (edge) as n_planets increases
-    const float mean_distance = max_rad / (n_planets + 1);
-    std::normal_distribution distance_dist(mean_distance, mean_distance * 0.1f);
-    std::uniform_real_distribution angle_dist(0.0f, 2.0f * PI);
-
-    constexpr float SOLAR_MASS = 1e4f;
-    const float sun_radius = /* starts at 0.2x mean distance and gradually approaches 0.5x */
-        mean_distance * (std::pow(0.3f, n_planets) - std::pow(0.6f, n_planets) + 0.5f);
-    const float density = SOLAR_MASS / (sun_radius * sun_radius);
-
-    const Vector2 center {WIDTH / 2.0f, HEIGHT / 2.0f};
-    std::vector<Body> bodies(n_planets + 1);
-    bodies[0] = {SOLAR_MASS, sun_radius, center, {}, get_random_color(eng)};
-
-    float distance = 0.0f;
-    for (auto& body : bodies | stdv::drop(1)) {
-        distance += distance_dist(eng);
-        Vector2 pos_dir = Vector2Rotate(Vector2UnitX, angle_dist(eng));
-        body.pos = center + pos_dir * distance;
-
-        // outer planets are larger on average
-        const float mean_rad = (distance / max_rad * 0.4f + 0.2f) * sun_radius;
-        std::normal_distribution rad_dist(mean_rad, mean_rad * 0.2f);
-        body.radius = rad_dist(eng);
-        // pretend planets are much smaller for visual reasons
-        body.mass = body.radius * body.radius * density * 1e-2f;
-
-        Vector2 vel_dir = Vector2Rotate(pos_dir, PI / 2.0f);
-        body.vel = vel_dir * std::sqrt(GRAVITY * SOLAR_MASS / distance);
-        body.color = get_random_color(eng);
+// one row per phase and one for the whole frame: the latest, median and 99th percentile time in ms,
+// the latest work count and a plot of the recent samples scaled to their maximum
+static void draw_profile(Vector2 origin, const std::array<RollingSamples, PHASE_COUNT>& phase_ms,
+                         const RollingSamples& frame_ms, const PhaseProfile& latest) {
+    constexpr int FONT = 10;
+    constexpr float ROW = 16.0f;
+    constexpr float PLOT_X = 330.0f;
+    constexpr float PANEL_WIDTH = PLOT_X + RollingSamples::CAPACITY + 8.0f;
+    DrawRectangleV(origin, {PANEL_WIDTH, ROW * (PHASE_COUNT + 1) + 8.0f}, {255, 255, 255, 200});
+
+    std::array<char, 96> text;
+    const auto row = [&](int index, const char* name, const RollingSamples& samples,
+                         std::uint64_t count, const char* count_name, Color color) {
+        const Vector2 pos = origin + Vector2 {4.0f, 4.0f + ROW * static_cast<float>(index)};
+        DrawText(name, static_cast<int>(pos.x), static_cast<int>(pos.y) + 3, FONT, DARKGRAY);
+        const float latest_ms = samples.size() == 0 ? 0.0f : samples[samples.size() - 1];
+        format_text(text, "{:7.3f} p50 {:7.3f} p99 {:7.3f} ms", latest_ms,
+                    samples.percentile(0.5f), samples.percentile(0.99f));
+        DrawText(text.data(), static_cast<int>(pos.x) + 70, static_cast<int>(pos.y) + 3, FONT,
+                 DARKGRAY);
+        if (count_name != nullptr) {
+            format_text(text, "{} {}", count, count_name);
+            DrawText(text.data(), static_cast<int>(pos.x) + 240, static_cast<int>(pos.y) + 3,
+                     FONT, GRAY);
+        }
+        const float max = samples.max();
+        for (std::size_t i = 0; max > 0.0f && i < samples.size(); i++) {
+            const float height = (ROW - 2.0f) * samples[i] / max;
+            DrawRectangleV({pos.x + PLOT_X + static_cast<float>(i), pos.y + ROW - 1.0f - height},
+                           {1.0f, height}, color);
+        }
+    };
+    constexpr Color COLORS[PHASE_COUNT] = {GRAY, RED, ORANGE, BLUE, PURPLE, MAROON, DARKGREEN};
+    for (std::size_t p = 0; p < PHASE_COUNT; p++) {
+        const auto phase = static_cast<Phase>(p);
+        row(static_cast<int>(p), phase_name(phase), phase_ms[p], latest.count(phase),
+            phase == Phase::INPUT ? nullptr : phase_count_name(phase), COLORS[p]);
     }
-    return bodies;
+    row(PHASE_COUNT, "frame", frame_ms, 0, nullptr, BLACK);
 }
 
-int main() {
+int main(int argc, char** argv) {
+    unsigned threads = std::thread::hardware_concurrency();
+    int substeps = 4;
+    std::string_view load_path;
+    std::string_view trajectory_path;
+    TrajectoryOptions trajectory_options;
+    std::string_view system_name = "solar";
+    int system_bodies = 0; // with solar, 0 picks 2 to 15 planets
+    std::optional<unsigned> seed; // of the generated systems, random if unset
+    const bool deterministic =
+        std::ranges::any_of(std::span(argv + 1, argv + argc), [](const char* arg) {
+            return std::string_view(arg) == "--deterministic";
+        });
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string_view(argv[i]) == "--threads") {
+            threads = static_cast<unsigned>(std::max(std::atoi(argv[++i]), 1));
+        } else if (std::string_view(argv[i]) == "--substeps") {
+            substeps = std::max(std::atoi(argv[++i]), 1);
+        } else if (std::string_view(argv[i]) == "--load") {
+            load_path = argv[++i];
+        } else if (std::string_view(argv[i]) == "--trajectory") {
+            trajectory_path = argv[++i];
+        } else if (std::string_view(argv[i]) == "--trajectory-every") {
+            trajectory_options.decimation = std::max(std::atoi(argv[++i]), 1);
+        } else if (std::string_view(argv[i]) == "--system") {
+            system_name = argv[++i];
+        } else if (std::string_view(argv[i]) == "--bodies") {
+            system_bodies = std::max(std::atoi(argv[++i]), 4);
+        } else if (std::string_view(argv[i]) == "--seed") {
+            seed = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        }
+    }
+    if (std::ranges::find(system_names(), system_name) == system_names().end()) {
+        TraceLog(LOG_ERROR, "unknown system '%s'", system_name.data());
+        return EXIT_FAILURE;
+    }
+    ThreadPool pool(threads);
+
     std::random_device r;
-    std::default_random_engine e(r());
-    auto bodies = get_random_system(e, 2, 15);
-    float sys_density = bodies[0].mass / (bodies[0].radius * bodies[0].radius) * 1e-2f;
+    std::default_random_engine e(seed ? *seed : r());
+    // a fresh system of the kind picked on the command line, for the start and the reset button;
+    // `workers` is nullptr while the simulation thread is stepping with the pool
+    const auto generate_system = [&](ThreadPool* workers) {
+        if (system_name == "solar" && system_bodies == 0) {
+            return get_random_system(e, 2, 15, {WIDTH, HEIGHT});
+        }
+        return make_system(system_name, e(), system_bodies == 0 ? 10000 : system_bodies,
+                           {WIDTH, HEIGHT}, workers);
+    };
+    // the world has no edge, so the bodies that leave the window stay in the simulation
+    Simulation sim(generate_system(&pool));
+    sim.pool = &pool;
+    sim.reserve(BODY_CAPACITY);
+    if (!load_path.empty()) {
+        const auto checkpoint = Checkpoint::open(load_path);
+        if (!checkpoint) {
+            TraceLog(LOG_ERROR, "%s", checkpoint.error().c_str());
+            return EXIT_FAILURE;
+        }
+        checkpoint->restore(sim);
+    }
+    // recorded from whichever thread steps the simulation; the writer does the I/O on its own
+    std::unique_ptr<TrajectoryWriter> trajectory;
+    if (!trajectory_path.empty()) {
+        auto writer = TrajectoryWriter::open(trajectory_path, trajectory_options);
+        if (!writer) {
+            TraceLog(LOG_ERROR, "%s", writer.error().c_str());
+            return EXIT_FAILURE;
+        }
+        trajectory = std::move(*writer);
+    }
+    const auto record = [&trajectory](const Simulation& s) {
+        if (trajectory) {
+            trajectory->record(s.step_count(), s.time(), s.bodies(), s.ids());
+        }
+    };
+    float sys_density = sim.bodies().empty() ? 1.0f : planet_density(sim.bodies()[0]);
 
-    std::vector<Vector2> acc(bodies.size());
     std::optional<Body> new_body {};
 
+    PairwiseEngine pairwise;
+    SymmetricPairwiseEngine pairwise_symmetric;
+    SimdPairwiseEngine pairwise_simd;
+    BarnesHutEngine barnes_hut;
+    FmmEngine fmm;
+    PmEngine p3m;
+    std::vector<ForceEngine*> engines = {&pairwise, &pairwise_symmetric, &pairwise_simd,
+                                         &barnes_hut, &fmm, &p3m};
+    std::size_t engine_idx = 0;
+    ForceEngine* engine = engines[engine_idx];
+    for (ForceEngine* eng : engines) {
+        eng->pool = &pool;
+        eng->deterministic = deterministic;
+    }
+    // what V measures the current engine against, including the float pairwise sum
+    PairwiseEngine reference(Precision::DOUBLE);
+    reference.pool = &pool;
+    sim.set_engine(engine);
+    std::optional<AccuracyReport> accuracy {};
+    std::future<AccuracyReport> pending_accuracy {};
+
+    // settings as last sent to the simulation, which the UI must not read while the thread runs
+    CollisionMode collisions = sim.collisions;
+    Integrator integrator = sim.integrator;
+    float theta = barnes_hut.theta;
+    int fmm_order = fmm.order;
+
+    // `substeps` physics steps per frame at the target rate, catching up at most 4 frames. The
+    // block integrator subdivides on its own and takes one step per frame.
+    const auto fixed_timestep = [&](Integrator integrator) {
+        const int n = integrator == Integrator::BLOCK ? 1 : substeps;
+        return FixedTimestep {.dt = 1.0f / (FPS * n), .max_steps = 4 * n};
+    };
+    FixedTimestep timestep = fixed_timestep(integrator);
+
     InitWindow(WIDTH, HEIGHT, "nbody");
-    SetTargetFPS(60);
+    SetTargetFPS(FPS);
+
+    // falls back to a DrawCircleV per body without GL 3.3
+    std::optional<BodyRenderer> renderer {};
+    if (BodyRenderer::available()) {
+        renderer.emplace();
+    }
+
+    // with G the GPU engine takes over the whole system and steps it on the device; `sim` is then
+    // only brought up to date when the system is edited or handed back
+    bool gpu_resident = false;
+    // engine that needs the GL context and so has to run on this thread
+    ForceEngine* main_thread_engine = nullptr;
+#ifdef NBODY_GPU
+    // compute shaders need the window's context
+    std::optional<GpuPairwiseEngine> pairwise_gpu {};
+    if (GpuPairwiseEngine::available()) {
+        pairwise_gpu.emplace();
+        engines.push_back(&*pairwise_gpu);
+        main_thread_engine = &*pairwise_gpu;
+    }
+    std::vector<Body> device_bodies;
+#endif
+    const auto pull_from_device = [&] {
+#ifdef NBODY_GPU
+        if (gpu_resident) {
+            pairwise_gpu->download(device_bodies);
+            sim.reset(std::move(device_bodies));
+        }
+#endif
+    };
+    const auto push_to_device = [&] {
+#ifdef NBODY_GPU
+        if (gpu_resident) {
+            pairwise_gpu->upload(sim.bodies());
+        }
+#endif
+    };
+
+    // the physics runs on its own thread unless it needs the GL context; the frames then draw the
+    // latest snapshot, interpolated from the one before
+    std::optional<SimulationThread> sim_thread {};
+    SimulationSnapshot snapshot {};
+    SimulationSnapshot prev_snapshot {};
+    std::vector<Body> interpolated;
+    interpolated.reserve(BODY_CAPACITY);
+    // index in prev_snapshot of every body id, -1 for the ids it does not have
+    std::vector<int> prev_index;
+    prev_index.reserve(BODY_CAPACITY);
+    // runs on the simulation thread when there is one, right away otherwise
+    const auto with_sim = [&](std::function<void(Simulation&)> command) {
+        if (sim_thread.has_value()) {
+            sim_thread->post(std::move(command));
+        } else {
+            command(sim);
+        }
+    };
 
     const Vector2 margin = {WIDTH / 100.0f, HEIGHT / 100.0f};
     const auto reset_text = "reset system";
@@ -99,94 +294,411 @@ int main() {
                                reset_btn_size.y};
     enum { NONE, HOVER, DOWN } reset_btn_state = NONE;
 
+    // the right or middle button pans, the wheel zooms around the cursor and Home goes back to
+    // the window's rectangle of the world
+    constexpr Camera2D home_camera = {.offset = {}, .target = {}, .rotation = 0.0f, .zoom = 1.0f};
+    Camera2D camera = home_camera;
+    // what of `shown` is in view, with the far away clusters drawn as one sprite each
+    BodyCuller culler;
+
+    // the text drawn every frame is formatted into these
+    std::array<char, 32> counter_text;
+    std::array<char, 128> engine_text, label_text;
+    std::array<char, 64> accuracy_text, allocation_text;
+    std::array<char, 128> diagnostics_text;
+    // E shows the drift of the conserved quantities, which are only sampled meanwhile
+    bool show_diagnostics = false;
+    // with NBODY_COUNT_ALLOCATIONS: heap allocations of the last frame, from all threads
+    std::uint64_t frame_allocations = 0;
+
+    // P shows the profile; input and draw are sampled every frame, the simulation phases per
+    // batch of steps (a frame's worth, or what the thread did between two snapshots)
+    bool show_profile = false;
+    std::array<RollingSamples, PHASE_COUNT> phase_ms;
+    RollingSamples frame_ms;
+    PhaseProfile latest_profile;
+    // snapshot.profile as of the last batch taken from it
+    PhaseProfile thread_profile;
+
     while (!WindowShouldClose()) {
+        const auto frame_start = std::chrono::steady_clock::now();
+        const std::uint64_t allocations_before = heap_allocations();
+        // the simulation phases of the steps that came in this frame, if any did
+        PhaseProfile batch;
+        bool have_batch = false;
+        const bool threaded = !gpu_resident && engine != main_thread_engine;
+        if (threaded && !sim_thread.has_value()) {
+            // nothing to interpolate from until the thread has published twice
+            snapshot = {};
+            prev_snapshot = {};
+            thread_profile = {};
+            sim_thread.emplace(sim, timestep, record);
+        } else if (!threaded && sim_thread.has_value()) {
+            sim_thread.reset();
+        }
+
+        if (IsKeyPressed(KEY_P)) {
+            show_profile = !show_profile;
+        }
+        if (IsKeyPressed(KEY_E)) {
+            show_diagnostics = !show_diagnostics;
+            with_sim([every = show_diagnostics ? DIAGNOSTICS_EVERY : 0](Simulation& s) {
+                s.diagnostics_every = every;
+            });
+        }
+        if (IsKeyPressed(KEY_B)) {
+            engine_idx = (engine_idx + 1) % std::size(engines);
+            engine = engines[engine_idx];
+            if (engine == main_thread_engine) {
+                // it steps on this thread from now on, so `sim` has to be ours before it gets it
+                sim_thread.reset();
+            }
+            with_sim([engine](Simulation& s) { s.set_engine(engine); });
+            accuracy.reset();
+        }
+        if (IsKeyPressed(KEY_C)) {
+            // broadphase -> kernel -> merge -> none -> broadphase
+            constexpr CollisionMode next_mode[] = {CollisionMode::BROADPHASE, CollisionMode::MERGE,
+                                                   CollisionMode::KERNEL, CollisionMode::NONE};
+            collisions = next_mode[static_cast<int>(collisions)];
+            with_sim([collisions](Simulation& s) { s.collisions = collisions; });
+        }
+        if (IsKeyPressed(KEY_I)) {
+            constexpr Integrator next_integrator[] = {Integrator::LEAPFROG, Integrator::YOSHIDA4,
+                                                      Integrator::BLOCK, Integrator::EULER};
+            integrator = next_integrator[static_cast<int>(integrator)];
+            timestep = fixed_timestep(integrator);
+            with_sim([integrator](Simulation& s) { s.integrator = integrator; });
+            if (sim_thread.has_value()) {
+                sim_thread->set_timestep(timestep);
+            }
+        }
+        if (IsKeyPressed(KEY_LEFT_BRACKET) || IsKeyPressed(KEY_RIGHT_BRACKET)) {
+            const float step = IsKeyPressed(KEY_LEFT_BRACKET) ? -0.1f : 0.1f;
+            theta = std::clamp(theta + step, 0.0f, 1.5f);
+            with_sim([&barnes_hut, &fmm, theta](Simulation&) {
+                barnes_hut.theta = theta;
+                // past 1 the multipole criterion would accept overlapping cells
+                fmm.theta = std::min(theta, 1.0f);
+            });
+            accuracy.reset();
+        }
+        if (IsKeyPressed(KEY_MINUS) || IsKeyPressed(KEY_EQUAL)) {
+            fmm_order = std::clamp(fmm_order + (IsKeyPressed(KEY_MINUS) ? -1 : 1), 1,
+                                   FmmEngine::MAX_ORDER);
+            with_sim([&fmm, fmm_order](Simulation&) { fmm.order = fmm_order; });
+            accuracy.reset();
+        }
+#ifdef NBODY_GPU
+        if (IsKeyPressed(KEY_G) && pairwise_gpu.has_value()) {
+            // `sim` changes hands, so it has to be ours
+            sim_thread.reset();
+            pull_from_device();
+            gpu_resident = !gpu_resident;
+            push_to_device();
+        }
+#endif
+
+        if (IsKeyPressed(KEY_F5)) {
+            // taken between two steps, with the integrator state
+            pull_from_device();
+            with_sim([](Simulation& s) {
+                if (const auto saved = save_checkpoint(CHECKPOINT_PATH, s); !saved) {
+                    TraceLog(LOG_WARNING, "%s", saved.error().c_str());
+                }
+            });
+        }
+        if (IsKeyPressed(KEY_F9)) {
+            if (auto checkpoint = Checkpoint::open(CHECKPOINT_PATH); !checkpoint) {
+                TraceLog(LOG_WARNING, "%s", checkpoint.error().c_str());
+            } else {
+                const CheckpointHeader& header = checkpoint->header();
+                collisions = static_cast<CollisionMode>(header.collisions);
+                integrator = static_cast<Integrator>(header.integrator);
+                timestep = fixed_timestep(integrator);
+                if (sim_thread.has_value()) {
+                    sim_thread->set_timestep(timestep);
+                }
+                if (header.count != 0) {
+                    const Body sun = {.mass = checkpoint->mass()[0],
+                                      .radius = checkpoint->radius()[0],
+                                      .pos = {},
+                                      .vel = {},
+                                      .color = {}};
+                    sys_density = planet_density(sun);
+                }
+                // the mapping goes with the command to the simulation thread
+                auto shared = std::make_shared<Checkpoint>(std::move(*checkpoint));
+                with_sim([shared](Simulation& s) { shared->restore(s); });
+                push_to_device();
+            }
+        }
+
+        if (sim_thread.has_value() && sim_thread->poll(prev_snapshot)) {
+            std::swap(snapshot, prev_snapshot);
+            batch = snapshot.profile;
+            batch -= thread_profile;
+            thread_profile = snapshot.profile;
+            have_batch = true;
+        }
+
         Vector2 mouse_pos = GetMousePosition();
         reset_btn_state = CheckCollisionPointRec(mouse_pos, reset_btn) ? HOVER : NONE;
 
+        if (const float wheel = GetMouseWheelMove(); wheel != 0.0f) {
+            // keeps the point under the cursor where it is
+            camera.target = GetScreenToWorld2D(mouse_pos, camera);
+            camera.offset = mouse_pos;
+            camera.zoom = std::clamp(camera.zoom * std::pow(1.25f, wheel), 1e-4f, 1e2f);
+        }
+        if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT) || IsMouseButtonDown(MOUSE_BUTTON_MIDDLE)) {
+            camera.target -= GetMouseDelta() / camera.zoom;
+        }
+        if (IsKeyPressed(KEY_HOME)) {
+            camera = home_camera;
+        }
+        // new bodies are placed and aimed in the world
+        const Vector2 world_mouse = GetScreenToWorld2D(mouse_pos, camera);
+
         if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
             if (new_body.has_value()) {
-                new_body->vel = mouse_pos - new_body->pos;
+                new_body->vel = world_mouse - new_body->pos;
             } else if (reset_btn_state == HOVER) {
                 reset_btn_state = DOWN;
             } else {
+                pull_from_device();
+                const std::span<const Body> bodies =
+                    sim_thread.has_value() ? snapshot.bodies : sim.bodies();
                 float rad_sum = std::accumulate(bodies.begin(), bodies.end(), 0.0f,
-                                                [](float part, Body b) { return part + b.radius; });
+                                                [](float part, const Body& b) {
+                                                    return part + b.radius;
+                                                });
                 float mean_rad = bodies.size() == 0.0f ? 20.0f : rad_sum / bodies.size();
                 new_body = {
                     .mass = mean_rad * mean_rad * sys_density,
                     .radius = mean_rad,
-                    .pos = mouse_pos,
+                    .pos = world_mouse,
                     .vel = {},
                     .color = get_random_color(e),
                 };
             }
         } else if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
+            pull_from_device();
             if (reset_btn_state == HOVER) {
-                bodies = get_random_system(e, 2, 15);
-                sys_density = bodies[0].mass / (bodies[0].radius * bodies[0].radius) * 1e-2f;
-                acc.clear();
-                acc.resize(bodies.size());
+                auto system = generate_system(sim_thread.has_value() ? nullptr : &pool);
+                sys_density = planet_density(system[0]);
+                with_sim([system = std::move(system)](Simulation& s) { s.reset(system); });
                 reset_btn_state = NONE;
             } else {
                 assert(new_body.has_value());
-                bodies.push_back(new_body.value());
-                acc.push_back({});
+                with_sim([body = *new_body](Simulation& s) { s.add_body(body); });
                 new_body.reset();
             }
+            push_to_device();
         }
 
-        const float dt = GetFrameTime();
-        for (auto [i, body] : stdv::enumerate(bodies)) {
-            for (const auto [j, other] : stdv::enumerate(bodies)) {
-                if (i == j) {
-                    continue;
-                }
-                const Vector2 xrel = Vector2AddValue(other.pos - body.pos, DIST_EPS);
-                const float dist_sqr = Vector2LengthSqr(xrel);
-                if (std::sqrt(dist_sqr) < body.radius + other.radius - COLL_EPS) {
-                    const Vector2 vrel = body.vel - other.vel;
-                    const float v_proj_mag = -Vector2DotProduct(vrel, xrel) / dist_sqr;
-                    const float idt = dt ? 1.0f / dt : 0.0f;
-                    const float m_tot = body.mass + other.mass;
-                    const Vector2 coll_acc = xrel * 2.0f * other.mass / m_tot * v_proj_mag * idt;
-                    acc[i] += coll_acc;
+        const float dt = timestep.dt;
+        if (IsKeyPressed(KEY_V)) {
+            // check the approximation against the exact sum for the current state
+            pull_from_device();
+            auto result = std::make_shared<std::promise<AccuracyReport>>();
+            pending_accuracy = result->get_future();
+            with_sim([engine, &reference, dt, result](Simulation& s) {
+                std::vector<Vector2> approx(s.bodies().size());
+                std::vector<Vector2> exact(s.bodies().size());
+                engine->compute(s.bodies(), approx, dt);
+                reference.collisions = engine->collisions;
+                reference.compute(s.bodies(), exact, dt);
+                result->set_value(compare_accelerations(exact, approx));
+            });
+        }
+        if (pending_accuracy.valid() &&
+            pending_accuracy.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            accuracy = pending_accuracy.get();
+        }
+
+        latest_profile.time(Phase::INPUT) = seconds_since(frame_start);
+        if (!sim_thread.has_value()) {
+            const int steps = timestep.advance(GetFrameTime());
+#ifdef NBODY_GPU
+            if (gpu_resident) {
+                pairwise_gpu->collisions = collisions != CollisionMode::NONE;
+                for (int s = 0; s < steps; s++) {
+                    pairwise_gpu->step(dt);
                 }
+            }
+#endif
+            for (int s = 0; s < steps && !gpu_resident; s++) {
+                sim.step(dt);
+                batch += sim.profile();
+                record(sim);
+            }
+            have_batch = steps > 0 && !gpu_resident;
+        }
 
-                const Vector2 grav_acc = xrel * GRAVITY * other.mass / std::pow(dist_sqr, 1.5f);
-                acc[i] += grav_acc;
+        // one snapshot interval behind the simulation, moving from the previous snapshot to the
+        // latest. Bodies added since the previous one are shown where they are.
+        std::span<const Body> shown = sim_thread.has_value() ? snapshot.bodies : sim.bodies();
+        if (sim_thread.has_value()) {
+            const float interval =
+                std::chrono::duration<float>(snapshot.published - prev_snapshot.published).count();
+            const float since =
+                std::chrono::duration<float>(std::chrono::steady_clock::now() - snapshot.published)
+                    .count();
+            const float alpha = interval > 0.0f ? std::clamp(since / interval, 0.0f, 1.0f) : 1.0f;
+            interpolated.assign(snapshot.bodies.begin(), snapshot.bodies.end());
+            if (prev_snapshot.structure == snapshot.structure &&
+                prev_snapshot.bodies.size() == snapshot.bodies.size()) {
+                for (std::size_t i = 0; i < interpolated.size(); i++) {
+                    interpolated[i].pos = Vector2Lerp(prev_snapshot.bodies[i].pos,
+                                                      snapshot.bodies[i].pos, alpha);
+                }
+            } else if (prev_snapshot.id_epoch == snapshot.id_epoch) {
+                // bodies were added, removed or reordered in between, so match them up by id
+                std::uint32_t ids = 0;
+                for (std::uint32_t id : prev_snapshot.ids) {
+                    ids = std::max(ids, id + 1);
+                }
+                prev_index.assign(ids, -1);
+                for (std::size_t k = 0; k < prev_snapshot.ids.size(); k++) {
+                    prev_index[prev_snapshot.ids[k]] = static_cast<int>(k);
+                }
+                for (std::size_t i = 0; i < interpolated.size(); i++) {
+                    const std::uint32_t id = snapshot.ids[i];
+                    if (id < ids && prev_index[id] >= 0) {
+                        interpolated[i].pos = Vector2Lerp(prev_snapshot.bodies[prev_index[id]].pos,
+                                                          snapshot.bodies[i].pos, alpha);
+                    }
+                }
             }
+            shown = interpolated;
         }
+        std::size_t n_bodies = shown.size();
 
+        const auto draw_start = std::chrono::steady_clock::now();
         BeginDrawing();
         ClearBackground(RAYWHITE);
-        for (auto [i, body] : stdv::enumerate(bodies)) {
-            body.update(acc[i], dt);
-            acc[i] = {};
+        BeginMode2D(camera);
+        const Vector2 view_corner = GetScreenToWorld2D({}, camera);
+        const Rectangle view = {view_corner.x, view_corner.y, WIDTH / camera.zoom,
+                                HEIGHT / camera.zoom};
+        std::size_t n_drawn = 0;
+#ifdef NBODY_GPU
+        if (gpu_resident) {
+            // GL 4.3 implies the renderer, which reads the engine's buffers in place; the
+            // bodies outside the view are left for the GPU to clip
+            renderer->draw(pairwise_gpu->position_buffer(), pairwise_gpu->color_buffer(),
+                           pairwise_gpu->size());
+            n_bodies = n_drawn = pairwise_gpu->size();
+        }
+#endif
+        if (!gpu_resident) {
+            // the pool is the simulation thread's while it runs
+            const std::span<const Body> drawn =
+                culler.cull(shown, view, camera.zoom, sim_thread.has_value() ? nullptr : &pool);
+            n_drawn = drawn.size();
+            if (renderer.has_value()) {
+                renderer->draw(drawn);
+            } else {
+                for (const auto& body : drawn) {
+                    DrawCircleV(body.pos, body.radius, body.color);
+                }
+            }
+        }
+        if (new_body.has_value()) {
+            DrawCircleV(new_body->pos, new_body->radius, new_body->color);
+            DrawLineEx(new_body->pos, new_body->pos + new_body->vel, 2.0f / camera.zoom,
+                       new_body->color);
+        }
+        EndMode2D();
 
-            DrawCircleV(body.pos, body.radius, body.color);
-            if (new_body.has_value()) {
-                DrawCircleV(new_body->pos, new_body->radius, new_body->color);
-                DrawLineEx(new_body->pos, new_body->pos + new_body->vel, 2.0f, new_body->color);
+        const char* counter =
+            format_text(counter_text, "{} bod{}", n_bodies, n_bodies == 1 ? "y" : "ies");
+        const int counter_size = MeasureText(counter, 20);
+        DrawText(counter, WIDTH - counter_size - margin.x, margin.y, 20, GRAY);
+        if constexpr (COUNTING_ALLOCATIONS) {
+            const char* allocations = format_text(allocation_text, "{} allocations last frame",
+                                                  frame_allocations);
+            const int allocations_size = MeasureText(allocations, 20);
+            DrawText(allocations, WIDTH - allocations_size - margin.x, margin.y + 25, 20, GRAY);
+        }
+
+        const long steps_per_frame = std::lround(1.0f / (FPS * timestep.dt));
+        if (gpu_resident) {
+            // the device always steps with leapfrog and resolves collisions in the kernel
+            const bool collide = collisions != CollisionMode::NONE;
+            format_text(engine_text, "pairwise-gpu (resident), {} collisions, leapfrog x{}",
+                        collide ? "kernel" : "none", steps_per_frame);
+        } else {
+            const char* label = engine->name();
+            if (engine == &barnes_hut) {
+                label = format_text(label_text, "{} (theta {:.1f})", engine->name(), theta);
+            } else if (engine == &fmm) {
+                label = format_text(label_text, "{} (theta {:.1f}, order {})", engine->name(),
+                                    std::min(theta, 1.0f), fmm_order);
+            } else if (engine == &p3m) {
+                label = format_text(label_text, "{} (mesh {})", engine->name(), p3m.mesh);
+            } else if (engine == &pairwise_simd) {
+                label = format_text(label_text, "{} ({})", engine->name(), simd_kernel_isa());
             }
+            format_text(engine_text, "{}, {} collisions, {} x{}", label,
+                        collision_mode_name(collisions), integrator_name(integrator),
+                        steps_per_frame);
+        }
+        DrawText(engine_text.data(), margin.x, margin.y, 20, GRAY);
+        if (accuracy.has_value()) {
+            DrawText(format_text(accuracy_text, "max err {:.2e}, rms err {:.2e}",
+                                 accuracy->max_rel_err, accuracy->rms_rel_err),
+                     margin.x, margin.y + 25, 20, GRAY);
+        }
+        const std::optional<Diagnostics>& diagnostics =
+            sim_thread.has_value() ? snapshot.diagnostics : sim.diagnostics();
+        const std::optional<Diagnostics>& initial_diagnostics =
+            sim_thread.has_value() ? snapshot.initial_diagnostics : sim.initial_diagnostics();
+        if (show_diagnostics && !gpu_resident && diagnostics && initial_diagnostics) {
+            const DiagnosticsDrift drift = diagnostics_drift(*initial_diagnostics, *diagnostics);
+            DrawText(format_text(diagnostics_text,
+                                 "energy drift {:+.2e}, momentum {:.2e}, angular momentum {:+.2e}",
+                                 drift.energy, drift.momentum, drift.angular_momentum),
+                     margin.x, margin.y + 50, 20, GRAY);
         }
-        const auto& counter =
-            std::format("{} bod{}", bodies.size(), bodies.size() == 1 ? "y" : "ies");
-        const int counter_size = MeasureText(counter.c_str(), 20);
-        DrawText(counter.c_str(), WIDTH - counter_size - margin.x, margin.y, 20, GRAY);
 
         const Color reset_btn_colors[] = {
             {150, 150, 150, 100}, {150, 150, 150, 130}, {150, 150, 150, 180}};
         DrawRectangleRec(reset_btn, reset_btn_colors[reset_btn_state]);
         DrawText(reset_text, WIDTH - reset_size.x - reset_inner_margin.x - margin.x,
                  HEIGHT - reset_size.y - reset_inner_margin.y - margin.y, 20, GRAY);
-        EndDrawing();
 
-        std::erase_if(bodies, [](Body b) {
-            return b.pos.x > WIDTH + b.radius || b.pos.x < -b.radius ||
-                   b.pos.y > HEIGHT + b.radius || b.pos.y < -b.radius;
-        });
+        latest_profile.time(Phase::DRAW) = seconds_since(draw_start);
+        latest_profile.count(Phase::DRAW) = n_drawn;
+        if (have_batch) {
+            for (Phase phase : STEP_PHASES) {
+                latest_profile.time(phase) = batch.time(phase);
+                latest_profile.count(phase) = batch.count(phase);
+            }
+        }
+        for (std::size_t p = 0; p < PHASE_COUNT; p++) {
+            const auto phase = static_cast<Phase>(p);
+            if (phase == Phase::INPUT || phase == Phase::DRAW || have_batch) {
+                phase_ms[p].push(1e3f * static_cast<float>(latest_profile.time(phase)));
+            }
+        }
+        frame_ms.push(1e3f * GetFrameTime());
+        if (show_profile) {
+            draw_profile({margin.x, HEIGHT - margin.y - 16.0f * (PHASE_COUNT + 1) - 8.0f}, phase_ms,
+                         frame_ms, latest_profile);
+        }
+        EndDrawing();
+        frame_allocations = heap_allocations() - allocations_before;
     }
 
+    sim_thread.reset();
+    // the buffers and shaders have to go before the context
+    renderer.reset();
+#ifdef NBODY_GPU
+    sim.set_engine(nullptr);
+    pairwise_gpu.reset();
+#endif
     CloseWindow();
     return 0;
 }
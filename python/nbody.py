@@ -0,0 +1,178 @@
+"""NumPy view of a simulation through the C interface in src/nbody.h (libnbody_c).
+
+    sim = nbody.Simulation.from_system("plummer", seed=1, bodies=10000, size=1000.0)
+    sim.set_engine("barnes-hut")
+    sim.step(0.01, 100)
+    pos = sim.bodies["pos"]  # (n, 2) float32, no copy
+
+The arrays are views of the simulation's own storage and, like the pointers they wrap, only last
+until the next step, reset or added body; take them again after each of those.
+"""
+
+import ctypes
+import ctypes.util
+import os
+
+import numpy as np
+
+BODY_DTYPE = np.dtype(
+    [
+        ("mass", np.float32),
+        ("radius", np.float32),
+        ("pos", np.float32, (2,)),
+        ("vel", np.float32, (2,)),
+        ("color", np.uint8, (4,)),
+    ]
+)
+assert BODY_DTYPE.itemsize == 28
+
+
+class NbodyDiagnostics(ctypes.Structure):
+    _fields_ = [
+        ("step", ctypes.c_uint64),
+        ("time", ctypes.c_double),
+        ("kinetic", ctypes.c_double),
+        ("potential", ctypes.c_double),
+        ("momentum_x", ctypes.c_double),
+        ("momentum_y", ctypes.c_double),
+        ("angular_momentum", ctypes.c_double),
+        ("energy_drift", ctypes.c_double),
+        ("momentum_drift", ctypes.c_double),
+        ("angular_momentum_drift", ctypes.c_double),
+    ]
+
+
+def _load():
+    path = os.environ.get("NBODY_LIBRARY") or ctypes.util.find_library("nbody_c")
+    if path is None:
+        raise OSError("libnbody_c not found; set NBODY_LIBRARY to its path")
+    lib = ctypes.CDLL(path)
+    sim_p = ctypes.c_void_p
+    body_p = ctypes.c_void_p
+    signatures = {
+        "nbody_create": (sim_p, [body_p, ctypes.c_size_t, ctypes.c_uint]),
+        "nbody_create_system": (
+            sim_p,
+            [ctypes.c_char_p, ctypes.c_uint64, ctypes.c_int, ctypes.c_float, ctypes.c_uint],
+        ),
+        "nbody_destroy": (None, [sim_p]),
+        "nbody_set_engine": (ctypes.c_bool, [sim_p, ctypes.c_char_p]),
+        "nbody_set_integrator": (ctypes.c_bool, [sim_p, ctypes.c_char_p]),
+        "nbody_set_collisions": (ctypes.c_bool, [sim_p, ctypes.c_char_p]),
+        "nbody_set_diagnostics_every": (None, [sim_p, ctypes.c_uint64]),
+        "nbody_set_bounds": (None, [sim_p] + [ctypes.c_float] * 4),
+        "nbody_step": (None, [sim_p, ctypes.c_float, ctypes.c_uint64]),
+        "nbody_reset": (None, [sim_p, body_p, ctypes.c_size_t]),
+        "nbody_add_body": (None, [sim_p, body_p]),
+        "nbody_body_count": (ctypes.c_size_t, [sim_p]),
+        "nbody_bodies": (ctypes.c_void_p, [sim_p]),
+        "nbody_edit_bodies": (ctypes.c_void_p, [sim_p]),
+        "nbody_ids": (ctypes.c_void_p, [sim_p]),
+        "nbody_structure_version": (ctypes.c_uint64, [sim_p]),
+        "nbody_step_count": (ctypes.c_uint64, [sim_p]),
+        "nbody_time": (ctypes.c_double, [sim_p]),
+        "nbody_get_diagnostics": (ctypes.c_bool, [sim_p, ctypes.POINTER(NbodyDiagnostics)]),
+    }
+    for name, (restype, argtypes) in signatures.items():
+        function = getattr(lib, name)
+        function.restype = restype
+        function.argtypes = argtypes
+    return lib
+
+
+_lib = _load()
+
+
+def _view(address, count, dtype, writeable):
+    if count == 0:
+        return np.empty(0, dtype)
+    buffer = (ctypes.c_char * (count * dtype.itemsize)).from_address(address)
+    array = np.frombuffer(buffer, dtype, count)
+    array.flags.writeable = writeable
+    return array
+
+
+class Simulation:
+    def __init__(self, bodies, threads=0):
+        """A simulation of a copy of `bodies`, an array of BODY_DTYPE."""
+        bodies = np.ascontiguousarray(bodies, BODY_DTYPE)
+        self._sim = _lib.nbody_create(bodies.ctypes.data, len(bodies), threads)
+
+    @classmethod
+    def from_system(cls, system, seed=0, bodies=1000, size=1000.0, threads=0):
+        sim = cls.__new__(cls)
+        sim._sim = _lib.nbody_create_system(system.encode(), seed, bodies, size, threads)
+        if not sim._sim:
+            raise ValueError(f"no system {system!r} of {bodies} bodies")
+        return sim
+
+    def __del__(self):
+        if getattr(self, "_sim", None):
+            _lib.nbody_destroy(self._sim)
+            self._sim = None
+
+    def _set(self, setter, kind, name):
+        if not setter(self._sim, name.encode()):
+            raise ValueError(f"unknown {kind} {name!r}")
+
+    def set_engine(self, name):
+        self._set(_lib.nbody_set_engine, "engine", name)
+
+    def set_integrator(self, name):
+        self._set(_lib.nbody_set_integrator, "integrator", name)
+
+    def set_collisions(self, name):
+        self._set(_lib.nbody_set_collisions, "collision mode", name)
+
+    def set_diagnostics_every(self, steps):
+        _lib.nbody_set_diagnostics_every(self._sim, steps)
+
+    def set_bounds(self, x, y, width, height):
+        _lib.nbody_set_bounds(self._sim, x, y, width, height)
+
+    def step(self, dt, steps=1):
+        _lib.nbody_step(self._sim, dt, steps)
+
+    def reset(self, bodies):
+        bodies = np.ascontiguousarray(bodies, BODY_DTYPE)
+        _lib.nbody_reset(self._sim, bodies.ctypes.data, len(bodies))
+
+    def add_body(self, body):
+        body = np.ascontiguousarray(body, BODY_DTYPE)
+        _lib.nbody_add_body(self._sim, body.ctypes.data)
+
+    def __len__(self):
+        return _lib.nbody_body_count(self._sim)
+
+    @property
+    def bodies(self):
+        """Read-only view of the bodies."""
+        return _view(_lib.nbody_bodies(self._sim), len(self), BODY_DTYPE, False)
+
+    def edit_bodies(self):
+        """Writable view of the bodies, for changing them in place between steps."""
+        return _view(_lib.nbody_edit_bodies(self._sim), len(self), BODY_DTYPE, True)
+
+    @property
+    def ids(self):
+        return _view(_lib.nbody_ids(self._sim), len(self), np.dtype(np.uint32), False)
+
+    @property
+    def structure_version(self):
+        return _lib.nbody_structure_version(self._sim)
+
+    @property
+    def step_count(self):
+        return _lib.nbody_step_count(self._sim)
+
+    @property
+    def time(self):
+        return _lib.nbody_time(self._sim)
+
+    @property
+    def diagnostics(self):
+        """The latest sample of the conserved quantities as a dict, or None before the first."""
+        out = NbodyDiagnostics()
+        if not _lib.nbody_get_diagnostics(self._sim, ctypes.byref(out)):
+            return None
+        return {name: getattr(out, name) for name, _ in out._fields_}
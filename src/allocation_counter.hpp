@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+// Heap allocation counting for checking that the steady-state loop does not allocate. With
+// NBODY_COUNT_ALLOCATIONS the global operator new is replaced by one that counts every call, from
+// any thread; without it nothing is counted and the functions return 0.
+
+#ifdef NBODY_COUNT_ALLOCATIONS
+constexpr bool COUNTING_ALLOCATIONS = true;
+#else
+constexpr bool COUNTING_ALLOCATIONS = false;
+#endif
+
+// allocations made by the whole process so far
+std::uint64_t heap_allocations();
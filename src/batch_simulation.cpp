@@ -0,0 +1,420 @@
+#include "batch_simulation.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+#include <utility>
+
+#include "cpu_features.hpp"
+#include "gravity.hpp"
+
+#if defined(NBODY_X86)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define NBODY_SIMD_NEON
+#endif
+
+namespace {
+
+constexpr std::size_t LANES = BatchSimulation::LANES;
+
+// groups handed to a thread at a time
+constexpr std::size_t GROUP_GRAIN = 16;
+
+// radius of the padding bodies, so that they never overlap anything
+constexpr float PADDING_RADIUS = -1e30f;
+
+// one group's rows, every array starting at the group's first row and strided by LANES
+struct GroupArrays {
+    const float* x;
+    const float* y;
+    const float* vx;
+    const float* vy;
+    const float* mass;
+    const float* radius;
+    const std::int32_t* count; // LANES, bodies of every lane's system
+    float* ax;
+    float* ay;
+    double* potential; // LANES, m_i phi_i / 2 summed per lane, if with POTENTIAL
+    int rows;
+};
+
+// lanes [lane, lane + VECTOR_LANES) of one group, in every version
+using GroupKernel = void (*)(const GroupArrays& g, float dt, std::size_t lane);
+
+#if defined(NBODY_X86)
+
+// the lanes [lane, lane + 8) of a group; AVX-512 CPUs run this one too, as a group is 8 wide
+template<bool COLLIDE, bool POTENTIAL>
+NBODY_TARGET("avx2,fma")
+void group_accelerations_avx2(const GroupArrays& g, float dt, std::size_t lane) {
+    const __m256 eps = _mm256_set1_ps(DIST_EPS);
+    const __m256 gravity = _mm256_set1_ps(GRAVITY);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 three_halves = _mm256_set1_ps(1.5f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 idt = _mm256_set1_ps(dt ? 1.0f / dt : 0.0f);
+    const __m256i count = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(g.count + lane));
+
+    for (int i = 0; i < g.rows; i++) {
+        const std::size_t row_i = i * LANES + lane;
+        const __m256 xi = _mm256_loadu_ps(g.x + row_i);
+        const __m256 yi = _mm256_loadu_ps(g.y + row_i);
+        const __m256 vxi = _mm256_loadu_ps(g.vx + row_i);
+        const __m256 vyi = _mm256_loadu_ps(g.vy + row_i);
+        const __m256 mi = _mm256_loadu_ps(g.mass + row_i);
+        const __m256 ri =
+            _mm256_sub_ps(_mm256_loadu_ps(g.radius + row_i), _mm256_set1_ps(COLL_EPS));
+
+        __m256 ax = _mm256_setzero_ps();
+        __m256 ay = _mm256_setzero_ps();
+        __m256 phi = _mm256_setzero_ps();
+        for (int j = 0; j < g.rows; j++) {
+            if (j == i) {
+                continue;
+            }
+            const std::size_t row_j = j * LANES + lane;
+            const __m256 mj = _mm256_loadu_ps(g.mass + row_j);
+            const __m256 dx = _mm256_add_ps(_mm256_sub_ps(_mm256_loadu_ps(g.x + row_j), xi), eps);
+            const __m256 dy = _mm256_add_ps(_mm256_sub_ps(_mm256_loadu_ps(g.y + row_j), yi), eps);
+            const __m256 dist_sqr = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+            // estimate of 1 / dist refined by one Newton step
+            __m256 inv_dist = _mm256_rsqrt_ps(dist_sqr);
+            inv_dist = _mm256_mul_ps(
+                inv_dist, _mm256_fnmadd_ps(_mm256_mul_ps(half, dist_sqr),
+                                           _mm256_mul_ps(inv_dist, inv_dist), three_halves));
+            const __m256 inv_sqr = _mm256_mul_ps(inv_dist, inv_dist);
+            __m256 coef =
+                _mm256_mul_ps(_mm256_mul_ps(gravity, mj), _mm256_mul_ps(inv_sqr, inv_dist));
+
+            if constexpr (COLLIDE) {
+                // the padding never overlaps, which also masks its 0 / 0 mass ratio
+                const __m256 dist = _mm256_mul_ps(dist_sqr, inv_dist);
+                const __m256 rj = _mm256_loadu_ps(g.radius + row_j);
+                const __m256 overlap = _mm256_cmp_ps(dist, _mm256_add_ps(ri, rj), _CMP_LT_OQ);
+                const __m256 vrx = _mm256_sub_ps(vxi, _mm256_loadu_ps(g.vx + row_j));
+                const __m256 vry = _mm256_sub_ps(vyi, _mm256_loadu_ps(g.vy + row_j));
+                const __m256 v_dot = _mm256_fmadd_ps(vrx, dx, _mm256_mul_ps(vry, dy));
+                const __m256 v_proj_mag = _mm256_mul_ps(v_dot, inv_sqr); // negated below
+                const __m256 mass_ratio =
+                    _mm256_div_ps(_mm256_mul_ps(two, mj), _mm256_add_ps(mi, mj));
+                const __m256 coll = _mm256_mul_ps(_mm256_mul_ps(mass_ratio, v_proj_mag), idt);
+                coef = _mm256_sub_ps(coef, _mm256_and_ps(overlap, coll));
+            }
+            if constexpr (POTENTIAL) {
+                phi = _mm256_fnmadd_ps(mj, inv_dist, phi);
+            }
+            ax = _mm256_fmadd_ps(dx, coef, ax);
+            ay = _mm256_fmadd_ps(dy, coef, ay);
+        }
+        // the padding stays where it is
+        const __m256 valid = _mm256_castsi256_ps(_mm256_cmpgt_epi32(count, _mm256_set1_epi32(i)));
+        _mm256_storeu_ps(g.ax + row_i, _mm256_and_ps(valid, ax));
+        _mm256_storeu_ps(g.ay + row_i, _mm256_and_ps(valid, ay));
+        if constexpr (POTENTIAL) {
+            alignas(32) float lanes[8];
+            _mm256_store_ps(lanes, _mm256_mul_ps(mi, phi));
+            for (std::size_t l = 0; l < 8; l++) {
+                g.potential[lane + l] += 0.5 * GRAVITY * lanes[l];
+            }
+        }
+    }
+}
+
+#elif defined(NBODY_SIMD_NEON)
+
+// the lanes [lane, lane + 4) of a group
+template<bool COLLIDE, bool POTENTIAL>
+void group_accelerations_neon(const GroupArrays& g, float dt, std::size_t lane) {
+    const float32x4_t eps = vdupq_n_f32(DIST_EPS);
+    const float32x4_t gravity = vdupq_n_f32(GRAVITY);
+    const float32x4_t two = vdupq_n_f32(2.0f);
+    const float32x4_t idt = vdupq_n_f32(dt ? 1.0f / dt : 0.0f);
+    const int32x4_t count = vld1q_s32(g.count + lane);
+
+    for (int i = 0; i < g.rows; i++) {
+        const std::size_t row_i = i * LANES + lane;
+        const float32x4_t xi = vld1q_f32(g.x + row_i);
+        const float32x4_t yi = vld1q_f32(g.y + row_i);
+        const float32x4_t vxi = vld1q_f32(g.vx + row_i);
+        const float32x4_t vyi = vld1q_f32(g.vy + row_i);
+        const float32x4_t mi = vld1q_f32(g.mass + row_i);
+        const float32x4_t ri = vsubq_f32(vld1q_f32(g.radius + row_i), vdupq_n_f32(COLL_EPS));
+
+        float32x4_t ax = vdupq_n_f32(0.0f);
+        float32x4_t ay = vdupq_n_f32(0.0f);
+        float32x4_t phi = vdupq_n_f32(0.0f);
+        for (int j = 0; j < g.rows; j++) {
+            if (j == i) {
+                continue;
+            }
+            const std::size_t row_j = j * LANES + lane;
+            const float32x4_t mj = vld1q_f32(g.mass + row_j);
+            const float32x4_t dx = vaddq_f32(vsubq_f32(vld1q_f32(g.x + row_j), xi), eps);
+            const float32x4_t dy = vaddq_f32(vsubq_f32(vld1q_f32(g.y + row_j), yi), eps);
+            const float32x4_t dist_sqr = vfmaq_f32(vmulq_f32(dy, dy), dx, dx);
+            // the 8 bit estimate of 1 / dist needs two Newton steps to reach float precision
+            float32x4_t inv_dist = vrsqrteq_f32(dist_sqr);
+            inv_dist = vmulq_f32(inv_dist, vrsqrtsq_f32(vmulq_f32(dist_sqr, inv_dist), inv_dist));
+            inv_dist = vmulq_f32(inv_dist, vrsqrtsq_f32(vmulq_f32(dist_sqr, inv_dist), inv_dist));
+            const float32x4_t inv_sqr = vmulq_f32(inv_dist, inv_dist);
+            float32x4_t coef = vmulq_f32(vmulq_f32(gravity, mj), vmulq_f32(inv_sqr, inv_dist));
+
+            if constexpr (COLLIDE) {
+                // the padding never overlaps, which also masks its 0 / 0 mass ratio
+                const float32x4_t dist = vmulq_f32(dist_sqr, inv_dist);
+                const uint32x4_t overlap =
+                    vcltq_f32(dist, vaddq_f32(ri, vld1q_f32(g.radius + row_j)));
+                const float32x4_t vrx = vsubq_f32(vxi, vld1q_f32(g.vx + row_j));
+                const float32x4_t vry = vsubq_f32(vyi, vld1q_f32(g.vy + row_j));
+                const float32x4_t v_dot = vfmaq_f32(vmulq_f32(vry, dy), vrx, dx);
+                const float32x4_t v_proj_mag = vmulq_f32(v_dot, inv_sqr); // negated below
+                const float32x4_t mass_ratio = vdivq_f32(vmulq_f32(two, mj), vaddq_f32(mi, mj));
+                const float32x4_t coll = vmulq_f32(vmulq_f32(mass_ratio, v_proj_mag), idt);
+                coef = vsubq_f32(coef, vreinterpretq_f32_u32(
+                                           vandq_u32(overlap, vreinterpretq_u32_f32(coll))));
+            }
+            if constexpr (POTENTIAL) {
+                phi = vfmsq_f32(phi, mj, inv_dist);
+            }
+            ax = vfmaq_f32(ax, dx, coef);
+            ay = vfmaq_f32(ay, dy, coef);
+        }
+        // the padding stays where it is
+        const uint32x4_t valid = vcgtq_s32(count, vdupq_n_s32(i));
+        vst1q_f32(g.ax + row_i, vreinterpretq_f32_u32(vandq_u32(valid, vreinterpretq_u32_f32(ax))));
+        vst1q_f32(g.ay + row_i, vreinterpretq_f32_u32(vandq_u32(valid, vreinterpretq_u32_f32(ay))));
+        if constexpr (POTENTIAL) {
+            float lanes[4];
+            vst1q_f32(lanes, vmulq_f32(mi, phi));
+            for (std::size_t l = 0; l < 4; l++) {
+                g.potential[lane + l] += 0.5 * GRAVITY * lanes[l];
+            }
+        }
+    }
+}
+
+#endif
+
+// lane `lane` of a group
+template<bool COLLIDE, bool POTENTIAL>
+void group_accelerations_scalar(const GroupArrays& g, float dt, std::size_t lane) {
+    const float idt = dt ? 1.0f / dt : 0.0f;
+    for (int i = 0; i < g.count[lane]; i++) {
+        const std::size_t row_i = i * LANES + lane;
+        float ax = 0.0f;
+        float ay = 0.0f;
+        float phi = 0.0f;
+        for (int j = 0; j < g.count[lane]; j++) {
+            if (j == i) {
+                continue;
+            }
+            const std::size_t row_j = j * LANES + lane;
+            const float dx = g.x[row_j] - g.x[row_i] + DIST_EPS;
+            const float dy = g.y[row_j] - g.y[row_i] + DIST_EPS;
+            const float dist_sqr = dx * dx + dy * dy;
+            const float inv_dist = inverse_sqrt(dist_sqr);
+            float coef = GRAVITY * g.mass[row_j] * inv_dist * inv_dist * inv_dist;
+            if constexpr (COLLIDE) {
+                const float dist = dist_sqr * inv_dist;
+                const float v_dot =
+                    (g.vx[row_i] - g.vx[row_j]) * dx + (g.vy[row_i] - g.vy[row_j]) * dy;
+                const float m_tot = g.mass[row_i] + g.mass[row_j];
+                const float coll = 2.0f * g.mass[row_j] / m_tot * v_dot * inv_dist * inv_dist;
+                coef -= dist < g.radius[row_i] + g.radius[row_j] - COLL_EPS ? coll * idt : 0.0f;
+            }
+            if constexpr (POTENTIAL) {
+                phi -= g.mass[row_j] * inv_dist;
+            }
+            ax += dx * coef;
+            ay += dy * coef;
+        }
+        g.ax[row_i] = ax;
+        g.ay[row_i] = ay;
+        if constexpr (POTENTIAL) {
+            g.potential[lane] += 0.5 * GRAVITY * g.mass[row_i] * phi;
+        }
+    }
+}
+
+// the version for the instruction set the CPU runs, and the lanes it does per call
+template<bool COLLIDE, bool POTENTIAL>
+std::pair<GroupKernel, std::size_t> group_kernel() {
+#if defined(NBODY_X86)
+    if (simd_isa() == SimdIsa::AVX2 || simd_isa() == SimdIsa::AVX512) {
+        return {group_accelerations_avx2<COLLIDE, POTENTIAL>, 8};
+    }
+#elif defined(NBODY_SIMD_NEON)
+    if (simd_isa() == SimdIsa::NEON) {
+        return {group_accelerations_neon<COLLIDE, POTENTIAL>, 4};
+    }
+#endif
+    return {group_accelerations_scalar<COLLIDE, POTENTIAL>, 1};
+}
+
+} // namespace
+
+void BatchSimulation::reset(std::span<const std::vector<Body>> systems) {
+    const std::size_t n = systems.size();
+    counts_.resize(n);
+    for (std::size_t s = 0; s < n; s++) {
+        counts_[s] = static_cast<std::uint32_t>(systems[s].size());
+    }
+    // systems of about the same size share a group, so little of it is padding
+    std::vector<std::uint32_t> order(n);
+    std::iota(order.begin(), order.end(), 0u);
+    std::ranges::stable_sort(order, {}, [&](std::uint32_t s) { return counts_[s]; });
+
+    const std::size_t group_count = (n + LANES - 1) / LANES;
+    groups_.resize(group_count);
+    slots_.resize(n);
+    lane_counts_.assign(group_count * LANES, 0);
+    pairs_ = 0;
+    std::size_t rows = 0;
+    for (std::size_t g = 0; g < group_count; g++) {
+        // the longest system of a group is its last
+        const std::size_t last = std::min(n, (g + 1) * LANES) - 1;
+        groups_[g] = {rows, counts_[order[last]]};
+        rows += groups_[g].rows;
+    }
+    for (auto* field : {&x_, &y_, &vx_, &vy_, &ax_, &ay_, &mass_}) {
+        field->assign(rows * LANES, 0.0f);
+    }
+    radius_.assign(rows * LANES, PADDING_RADIUS);
+    color_.assign(rows * LANES, {});
+    for (std::size_t k = 0; k < n; k++) {
+        const std::uint32_t s = order[k];
+        const std::size_t g = k / LANES, lane = k % LANES;
+        slots_[s] = static_cast<std::uint32_t>(k);
+        lane_counts_[k] = static_cast<std::int32_t>(counts_[s]);
+        pairs_ += static_cast<std::uint64_t>(counts_[s]) * (counts_[s] - 1);
+        for (std::size_t i = 0; i < counts_[s]; i++) {
+            const Body& body = systems[s][i];
+            const std::size_t at = (groups_[g].first + i) * LANES + lane;
+            x_[at] = body.pos.x;
+            y_[at] = body.pos.y;
+            vx_[at] = body.vel.x;
+            vy_[at] = body.vel.y;
+            mass_[at] = body.mass;
+            radius_[at] = body.radius;
+            color_[at] = body.color;
+        }
+    }
+    potential_.assign(group_count * LANES, 0.0);
+    diagnostics_.clear();
+    acc_valid_ = false;
+    steps_ = 0;
+    time_ = 0.0;
+}
+
+std::vector<Body> BatchSimulation::bodies(std::size_t system) const {
+    const std::size_t g = slots_[system] / LANES, lane = slots_[system] % LANES;
+    std::vector<Body> out(counts_[system]);
+    for (std::size_t i = 0; i < out.size(); i++) {
+        const std::size_t at = (groups_[g].first + i) * LANES + lane;
+        out[i] = {mass_[at], radius_[at], {x_[at], y_[at]}, {vx_[at], vy_[at]}, color_[at]};
+    }
+    return out;
+}
+
+void BatchSimulation::step(float dt) {
+    assert(integrator != Integrator::BLOCK);
+    interactions_ = 0;
+    switch (integrator) {
+        case Integrator::EULER:
+            if (!acc_valid_) {
+                compute_forces(dt);
+            }
+            kick(dt);
+            drift(dt);
+            acc_valid_ = false;
+            break;
+        case Integrator::LEAPFROG:
+            if (!acc_valid_) {
+                compute_forces(dt);
+            }
+            kick(dt * 0.5f);
+            drift(dt);
+            compute_forces(dt);
+            kick(dt * 0.5f);
+            break;
+        case Integrator::YOSHIDA4: {
+            // the composition of Simulation::step
+            const float cbrt2 = std::cbrt(2.0f);
+            const float w1 = 1.0f / (2.0f - cbrt2);
+            const float w0 = -cbrt2 * w1;
+            const float drifts[] = {w1 * 0.5f, (w0 + w1) * 0.5f, (w0 + w1) * 0.5f, w1 * 0.5f};
+            const float kicks[] = {w1, w0, w1};
+            for (int k = 0; k < 3; k++) {
+                drift(drifts[k] * dt);
+                compute_forces(dt);
+                kick(kicks[k] * dt);
+            }
+            drift(drifts[3] * dt);
+            acc_valid_ = false;
+            break;
+        }
+        case Integrator::BLOCK:
+            break;
+    }
+    steps_++;
+    time_ += dt;
+}
+
+std::span<const Diagnostics> BatchSimulation::sample(float dt) {
+    compute_forces(dt, true);
+    diagnostics_.resize(size());
+    std::vector<Body> bodies;
+    for (std::size_t s = 0; s < size(); s++) {
+        bodies = this->bodies(s);
+        diagnostics_[s] = measure_diagnostics(bodies, potential_[slots_[s]]);
+        diagnostics_[s].step = steps_;
+        diagnostics_[s].time = time_;
+    }
+    return diagnostics_;
+}
+
+// the collision response and the potential are only compiled into the loop when they are needed
+void BatchSimulation::compute_forces(float dt, bool potential) {
+    const float collision_dt = collisions ? dt : 0.0f;
+    if (potential) {
+        std::ranges::fill(potential_, 0.0);
+    }
+    const auto [kernel, vector_lanes] =
+        collision_dt ? (potential ? group_kernel<true, true>() : group_kernel<true, false>())
+                     : (potential ? group_kernel<false, true>() : group_kernel<false, false>());
+    parallel_for(pool, groups_.size(), GROUP_GRAIN, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t g = begin; g < end; g++) {
+            const std::size_t at = groups_[g].first * LANES;
+            const GroupArrays arrays {&x_[at], &y_[at], &vx_[at], &vy_[at], &mass_[at],
+                                      &radius_[at], &lane_counts_[g * LANES], &ax_[at], &ay_[at],
+                                      &potential_[g * LANES], static_cast<int>(groups_[g].rows)};
+            for (std::size_t lane = 0; lane < LANES; lane += vector_lanes) {
+                kernel(arrays, collision_dt, lane);
+            }
+        }
+    });
+    interactions_ += pairs_;
+    // the collision term depends on velocities, which the next kick changes
+    acc_valid_ = !collisions;
+}
+
+void BatchSimulation::kick(float dt) {
+    parallel_for(pool, vx_.size(), 4096, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            vx_[i] += ax_[i] * dt;
+            vy_[i] += ay_[i] * dt;
+        }
+    });
+}
+
+void BatchSimulation::drift(float dt) {
+    parallel_for(pool, x_.size(), 4096, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            x_[i] += vx_[i] * dt;
+            y_[i] += vy_[i] * dt;
+        }
+    });
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "body.hpp"
+#include "diagnostics.hpp"
+#include "simulation.hpp"
+#include "thread_pool.hpp"
+
+// many small independent systems (a few to a few dozen bodies each, as in a sweep over
+// get_random_system) stepped side by side. A system that small leaves a vector loop over its
+// bodies mostly idle, so the vectors run across systems instead: the systems are sorted by size
+// and packed LANES to a group, with body k of every system of a group in one row of LANES floats,
+// and the exact pairwise sum runs over the rows of a group for all of its systems at once. Systems
+// shorter than the longest of their group are padded with massless bodies that no other body sees.
+// The groups are split over the threads, each staying on one thread for the whole evaluation.
+//
+// Every system evolves as it would in a Simulation of its own with the same settings and the
+// pairwise engine, up to rounding. Bodies are not removed, reordered or merged, so each system
+// keeps its bodies in the order it was given them.
+class BatchSimulation {
+public:
+    static constexpr std::size_t LANES = 8;
+
+    void reset(std::span<const std::vector<Body>> systems);
+
+    std::size_t size() const {
+        return counts_.size();
+    }
+    std::size_t body_count(std::size_t system) const {
+        return counts_[system];
+    }
+    // the current state of one system, unpacked
+    std::vector<Body> bodies(std::size_t system) const;
+
+    // advances every system by dt
+    void step(float dt);
+    // the energy and momenta of every system, with the potential from a force evaluation at the
+    // current positions (which the next step reuses where it can)
+    std::span<const Diagnostics> sample(float dt);
+
+    std::uint64_t step_count() const {
+        return steps_;
+    }
+    double time() const {
+        return time_;
+    }
+    // body-body evaluations over all the systems in the last step
+    std::uint64_t interactions() const {
+        return interactions_;
+    }
+
+    ThreadPool* pool = nullptr;
+    // the elastic collision response inside the pair loop, as CollisionMode::KERNEL
+    bool collisions = true;
+    // any but the block integrator, whose bodies would need steps of their own
+    Integrator integrator = Integrator::EULER;
+
+private:
+    // `rows` rows of LANES floats starting at row `first` of the arrays
+    struct Group {
+        std::size_t first;
+        std::size_t rows;
+    };
+
+    void compute_forces(float dt, bool potential = false);
+    void kick(float dt);
+    void drift(float dt);
+
+    std::vector<Group> groups_;
+    // group * LANES + lane of every system
+    std::vector<std::uint32_t> slots_;
+    std::vector<std::uint32_t> counts_;
+    // bodies of the system in every lane, 0 for the lanes past the last system
+    std::vector<std::int32_t> lane_counts_;
+    std::vector<float> x_, y_, vx_, vy_, ax_, ay_, mass_, radius_;
+    std::vector<Color> color_;
+    std::vector<double> potential_; // per lane, of the last evaluation with the potential
+    std::vector<Diagnostics> diagnostics_;
+    std::uint64_t pairs_ = 0; // ordered pairs of bodies in one evaluation of every system
+    bool acc_valid_ = false;
+    std::uint64_t steps_ = 0;
+    double time_ = 0.0;
+    std::uint64_t interactions_ = 0;
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <raylib.h>
+#include <raymath.h>
+
+constexpr float GRAVITY = 3e2f;
+constexpr float DIST_EPS = 1e-4f;
+constexpr float COLL_EPS = 1.0f;
+// length scale of Softening::PLUMMER, about the radius of a small planet
+constexpr float PLUMMER_EPS = 1.0f;
+
+struct Body {
+    float mass;
+    float radius;
+    Vector2 pos;
+    Vector2 vel;
+    Color color;
+
+    void update(Vector2 acc, float dt) {
+        vel += acc * dt;
+        pos += vel * dt;
+    }
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cassert>
+#include <span>
+#include <vector>
+
+#include "body.hpp"
+
+// structure-of-arrays copy of a set of bodies, for kernels that stream over a few fields at a
+// time. Every array is zero-padded to a multiple of PADDING so vector loops need no scalar tail.
+struct BodyArrays {
+    static constexpr std::size_t PADDING = 16;
+
+    std::vector<float> x, y, vx, vy, mass, radius;
+    std::vector<Color> color;
+
+    std::size_t size() const {
+        return count_;
+    }
+    std::size_t padded_size() const {
+        return x.size();
+    }
+
+    void assign(std::span<const Body> bodies) {
+        count_ = bodies.size();
+        const std::size_t padded = (count_ + PADDING - 1) / PADDING * PADDING;
+        for (auto* field : {&x, &y, &vx, &vy, &mass, &radius}) {
+            field->assign(padded, 0.0f);
+        }
+        color.assign(padded, {});
+        for (std::size_t i = 0; i < count_; i++) {
+            const Body& body = bodies[i];
+            x[i] = body.pos.x;
+            y[i] = body.pos.y;
+            vx[i] = body.vel.x;
+            vy[i] = body.vel.y;
+            mass[i] = body.mass;
+            radius[i] = body.radius;
+            color[i] = body.color;
+        }
+    }
+
+    Body get(std::size_t i) const {
+        assert(i < count_);
+        return {mass[i], radius[i], {x[i], y[i]}, {vx[i], vy[i]}, color[i]};
+    }
+
+    void store(std::span<Body> bodies) const {
+        assert(bodies.size() == count_);
+        for (std::size_t i = 0; i < count_; i++) {
+            bodies[i] = get(i);
+        }
+    }
+
+private:
+    std::size_t count_ = 0;
+};
@@ -0,0 +1,112 @@
+#include "body_culler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+namespace {
+
+// whether the square of half size `reach` around `center` overlaps `view`
+bool overlaps(Rectangle view, Vector2 center, float reach) {
+    return std::abs(center.x - (view.x + 0.5f * view.width)) <= 0.5f * view.width + reach &&
+           std::abs(center.y - (view.y + 0.5f * view.height)) <= 0.5f * view.height + reach;
+}
+
+} // namespace
+
+std::span<const Body> BodyCuller::cull(std::span<const Body> bodies, Rectangle view, float scale,
+                                       ThreadPool* pool) {
+    view_ = view;
+    scale_ = scale;
+    clusters_ = 0;
+    drawn_.clear();
+    pad_ = 0.0f;
+    for (const Body& body : bodies) {
+        pad_ = std::max(pad_, body.radius);
+    }
+
+    if (bodies.size() < min_bodies) {
+        for (const Body& body : bodies) {
+            if (overlaps(view_, body.pos, body.radius)) {
+                drawn_.push_back(body);
+            }
+        }
+        return drawn_;
+    }
+    // the bodies only move a little between two frames
+    tree_.update(bodies, leaf_size, 0.25f, pool);
+    if (!tree_.empty()) {
+        visit(bodies, 0);
+    }
+    return drawn_;
+}
+
+void BodyCuller::visit(std::span<const Body> bodies, int index) {
+    const QuadNode& node = tree_.nodes()[index];
+    if (!overlaps(view_, node.center, node.half_size + pad_)) {
+        return;
+    }
+    if (node.count > 1 && 2.0f * node.half_size * scale_ < cell_pixels) {
+        merge(bodies, node);
+        return;
+    }
+    if (node.is_leaf()) {
+        const auto order = tree_.order();
+        for (int k = node.first; k < node.first + node.count; k++) {
+            const Body& body = bodies[order[k]];
+            if (overlaps(view_, body.pos, body.radius)) {
+                drawn_.push_back(body);
+            }
+        }
+        return;
+    }
+    for (int child : node.children) {
+        if (child >= 0) {
+            visit(bodies, child);
+        }
+    }
+}
+
+void BodyCuller::merge(std::span<const Body> bodies, const QuadNode& node) {
+    // bodies wider than half a cell on screen are drawn as they are
+    const float merged_radius = 0.5f * cell_pixels / scale_;
+    const auto order = tree_.order();
+    float mass = 0.0f, area = 0.0f;
+    Vector2 moment = {};
+    float color[4] = {};
+    for (int k = node.first; k < node.first + node.count; k++) {
+        const Body& body = bodies[order[k]];
+        if (body.radius >= merged_radius) {
+            if (overlaps(view_, body.pos, body.radius)) {
+                drawn_.push_back(body);
+            }
+            continue;
+        }
+        const float a = std::numbers::pi_v<float> * body.radius * body.radius;
+        mass += body.mass;
+        moment += body.pos * body.mass;
+        area += a;
+        color[0] += a * body.color.r;
+        color[1] += a * body.color.g;
+        color[2] += a * body.color.b;
+        color[3] += a * body.color.a;
+    }
+    if (area == 0.0f || mass == 0.0f) {
+        return;
+    }
+
+    const float side = 2.0f * node.half_size;
+    const float coverage = std::min(area / (side * side), 1.0f);
+    const auto channel = [&](float sum) {
+        return static_cast<unsigned char>(std::clamp(sum / area, 0.0f, 255.0f));
+    };
+    drawn_.push_back(Body {
+        .mass = mass,
+        .radius = side / std::sqrt(std::numbers::pi_v<float>),
+        .pos = moment / mass,
+        .vel = {},
+        .color = {channel(color[0]), channel(color[1]), channel(color[2]),
+                  channel(color[3] * coverage)},
+    });
+    clusters_++;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include <raylib.h>
+
+#include "body.hpp"
+#include "quadtree.hpp"
+#include "thread_pool.hpp"
+
+// picks what a frame draws of a system: the bodies whose circle overlaps the view and, where the
+// view is zoomed out so far that a whole cell of a quadtree over the bodies covers less than
+// `cell_pixels` on screen, one sprite for the cell in place of its bodies. The sprite sits at the
+// cell's center of mass with the cell's area, the mean color of its bodies and an opacity of the
+// share of that area the bodies would have covered, so sparse clusters fade out. Bodies large
+// enough to see on their own are never merged into one.
+//
+// The tree is the culler's own, over the drawn positions, and is refitted from frame to frame.
+// Below `min_bodies` bodies it is skipped and every body is culled on its own.
+class BodyCuller {
+public:
+    // `view` is the visible part of the world and `scale` the pixels per unit of it
+    std::span<const Body> cull(std::span<const Body> bodies, Rectangle view, float scale,
+                               ThreadPool* pool = nullptr);
+
+    // sprites among the bodies of the last cull
+    std::size_t clusters() const {
+        return clusters_;
+    }
+
+    float cell_pixels = 3.0f;
+    std::size_t min_bodies = 4096;
+    int leaf_size = 16;
+
+private:
+    void visit(std::span<const Body> bodies, int index);
+    void merge(std::span<const Body> bodies, const QuadNode& node);
+
+    QuadTree tree_;
+    std::vector<Body> drawn_;
+    Rectangle view_ {};
+    float scale_ = 1.0f;
+    float pad_ = 0.0f; // largest body radius, by which the cells are grown for the overlap test
+    std::size_t clusters_ = 0;
+};
@@ -0,0 +1,126 @@
+#include "body_renderer.hpp"
+
+#include <bit>
+#include <cassert>
+
+#include <raymath.h>
+#include <rlgl.h>
+
+static const char* VERTEX_SHADER = R"(#version 330
+layout(location = 0) in vec2 corner; // of the unit quad, in [-1, 1]
+layout(location = 1) in vec4 body;   // x, y, mass, radius
+layout(location = 2) in vec4 color;
+
+uniform mat4 mvp;
+
+out vec2 local;
+out vec4 body_color;
+
+void main() {
+    local = corner;
+    body_color = color;
+    gl_Position = mvp * vec4(body.xy + corner * body.w, 0.0, 1.0);
+}
+)";
+
+// one pixel of antialiasing at the rim
+static const char* FRAGMENT_SHADER = R"(#version 330
+in vec2 local;
+in vec4 body_color;
+
+out vec4 frag_color;
+
+void main() {
+    float dist = length(local);
+    float alpha = 1.0 - smoothstep(1.0 - fwidth(dist), 1.0, dist);
+    if (alpha <= 0.0) {
+        discard;
+    }
+    frag_color = vec4(body_color.rgb, body_color.a * alpha);
+}
+)";
+
+// two triangles covering [-1, 1]^2
+constexpr float QUAD[] = {-1, -1, 1, -1, 1, 1, -1, -1, 1, 1, -1, 1};
+
+bool BodyRenderer::available() {
+    return rlGetVersion() == RL_OPENGL_33 || rlGetVersion() == RL_OPENGL_43;
+}
+
+BodyRenderer::BodyRenderer() {
+    assert(available());
+    shader_ = LoadShaderFromMemory(VERTEX_SHADER, FRAGMENT_SHADER);
+    mvp_loc_ = GetShaderLocation(shader_, "mvp");
+    vao_ = rlLoadVertexArray();
+    rlEnableVertexArray(vao_);
+    quad_buf_ = rlLoadVertexBuffer(QUAD, sizeof(QUAD), false);
+    rlSetVertexAttribute(0, 2, RL_FLOAT, false, 0, 0);
+    rlEnableVertexAttribute(0);
+    rlDisableVertexArray();
+    reserve(1024);
+}
+
+BodyRenderer::~BodyRenderer() {
+    rlUnloadVertexBuffer(pos_buf_);
+    rlUnloadVertexBuffer(color_buf_);
+    rlUnloadVertexBuffer(quad_buf_);
+    rlUnloadVertexArray(vao_);
+    UnloadShader(shader_);
+}
+
+void BodyRenderer::reserve(std::size_t n) {
+    if (n <= capacity_) {
+        return;
+    }
+    if (capacity_ != 0) {
+        rlUnloadVertexBuffer(pos_buf_);
+        rlUnloadVertexBuffer(color_buf_);
+    }
+    capacity_ = std::bit_ceil(n);
+    pos_buf_ = rlLoadVertexBuffer(nullptr, static_cast<int>(capacity_ * sizeof(Vector4)), true);
+    color_buf_ = rlLoadVertexBuffer(nullptr, static_cast<int>(capacity_ * sizeof(Color)), true);
+}
+
+void BodyRenderer::draw(std::span<const Body> bodies) {
+    const std::size_t n = bodies.size();
+    if (n == 0) {
+        return;
+    }
+    reserve(n);
+    pos_staging_.resize(n);
+    color_staging_.resize(n);
+    for (std::size_t i = 0; i < n; i++) {
+        pos_staging_[i] = {bodies[i].pos.x, bodies[i].pos.y, bodies[i].mass, bodies[i].radius};
+        color_staging_[i] = bodies[i].color;
+    }
+    rlUpdateVertexBuffer(pos_buf_, pos_staging_.data(), static_cast<int>(n * sizeof(Vector4)), 0);
+    rlUpdateVertexBuffer(color_buf_, color_staging_.data(), static_cast<int>(n * sizeof(Color)),
+                         0);
+    draw(pos_buf_, color_buf_, n);
+}
+
+void BodyRenderer::draw(unsigned int position_buffer, unsigned int color_buffer,
+                        std::size_t count) {
+    if (count == 0) {
+        return;
+    }
+    // whatever raylib has batched so far goes first, so the bodies keep their place in the
+    // drawing order
+    rlDrawRenderBatchActive();
+
+    rlEnableShader(shader_.id);
+    rlSetUniformMatrix(mvp_loc_, MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection()));
+    rlEnableVertexArray(vao_);
+    rlEnableVertexBuffer(position_buffer);
+    rlSetVertexAttribute(1, 4, RL_FLOAT, false, 0, 0);
+    rlSetVertexAttributeDivisor(1, 1);
+    rlEnableVertexAttribute(1);
+    rlEnableVertexBuffer(color_buffer);
+    rlSetVertexAttribute(2, 4, RL_UNSIGNED_BYTE, true, 0, 0);
+    rlSetVertexAttributeDivisor(2, 1);
+    rlEnableVertexAttribute(2);
+    rlDrawVertexArrayInstanced(0, 6, static_cast<int>(count));
+    rlDisableVertexBuffer();
+    rlDisableVertexArray();
+    rlDisableShader();
+}
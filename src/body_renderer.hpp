@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include <raylib.h>
+
+#include "body.hpp"
+
+// draws all the bodies as one instanced quad draw, with the circle cut out in the fragment shader.
+// Each instance reads a vec4 (x, y, mass, radius) and an RGBA8 color, the same layout as the
+// buffers of GpuPairwiseEngine, so a device resident system is drawn without any copy. Needs
+// OpenGL 3.3 for instancing; call it between BeginDrawing and EndDrawing.
+class BodyRenderer {
+public:
+    BodyRenderer();
+    ~BodyRenderer();
+    BodyRenderer(const BodyRenderer&) = delete;
+    BodyRenderer& operator=(const BodyRenderer&) = delete;
+
+    static bool available();
+
+    // uploads the bodies into the renderer's own instance buffers
+    void draw(std::span<const Body> bodies);
+    // draws `count` instances straight from existing GL buffers
+    void draw(unsigned int position_buffer, unsigned int color_buffer, std::size_t count);
+
+private:
+    void reserve(std::size_t n);
+
+    Shader shader_ {};
+    int mvp_loc_ = -1;
+    unsigned int vao_ = 0;
+    unsigned int quad_buf_ = 0;
+    unsigned int pos_buf_ = 0;
+    unsigned int color_buf_ = 0;
+    std::size_t capacity_ = 0;
+    std::vector<Vector4> pos_staging_;
+    std::vector<Color> color_staging_;
+};
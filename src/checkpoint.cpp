@@ -0,0 +1,288 @@
+#include "checkpoint.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(std::endian::native == std::endian::little,
+              "checkpoints are used in place and are little-endian");
+static_assert(sizeof(Color) == 4);
+
+namespace {
+
+enum Field { X, Y, VX, VY, MASS, RADIUS, COLOR, AX, AY, LEVEL, ID, FIELD_COUNT };
+
+constexpr std::size_t ALIGNMENT = 64;
+
+constexpr std::size_t field_size(int field) {
+    return field == LEVEL ? 1 : 4;
+}
+
+constexpr bool has_field(int field, std::uint32_t flags) {
+    if (field == AX || field == AY) {
+        return flags & CheckpointHeader::HAS_ACCELERATIONS;
+    } else if (field == LEVEL) {
+        return flags & CheckpointHeader::HAS_LEVELS;
+    } else if (field == ID) {
+        return flags & CheckpointHeader::HAS_IDS;
+    }
+    return true;
+}
+
+struct Layout {
+    std::size_t offsets[FIELD_COUNT];
+    std::size_t total;
+};
+
+Layout layout(std::uint64_t count, std::uint32_t flags) {
+    Layout result {};
+    std::size_t offset = sizeof(CheckpointHeader);
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        offset = (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        result.offsets[field] = offset;
+        if (has_field(field, flags)) {
+            offset += count * field_size(field);
+        }
+    }
+    result.total = offset;
+    return result;
+}
+
+} // namespace
+
+std::expected<Checkpoint, std::string> Checkpoint::open(const std::filesystem::path& path) {
+    Checkpoint checkpoint;
+#ifdef _WIN32
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        return std::unexpected(std::format("cannot open {}", path.string()));
+    }
+    checkpoint.buffer_.resize(static_cast<std::size_t>(in.tellg()));
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(checkpoint.buffer_.data()),
+            static_cast<std::streamsize>(checkpoint.buffer_.size()));
+    if (!in) {
+        return std::unexpected(std::format("cannot read {}", path.string()));
+    }
+    checkpoint.data_ = checkpoint.buffer_.data();
+    checkpoint.bytes_ = checkpoint.buffer_.size();
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return std::unexpected(std::format("cannot open {}", path.string()));
+    }
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return std::unexpected(std::format("cannot read {}", path.string()));
+    }
+    void* data = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return std::unexpected(std::format("cannot map {}", path.string()));
+    }
+    checkpoint.data_ = static_cast<const std::byte*>(data);
+    checkpoint.bytes_ = static_cast<std::size_t>(st.st_size);
+#endif
+
+    if (checkpoint.bytes_ < sizeof(CheckpointHeader) ||
+        std::memcmp(checkpoint.header().magic, CheckpointHeader::MAGIC, 8) != 0) {
+        return std::unexpected(std::format("{} is not a checkpoint", path.string()));
+    }
+    const CheckpointHeader& header = checkpoint.header();
+    if (header.version != CheckpointHeader::VERSION) {
+        return std::unexpected(
+            std::format("{} has version {}, expected {}", path.string(), header.version,
+                        CheckpointHeader::VERSION));
+    }
+    // the count has to fit the file before any size is computed from it
+    if (header.count > checkpoint.bytes_ || layout(header.count, header.flags).total >
+                                                checkpoint.bytes_) {
+        return std::unexpected(std::format("{} is truncated", path.string()));
+    }
+    // everything that ends up in an enum or sizes a block step, so that restore can take it as is
+    const auto levels = checkpoint.field<std::uint8_t>(LEVEL);
+    if (header.integrator > static_cast<std::uint32_t>(Integrator::BLOCK) ||
+        header.collisions > static_cast<std::uint32_t>(CollisionMode::MERGE) ||
+        !(header.block_eta > 0.0f) ||
+        std::any_of(levels.begin(), levels.end(),
+                    [](std::uint8_t level) { return level > Simulation::MAX_BLOCK_LEVEL; })) {
+        return std::unexpected(std::format("{} is a corrupt checkpoint", path.string()));
+    }
+    return checkpoint;
+}
+
+Checkpoint::Checkpoint(Checkpoint&& other) noexcept :
+    data_(std::exchange(other.data_, nullptr)), bytes_(std::exchange(other.bytes_, 0)),
+    buffer_(std::move(other.buffer_)) {}
+
+Checkpoint& Checkpoint::operator=(Checkpoint&& other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(bytes_, other.bytes_);
+    std::swap(buffer_, other.buffer_);
+    return *this;
+}
+
+Checkpoint::~Checkpoint() {
+#ifndef _WIN32
+    if (data_ != nullptr) {
+        munmap(const_cast<std::byte*>(data_), bytes_);
+    }
+#endif
+}
+
+template<class T>
+std::span<const T> Checkpoint::field(int index) const {
+    const CheckpointHeader& h = header();
+    if (!has_field(index, h.flags)) {
+        return {};
+    }
+    const std::size_t offset = layout(h.count, h.flags).offsets[index];
+    return {reinterpret_cast<const T*>(data_ + offset), static_cast<std::size_t>(h.count)};
+}
+
+std::span<const float> Checkpoint::x() const {
+    return field<float>(X);
+}
+std::span<const float> Checkpoint::y() const {
+    return field<float>(Y);
+}
+std::span<const float> Checkpoint::vx() const {
+    return field<float>(VX);
+}
+std::span<const float> Checkpoint::vy() const {
+    return field<float>(VY);
+}
+std::span<const float> Checkpoint::mass() const {
+    return field<float>(MASS);
+}
+std::span<const float> Checkpoint::radius() const {
+    return field<float>(RADIUS);
+}
+std::span<const Color> Checkpoint::color() const {
+    return field<Color>(COLOR);
+}
+std::span<const std::uint32_t> Checkpoint::ids() const {
+    return field<std::uint32_t>(ID);
+}
+
+std::vector<Body> Checkpoint::bodies() const {
+    const auto xs = x(), ys = y(), vxs = vx(), vys = vy(), masses = mass(), radii = radius();
+    const auto colors = color();
+    std::vector<Body> result(size());
+    for (std::size_t i = 0; i < result.size(); i++) {
+        result[i] = {masses[i], radii[i], {xs[i], ys[i]}, {vxs[i], vys[i]}, colors[i]};
+    }
+    return result;
+}
+
+void Checkpoint::restore(Simulation& sim) const {
+    const CheckpointHeader& h = header();
+    std::vector<Vector2> acc;
+    if (h.flags & CheckpointHeader::HAS_ACCELERATIONS) {
+        const auto ax = field<float>(AX), ay = field<float>(AY);
+        acc.resize(size());
+        for (std::size_t i = 0; i < acc.size(); i++) {
+            acc[i] = {ax[i], ay[i]};
+        }
+    }
+    sim.integrator = static_cast<Integrator>(h.integrator);
+    sim.collisions = static_cast<CollisionMode>(h.collisions);
+    sim.block_eta = h.block_eta;
+    sim.restore(bodies(), h.steps, h.time, acc, field<std::uint8_t>(LEVEL), ids());
+}
+
+std::expected<void, std::string> save_checkpoint(const std::filesystem::path& path,
+                                                 const Simulation& sim) {
+    const auto bodies = sim.bodies();
+    const auto acc = sim.accelerations();
+    const auto levels = sim.timestep_levels();
+    const auto ids = sim.ids();
+
+    CheckpointHeader header {};
+    std::memcpy(header.magic, CheckpointHeader::MAGIC, sizeof(header.magic));
+    header.version = CheckpointHeader::VERSION;
+    header.flags = (acc.size() == bodies.size() ? CheckpointHeader::HAS_ACCELERATIONS : 0) |
+                   (levels.size() == bodies.size() ? CheckpointHeader::HAS_LEVELS : 0) |
+                   (ids.size() == bodies.size() ? CheckpointHeader::HAS_IDS : 0);
+    header.count = bodies.size();
+    header.steps = sim.step_count();
+    header.time = sim.time();
+    header.integrator = static_cast<std::uint32_t>(sim.integrator);
+    header.collisions = static_cast<std::uint32_t>(sim.collisions);
+    header.block_eta = sim.block_eta;
+
+    std::filesystem::path tmp = path;
+    tmp += ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return std::unexpected(std::format("cannot create {}", tmp.string()));
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // fields are gathered from the bodies a chunk at a time
+    constexpr std::size_t CHUNK = 1 << 14;
+    std::uint32_t chunk[CHUNK];
+    const Layout lay = layout(header.count, header.flags);
+    std::size_t written = sizeof(header);
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        const char zeros[ALIGNMENT] {};
+        out.write(zeros, static_cast<std::streamsize>(lay.offsets[field] - written));
+        written = lay.offsets[field];
+        if (!has_field(field, header.flags)) {
+            continue;
+        }
+        if (field == LEVEL) {
+            out.write(reinterpret_cast<const char*>(levels.data()),
+                      static_cast<std::streamsize>(levels.size()));
+            written += levels.size();
+            continue;
+        }
+        if (field == ID) {
+            out.write(reinterpret_cast<const char*>(ids.data()),
+                      static_cast<std::streamsize>(ids.size_bytes()));
+            written += ids.size_bytes();
+            continue;
+        }
+        for (std::size_t begin = 0; begin < bodies.size(); begin += CHUNK) {
+            const std::size_t end = std::min(bodies.size(), begin + CHUNK);
+            for (std::size_t i = begin; i < end; i++) {
+                const Body& body = bodies[i];
+                const float values[] = {body.pos.x, body.pos.y, body.vel.x, body.vel.y, body.mass,
+                                        body.radius};
+                auto& word = chunk[i - begin];
+                if (field <= RADIUS) {
+                    word = std::bit_cast<std::uint32_t>(values[field]);
+                } else if (field == COLOR) {
+                    word = std::bit_cast<std::uint32_t>(body.color);
+                } else {
+                    word = std::bit_cast<std::uint32_t>(field == AX ? acc[i].x : acc[i].y);
+                }
+            }
+            out.write(reinterpret_cast<const char*>(chunk),
+                      static_cast<std::streamsize>((end - begin) * sizeof(chunk[0])));
+        }
+        written += bodies.size() * field_size(field);
+    }
+    out.close();
+    if (!out) {
+        return std::unexpected(std::format("cannot write {}", tmp.string()));
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        return std::unexpected(std::format("cannot replace {}: {}", path.string(), ec.message()));
+    }
+    return {};
+}
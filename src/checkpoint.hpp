@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "body.hpp"
+#include "simulation.hpp"
+
+// Checkpoint file, version 1, little-endian: a 64 byte CheckpointHeader followed by one array per
+// field, each starting at a multiple of 64 bytes:
+//   x, y, vx, vy, mass, radius  float[count]
+//   color                       RGBA8[count]
+//   ax, ay                      float[count], with HAS_ACCELERATIONS
+//   level                       uint8[count], with HAS_LEVELS
+//   id                          uint32[count], with HAS_IDS
+// The arrays are used in place from the mapped file, so opening one costs no parsing.
+struct CheckpointHeader {
+    static constexpr char MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'C', 'K', '\0'};
+    static constexpr std::uint32_t VERSION = 1;
+    static constexpr std::uint32_t HAS_ACCELERATIONS = 1;
+    static constexpr std::uint32_t HAS_LEVELS = 2;
+    static constexpr std::uint32_t HAS_IDS = 4;
+
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t flags;
+    std::uint64_t count;
+    std::uint64_t steps;
+    double time;
+    std::uint32_t integrator;
+    std::uint32_t collisions;
+    float block_eta;
+    std::uint8_t reserved[12];
+};
+static_assert(sizeof(CheckpointHeader) == 64);
+
+// read-only view of a checkpoint file mapped into memory
+class Checkpoint {
+public:
+    static std::expected<Checkpoint, std::string> open(const std::filesystem::path& path);
+
+    Checkpoint(Checkpoint&& other) noexcept;
+    Checkpoint& operator=(Checkpoint&& other) noexcept;
+    ~Checkpoint();
+
+    const CheckpointHeader& header() const {
+        return *reinterpret_cast<const CheckpointHeader*>(data_);
+    }
+    std::size_t size() const {
+        return header().count;
+    }
+
+    std::span<const float> x() const;
+    std::span<const float> y() const;
+    std::span<const float> vx() const;
+    std::span<const float> vy() const;
+    std::span<const float> mass() const;
+    std::span<const float> radius() const;
+    std::span<const Color> color() const;
+    // Simulation::ids() of the bodies, or empty if the file has none
+    std::span<const std::uint32_t> ids() const;
+
+    std::vector<Body> bodies() const;
+    // the saved bodies, step count, time, integrator settings and integrator state
+    void restore(Simulation& sim) const;
+
+private:
+    Checkpoint() = default;
+    template<class T>
+    std::span<const T> field(int index) const;
+
+    const std::byte* data_ = nullptr;
+    std::size_t bytes_ = 0;
+    // where no mapping is available the file is read into here instead
+    std::vector<std::byte> buffer_;
+};
+
+// writes `sim` to `path` (through a temporary file, so an existing checkpoint is replaced only by
+// a complete one)
+std::expected<void, std::string> save_checkpoint(const std::filesystem::path& path,
+                                                 const Simulation& sim);
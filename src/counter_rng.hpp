@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numbers>
+
+// counter-based random numbers: the n-th draw of stream s under a seed is a hash of the three,
+// with no state carried from one draw to the next beyond the counter. Every body of a generated
+// system draws from its own stream, so the system comes out the same on any number of threads.
+// It also meets UniformRandomBitGenerator for the std distributions.
+class CounterRng {
+public:
+    using result_type = std::uint64_t;
+
+    CounterRng(std::uint64_t seed, std::uint64_t stream) : key_(mix(mix(seed) ^ stream)) {}
+
+    static constexpr result_type min() {
+        return 0;
+    }
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+    result_type operator()() {
+        return mix(key_ + ++counter_ * GOLDEN);
+    }
+
+    // in [0, 1)
+    float uniform() {
+        return static_cast<float>((*this)() >> 40) * 0x1p-24f;
+    }
+    float uniform(float lo, float hi) {
+        return lo + (hi - lo) * uniform();
+    }
+    // standard normal by Box-Muller, drawing two numbers per call
+    float normal() {
+        const float r = std::sqrt(-2.0f * std::log(1.0f - uniform()));
+        return r * std::cos(2.0f * std::numbers::pi_v<float> * uniform());
+    }
+
+private:
+    static constexpr std::uint64_t GOLDEN = 0x9E3779B97F4A7C15;
+
+    // the SplitMix64 finalizer
+    static constexpr std::uint64_t mix(std::uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xBF58476D1CE4E5B9;
+        x ^= x >> 27;
+        x *= 0x94D049BB133111EB;
+        return x ^ (x >> 31);
+    }
+
+    std::uint64_t key_;
+    std::uint64_t counter_ = 0;
+};
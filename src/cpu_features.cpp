@@ -0,0 +1,77 @@
+#include "cpu_features.hpp"
+
+#include <atomic>
+
+namespace {
+
+constexpr SimdIsa SIMD_ISAS[] = {SimdIsa::SCALAR, SimdIsa::SSE2, SimdIsa::AVX2, SimdIsa::AVX512,
+                                 SimdIsa::NEON};
+
+SimdIsa detect_simd_isa() {
+    // best first
+    for (SimdIsa isa : {SimdIsa::AVX512, SimdIsa::AVX2, SimdIsa::SSE2, SimdIsa::NEON}) {
+        if (simd_isa_supported(isa)) {
+            return isa;
+        }
+    }
+    return SimdIsa::SCALAR;
+}
+
+std::atomic<SimdIsa>& active_isa() {
+    static std::atomic<SimdIsa> isa = detect_simd_isa();
+    return isa;
+}
+
+} // namespace
+
+const char* simd_isa_name(SimdIsa isa) {
+    switch (isa) {
+        case SimdIsa::SCALAR:
+            return "scalar";
+        case SimdIsa::SSE2:
+            return "sse2";
+        case SimdIsa::AVX2:
+            return "avx2";
+        case SimdIsa::AVX512:
+            return "avx512";
+        case SimdIsa::NEON:
+            return "neon";
+    }
+    return "?";
+}
+
+std::span<const SimdIsa> simd_isas() {
+    return SIMD_ISAS;
+}
+
+bool simd_isa_supported(SimdIsa isa) {
+    switch (isa) {
+        case SimdIsa::SCALAR:
+            return true;
+#if defined(NBODY_X86)
+        case SimdIsa::SSE2:
+            return __builtin_cpu_supports("sse2");
+        case SimdIsa::AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case SimdIsa::AVX512:
+            return __builtin_cpu_supports("avx512f");
+#elif defined(__aarch64__)
+        case SimdIsa::NEON:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+SimdIsa simd_isa() {
+    return active_isa().load(std::memory_order_relaxed);
+}
+
+bool set_simd_isa(SimdIsa isa) {
+    if (!simd_isa_supported(isa)) {
+        return false;
+    }
+    active_isa().store(isa, std::memory_order_relaxed);
+    return true;
+}
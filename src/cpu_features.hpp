@@ -0,0 +1,33 @@
+#pragma once
+
+#include <span>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NBODY_X86
+#endif
+
+// compiles one function for `isa` whatever the flags of the rest of its file, for the kernel
+// versions that are only called once simd_isa() has said the CPU can run them
+#define NBODY_TARGET(isa) __attribute__((target(isa)))
+
+// vector instruction sets that the SIMD kernels have versions for
+enum class SimdIsa {
+    SCALAR,
+    SSE2,   // x86-64 baseline, 4 floats
+    AVX2,   // with FMA, 8 floats
+    AVX512, // AVX-512F, 16 floats
+    NEON,   // arm64 baseline, 4 floats
+};
+
+const char* simd_isa_name(SimdIsa isa);
+std::span<const SimdIsa> simd_isas();
+
+// whether this CPU can run the kernels of `isa`, from CPUID on x86
+bool simd_isa_supported(SimdIsa isa);
+
+// instruction set the kernels run with: the best this CPU supports, detected on first use, so one
+// binary runs the best kernel of every machine it is copied to
+SimdIsa simd_isa();
+// makes the kernels run with `isa` instead (to compare them, or to get the same rounding on every
+// machine), false if the CPU lacks it. Not to be called while a kernel runs.
+bool set_simd_isa(SimdIsa isa);
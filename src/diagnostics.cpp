@@ -0,0 +1,34 @@
+#include "diagnostics.hpp"
+
+#include <cmath>
+
+Diagnostics measure_diagnostics(std::span<const Body> bodies, double potential) {
+    Diagnostics d;
+    d.potential = potential;
+    for (const Body& body : bodies) {
+        const double m = body.mass;
+        const double vx = body.vel.x, vy = body.vel.y;
+        const double cross = body.pos.x * vy - body.pos.y * vx;
+        d.kinetic += 0.5 * m * (vx * vx + vy * vy);
+        d.momentum_x += m * vx;
+        d.momentum_y += m * vy;
+        d.angular_momentum += m * cross;
+        d.momentum_scale += m * std::hypot(vx, vy);
+        d.angular_momentum_scale += m * std::abs(cross);
+    }
+    return d;
+}
+
+DiagnosticsDrift diagnostics_drift(const Diagnostics& initial, const Diagnostics& current) {
+    const auto relative = [](double change, double scale) {
+        return scale > 0.0 ? change / scale : 0.0;
+    };
+    return {
+        .energy = relative(current.energy() - initial.energy(), std::abs(initial.energy())),
+        .momentum = relative(std::hypot(current.momentum_x - initial.momentum_x,
+                                        current.momentum_y - initial.momentum_y),
+                             initial.momentum_scale),
+        .angular_momentum = relative(current.angular_momentum - initial.angular_momentum,
+                                     initial.angular_momentum_scale),
+    };
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include "body.hpp"
+
+// the conserved quantities of a system at one step. Gravity and elastic collisions conserve both
+// momenta and gravity alone the energy as well, so their drift over a run is the error of the
+// integration; an energy drift that grows quickly with dt means the step is too large.
+struct Diagnostics {
+    std::uint64_t step = 0;
+    double time = 0.0;
+    double kinetic = 0.0;
+    double potential = 0.0; // NaN if the engine does not sum it
+    double momentum_x = 0.0;
+    double momentum_y = 0.0;
+    double angular_momentum = 0.0; // about the origin
+    // sums of m |v| and m |x cross v|, the scales the momentum drifts are measured against, as
+    // the totals may well be zero
+    double momentum_scale = 0.0;
+    double angular_momentum_scale = 0.0;
+
+    double energy() const {
+        return kinetic + potential;
+    }
+};
+
+// the kinetic energy and momenta of `bodies`, from one pass over them in a fixed order
+Diagnostics measure_diagnostics(std::span<const Body> bodies, double potential);
+
+// relative change of each quantity from `initial` to `current`
+struct DiagnosticsDrift {
+    double energy;
+    double momentum;
+    double angular_momentum;
+};
+
+DiagnosticsDrift diagnostics_drift(const Diagnostics& initial, const Diagnostics& current);
@@ -0,0 +1,240 @@
+#include "distributed.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+// keys per rank that the splitters of a rebalance are picked from
+constexpr std::size_t SPLITTER_SAMPLES = 256;
+
+// one key out of every so many of a rank, standing for `weight` of the work up to the next one
+struct CurveSample {
+    std::uint32_t key;
+    float weight;
+};
+
+// distance from `p` to the nearest point of the box, 0 inside it
+float box_distance(Vector2 p, const float* box) {
+    const float dx = std::max({box[0] - p.x, 0.0f, p.x - box[2]});
+    const float dy = std::max({box[1] - p.y, 0.0f, p.y - box[3]});
+    return std::sqrt(dx * dx + dy * dy);
+}
+
+void exclusive_scan(std::span<const int> counts, std::vector<int>& displs) {
+    displs.resize(counts.size());
+    std::exclusive_scan(counts.begin(), counts.end(), displs.begin(), 0);
+}
+
+} // namespace
+
+DistributedEngine::DistributedEngine(MPI_Comm comm, ForceEngine& local) :
+    comm_(comm), local_(local) {
+    MPI_Comm_rank(comm_, &rank_);
+    MPI_Comm_size(comm_, &ranks_);
+    // bodies go over the wire as they are in memory, as every rank runs the same executable
+    MPI_Type_contiguous(sizeof(Body), MPI_BYTE, &body_type_);
+    MPI_Type_commit(&body_type_);
+}
+
+DistributedEngine::~DistributedEngine() {
+    MPI_Type_free(&body_type_);
+}
+
+void DistributedEngine::compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) {
+    targets_.resize(bodies.size());
+    std::iota(targets_.begin(), targets_.end(), 0u);
+    compute_subset(bodies, targets_, acc, dt);
+}
+
+void DistributedEngine::compute_subset(std::span<const Body> bodies,
+                                       std::span<const std::uint32_t> targets,
+                                       std::span<Vector2> acc, float dt) {
+    assert(acc.size() == bodies.size());
+    const double start = MPI_Wtime();
+    exchange(bodies);
+    const double exchanged = MPI_Wtime();
+
+    local_.pool = pool;
+    local_.collisions = collisions;
+    local_.deterministic = deterministic;
+    local_.with_potential = with_potential;
+    combined_acc_.resize(combined_.size());
+    // the received bodies come after this rank's own, so the targets index both alike
+    local_.compute_subset(combined_, targets, combined_acc_, dt);
+    local_.with_potential = false;
+    for (std::uint32_t i : targets) {
+        acc[i] = combined_acc_[i];
+    }
+    interactions = local_.interactions;
+    potential_energy = local_.potential_energy;
+
+    exchange_seconds_ += exchanged - start;
+    force_seconds_ += MPI_Wtime() - exchanged;
+}
+
+void DistributedEngine::exchange(std::span<const Body> bodies) {
+    // the domain of every rank is the bounding box of its bodies
+    float box[4] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                    std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
+    for (const Body& body : bodies) {
+        box[0] = std::min(box[0], body.pos.x);
+        box[1] = std::min(box[1], body.pos.y);
+        box[2] = std::max(box[2], body.pos.x);
+        box[3] = std::max(box[3], body.pos.y);
+    }
+    domains_.resize(4 * ranks_);
+    MPI_Allgather(box, 4, MPI_FLOAT, domains_.data(), 4, MPI_FLOAT, comm_);
+
+    // the essential tree of this rank for every other one, in rank order
+    send_.clear();
+    send_counts_.assign(ranks_, 0);
+    if (!bodies.empty()) {
+        tree_.update(bodies, leaf_size, 0.25f, pool);
+    }
+    const auto nodes = tree_.nodes();
+    const auto order = tree_.order();
+    for (int r = 0; r < ranks_; r++) {
+        const float* domain = &domains_[4 * r];
+        if (r == rank_ || bodies.empty() || domain[0] > domain[2]) {
+            continue;
+        }
+        const std::size_t before = send_.size();
+        stack_.assign(1, 0);
+        while (!stack_.empty()) {
+            const QuadNode& node = nodes[stack_.back()];
+            stack_.pop_back();
+            // the Barnes-Hut criterion for the nearest point the domain could hold a body at
+            const float open_dist =
+                2.0f * node.half_size / theta + Vector2Distance(node.com, node.center);
+            if (node.count > 1 && open_dist < box_distance(node.com, domain)) {
+                send_.push_back(Body {.mass = node.mass,
+                                      .radius = 0.0f,
+                                      .pos = node.com,
+                                      .vel = {},
+                                      .color = {}});
+            } else if (node.is_leaf()) {
+                for (int k = node.first; k < node.first + node.count; k++) {
+                    send_.push_back(bodies[order[k]]);
+                }
+            } else {
+                for (int child : node.children) {
+                    if (child >= 0) {
+                        stack_.push_back(child);
+                    }
+                }
+            }
+        }
+        send_counts_[r] = static_cast<int>(send_.size() - before);
+    }
+
+    recv_counts_.resize(ranks_);
+    MPI_Alltoall(send_counts_.data(), 1, MPI_INT, recv_counts_.data(), 1, MPI_INT, comm_);
+    exclusive_scan(send_counts_, send_displs_);
+    exclusive_scan(recv_counts_, recv_displs_);
+    local_count_ = bodies.size();
+    const std::size_t received = recv_displs_.back() + recv_counts_.back();
+    combined_.resize(local_count_ + received);
+    std::copy(bodies.begin(), bodies.end(), combined_.begin());
+    MPI_Alltoallv(send_.data(), send_counts_.data(), send_displs_.data(), body_type_,
+                  combined_.data() + local_count_, recv_counts_.data(), recv_displs_.data(),
+                  body_type_, comm_);
+}
+
+void rebalance(MPI_Comm comm, Simulation& sim, double work) {
+    int rank = 0, ranks = 1;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+    const auto bodies = sim.bodies();
+    const auto ids = sim.ids();
+    const std::size_t n = bodies.size();
+
+    // Morton keys over the bounding box of the whole system, as Simulation::reorder makes them
+    float lo[2] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+    float hi[2] = {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
+    for (const Body& body : bodies) {
+        lo[0] = std::min(lo[0], body.pos.x);
+        lo[1] = std::min(lo[1], body.pos.y);
+        hi[0] = std::max(hi[0], body.pos.x);
+        hi[1] = std::max(hi[1], body.pos.y);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, lo, 2, MPI_FLOAT, MPI_MIN, comm);
+    MPI_Allreduce(MPI_IN_PLACE, hi, 2, MPI_FLOAT, MPI_MAX, comm);
+    const float to_grid = 65535.0f / std::max(std::max(hi[0] - lo[0], hi[1] - lo[1]), 1e-6f);
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> keys(n);
+    for (std::size_t i = 0; i < n; i++) {
+        const float qx = std::clamp((bodies[i].pos.x - lo[0]) * to_grid, 0.0f, 65535.0f);
+        const float qy = std::clamp((bodies[i].pos.y - lo[1]) * to_grid, 0.0f, 65535.0f);
+        keys[i] = {morton_encode(static_cast<std::uint16_t>(qx), static_cast<std::uint16_t>(qy)),
+                   static_cast<std::uint32_t>(i)};
+    }
+    std::sort(keys.begin(), keys.end());
+
+    // every rank samples its keys evenly, each sample standing for the work of the bodies up to
+    // the next one, and all of them cut the merged samples into equal shares of the total work
+    double total_work = work;
+    MPI_Allreduce(MPI_IN_PLACE, &total_work, 1, MPI_DOUBLE, MPI_SUM, comm);
+    const double body_work = total_work > 0.0 ? (n ? work / n : 0.0) : 1.0;
+    const std::size_t samples = std::min(n, SPLITTER_SAMPLES);
+    std::vector<CurveSample> own(samples);
+    for (std::size_t s = 0; s < samples; s++) {
+        own[s] = {keys[s * n / samples].first,
+                  static_cast<float>(body_work * ((s + 1) * n / samples - s * n / samples))};
+    }
+    std::vector<int> counts(ranks), displs;
+    const int own_bytes = static_cast<int>(samples * sizeof(CurveSample));
+    MPI_Allgather(&own_bytes, 1, MPI_INT, counts.data(), 1, MPI_INT, comm);
+    exclusive_scan(counts, displs);
+    std::vector<CurveSample> all((displs.back() + counts.back()) / sizeof(CurveSample));
+    MPI_Allgatherv(own.data(), own_bytes, MPI_BYTE, all.data(), counts.data(), displs.data(),
+                   MPI_BYTE, comm);
+    std::sort(all.begin(), all.end(),
+              [](const CurveSample& a, const CurveSample& b) { return a.key < b.key; });
+    double weight = 0.0;
+    for (const CurveSample& sample : all) {
+        weight += sample.weight;
+    }
+    // rank r takes the keys from splitters[r - 1] up to splitters[r]
+    std::vector<std::uint32_t> splitters;
+    double sum = 0.0;
+    for (const CurveSample& sample : all) {
+        while (splitters.size() + 1 < static_cast<std::size_t>(ranks) &&
+               sum >= weight * static_cast<double>(splitters.size() + 1) / ranks) {
+            splitters.push_back(sample.key);
+        }
+        sum += sample.weight;
+    }
+    splitters.resize(ranks - 1, std::numeric_limits<std::uint32_t>::max());
+
+    // the bodies in key order are already grouped by the rank they go to
+    std::vector<Body> outgoing(n);
+    std::vector<std::uint32_t> outgoing_ids(n);
+    std::vector<int> send_counts(ranks, 0);
+    for (std::size_t k = 0; k < n; k++) {
+        const auto [key, i] = keys[k];
+        outgoing[k] = bodies[i];
+        outgoing_ids[k] = ids[i];
+        send_counts[std::upper_bound(splitters.begin(), splitters.end(), key) -
+                    splitters.begin()]++;
+    }
+    std::vector<int> recv_counts(ranks), send_displs, recv_displs;
+    MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT, comm);
+    exclusive_scan(send_counts, send_displs);
+    exclusive_scan(recv_counts, recv_displs);
+    const std::size_t incoming = recv_displs.back() + recv_counts.back();
+    std::vector<Body> moved(incoming);
+    std::vector<std::uint32_t> moved_ids(incoming);
+    MPI_Datatype body_type;
+    MPI_Type_contiguous(sizeof(Body), MPI_BYTE, &body_type);
+    MPI_Type_commit(&body_type);
+    MPI_Alltoallv(outgoing.data(), send_counts.data(), send_displs.data(), body_type, moved.data(),
+                  recv_counts.data(), recv_displs.data(), body_type, comm);
+    MPI_Type_free(&body_type);
+    MPI_Alltoallv(outgoing_ids.data(), send_counts.data(), send_displs.data(), MPI_UINT32_T,
+                  moved_ids.data(), recv_counts.data(), recv_displs.data(), MPI_UINT32_T, comm);
+
+    sim.restore(std::move(moved), sim.step_count(), sim.time(), {}, {}, moved_ids);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <mpi.h>
+
+#include "gravity.hpp"
+#include "quadtree.hpp"
+#include "simulation.hpp"
+
+// force engine for the bodies one MPI rank owns out of a system spread over the ranks of `comm`.
+// Before every evaluation the ranks swap their locally essential trees: each walks its own
+// quadtree for every other rank and sends the cells that look smaller than `theta` radians from
+// anywhere in that rank's domain as single masses, and the bodies of the leaves it had to open as
+// they are. `local` then sums the forces on this rank's bodies from its own bodies and everything
+// it received, so the far field is a Barnes-Hut approximation whatever `local` is, and a zero
+// `theta` sends every body everywhere for the exact sum. Received bodies carry their velocities,
+// so a kernel collision across a domain boundary is resolved like any other.
+//
+// Every evaluation is a collective exchange, so all the ranks have to make the same evaluations:
+// the integrators that evaluate the whole system a fixed number of times per step do, the block
+// integrator (whose steps depend on the bodies) and anything that removes bodies on one rank only
+// do not. `local` needs a compute_subset that sums only the targets (the pairwise and Barnes-Hut
+// engines) for the potential to come out right.
+class DistributedEngine final : public ForceEngine {
+public:
+    DistributedEngine(MPI_Comm comm, ForceEngine& local);
+    ~DistributedEngine() override;
+
+    const char* name() const override {
+        return local_.name();
+    }
+    void compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) override;
+    void compute_subset(std::span<const Body> bodies, std::span<const std::uint32_t> targets,
+                        std::span<Vector2> acc, float dt) override;
+
+    // seconds spent in the local engine and in the exchange, summed since the last reset
+    double force_seconds() const {
+        return force_seconds_;
+    }
+    double exchange_seconds() const {
+        return exchange_seconds_;
+    }
+    void reset_timers() {
+        force_seconds_ = exchange_seconds_ = 0.0;
+    }
+    // bodies and cells received from the other ranks by the last evaluation
+    std::size_t received() const {
+        return combined_.size() - local_count_;
+    }
+
+    float theta = 0.5f;
+    int leaf_size = 8;
+
+private:
+    // fills combined_ with `bodies` followed by what the other ranks sent for this one
+    void exchange(std::span<const Body> bodies);
+
+    MPI_Comm comm_;
+    ForceEngine& local_;
+    MPI_Datatype body_type_ = MPI_DATATYPE_NULL;
+    int rank_ = 0;
+    int ranks_ = 1;
+    QuadTree tree_;
+    std::vector<float> domains_; // min x, min y, max x, max y of every rank, empty if min > max
+    std::vector<Body> send_;
+    std::vector<int> send_counts_, send_displs_, recv_counts_, recv_displs_;
+    std::vector<int> stack_;
+    std::vector<Body> combined_;
+    std::size_t local_count_ = 0;
+    std::vector<Vector2> combined_acc_;
+    std::vector<std::uint32_t> targets_;
+    double force_seconds_ = 0.0;
+    double exchange_seconds_ = 0.0;
+};
+
+// moves bodies between the ranks of `comm` so that each owns one stretch of the Z-order curve
+// over the whole system, cut where the work adds up to equal shares. `work` is this rank's
+// measured force time since the last rebalance, spread evenly over its bodies, so that a rank
+// that took longer hands some of its bodies to the others; 0 on every rank weighs all bodies the
+// same. Every rank calls it at the same step. The ids, step count and time come along, the
+// integrator state does not.
+void rebalance(MPI_Comm comm, Simulation& sim, double work);
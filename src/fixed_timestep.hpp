@@ -0,0 +1,32 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+// decouples the physics step from the frame rate: frame times are accumulated and consumed in
+// steps of exactly `dt`, so a stutter runs more steps instead of one huge (unstable) one
+struct FixedTimestep {
+    float dt;
+    // cap on steps per frame; time beyond it is dropped rather than carried into later frames
+    int max_steps;
+    float accumulator = 0.0f;
+
+    // number of steps of `dt` to run for a frame that took `frame_time` seconds
+    int advance(float frame_time) {
+        accumulator += std::max(frame_time, 0.0f);
+        int steps = 0;
+        while (accumulator >= dt && steps < max_steps) {
+            accumulator -= dt;
+            steps++;
+        }
+        if (steps == max_steps) {
+            accumulator = std::fmod(accumulator, dt);
+        }
+        return steps;
+    }
+
+    // fraction of a step left in the accumulator, for interpolating between states
+    float alpha() const {
+        return accumulator / dt;
+    }
+};
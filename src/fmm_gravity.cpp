@@ -0,0 +1,318 @@
+#include "fmm_gravity.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+
+namespace {
+
+// depth of the subtrees handed to the pool (up to 4^4 tasks)
+constexpr int TASK_DEPTH = 4;
+constexpr int MAX_COEFS = (FmmEngine::MAX_ORDER + 1) * (FmmEngine::MAX_ORDER + 2) / 2;
+
+// the coefficient of x^a y^b, stored by total order a + b and then by b
+constexpr int coef_index(int a, int b) {
+    return (a + b) * (a + b + 1) / 2 + b;
+}
+
+constexpr auto FACTORIALS = [] {
+    std::array<double, FmmEngine::MAX_ORDER + 1> f {};
+    f[0] = 1.0;
+    for (std::size_t i = 1; i < f.size(); i++) {
+        f[i] = f[i - 1] * static_cast<double>(i);
+    }
+    return f;
+}();
+
+// x^a y^b / (a! b!) for every a + b <= p
+void scaled_powers(double x, double y, int p, double* out) {
+    double px[FmmEngine::MAX_ORDER + 1], py[FmmEngine::MAX_ORDER + 1];
+    px[0] = py[0] = 1.0;
+    for (int a = 1; a <= p; a++) {
+        px[a] = px[a - 1] * x / a;
+        py[a] = py[a - 1] * y / a;
+    }
+    for (int n = 0; n <= p; n++) {
+        for (int b = 0; b <= n; b++) {
+            out[coef_index(n - b, b)] = px[n - b] * py[b];
+        }
+    }
+}
+
+// d^(a+b) / dx^a dy^b of 1 / |r| at r = (x, y) for every a + b <= p. The Taylor coefficients
+// t = (-1)^(a+b) D / (a! b!) follow the recurrence
+//   n |r|^2 t(a, b) = (2n - 1) (x t(a-1, b) + y t(a, b-1)) - (n - 1) (t(a-2, b) + t(a, b-2))
+// with n = a + b, which is the one for 1 / |r| in space with no extent along z.
+void kernel_derivatives(double x, double y, int p, double* out) {
+    const double r_sqr = x * x + y * y;
+    double t[MAX_COEFS];
+    t[0] = 1.0 / std::sqrt(r_sqr);
+    for (int n = 1; n <= p; n++) {
+        for (int b = 0; b <= n; b++) {
+            const int a = n - b;
+            double first = 0.0, second = 0.0;
+            if (a >= 1) {
+                first += x * t[coef_index(a - 1, b)];
+            }
+            if (b >= 1) {
+                first += y * t[coef_index(a, b - 1)];
+            }
+            if (a >= 2) {
+                second += t[coef_index(a - 2, b)];
+            }
+            if (b >= 2) {
+                second += t[coef_index(a, b - 2)];
+            }
+            t[coef_index(a, b)] = ((2 * n - 1) * first - (n - 1) * second) / (n * r_sqr);
+        }
+    }
+    for (int n = 0; n <= p; n++) {
+        const double sign = n % 2 ? -1.0 : 1.0;
+        for (int b = 0; b <= n; b++) {
+            const int i = coef_index(n - b, b);
+            out[i] = sign * FACTORIALS[n - b] * FACTORIALS[b] * t[i];
+        }
+    }
+}
+
+void collect_tasks(std::span<const QuadNode> nodes, int index, int depth, std::vector<int>& out) {
+    if (depth == TASK_DEPTH || nodes[index].is_leaf()) {
+        out.push_back(index);
+        return;
+    }
+    for (int child : nodes[index].children) {
+        if (child >= 0) {
+            collect_tasks(nodes, child, depth + 1, out);
+        }
+    }
+}
+
+} // namespace
+
+// With M(k) = sum of m (x - c)^k / k! over the bodies of a cell around its center of mass c, the
+// potential -GRAVITY sum m / |x - x_j| at a point x + u of a distant cell centered on x is
+// -GRAVITY sum over n of L(n) u^n / n!, where L(n) = sum over k of (-1)^|k| M(k) D^(n+k)(1 / |r|)
+// at r = x - c. Both expansions are truncated at |n| + |k| <= p.
+void FmmEngine::compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) {
+    assert(acc.size() == bodies.size());
+    dt = collision_dt(dt);
+    std::fill(acc.begin(), acc.end(), Vector2 {});
+    interactions = 0;
+    tree_.update(bodies, leaf_size, max_drift, pool);
+    potential_ = with_potential ? potential_rows(bodies.size()) : std::span<double> {};
+    potential_energy = 0.0;
+    if (tree_.empty()) {
+        return;
+    }
+    p_ = std::clamp(order, 1, MAX_ORDER);
+    coefs_ = (p_ + 1) * (p_ + 2) / 2;
+
+    const auto nodes = tree_.nodes();
+    const auto sorted = tree_.order();
+    const std::size_t node_count = nodes.size();
+    multipoles_.assign(node_count * coefs_, 0.0);
+    locals_.assign(node_count * coefs_, 0.0);
+    radius_.resize(node_count);
+
+    // leaves expand their bodies in parallel...
+    parallel_for(pool, node_count, 64, [&](std::size_t begin, std::size_t end) {
+        double powers[MAX_COEFS];
+        for (std::size_t i = begin; i < end; i++) {
+            const QuadNode& node = nodes[i];
+            if (!node.is_leaf()) {
+                continue;
+            }
+            double* m = &multipoles_[i * coefs_];
+            double reach = 0.0;
+            for (int k = node.first; k < node.first + node.count; k++) {
+                const Body& body = bodies[sorted[k]];
+                const double dx = body.pos.x - node.com.x;
+                const double dy = body.pos.y - node.com.y;
+                scaled_powers(dx, dy, p_, powers);
+                for (int c = 0; c < coefs_; c++) {
+                    m[c] += body.mass * powers[c];
+                }
+                // a body that could touch one in another cell keeps the two cells from being
+                // accepted as far apart
+                reach = std::max(reach, std::hypot(dx, dy) + body.radius);
+            }
+            radius_[i] = reach;
+        }
+    });
+    // ...and their parents, which always come before them, gather the expansions going back up
+    for (std::size_t i = node_count; i-- > 0;) {
+        const QuadNode& node = nodes[i];
+        if (node.is_leaf()) {
+            continue;
+        }
+        double* m = &multipoles_[i * coefs_];
+        double reach = 0.0;
+        for (int child : node.children) {
+            if (child < 0) {
+                continue;
+            }
+            const double dx = nodes[child].com.x - node.com.x;
+            const double dy = nodes[child].com.y - node.com.y;
+            double powers[MAX_COEFS];
+            scaled_powers(dx, dy, p_, powers);
+            const double* mc = &multipoles_[child * coefs_];
+            for (int n = 0; n <= p_; n++) {
+                for (int b = 0; b <= n; b++) {
+                    const int a = n - b;
+                    double sum = 0.0;
+                    for (int ka = 0; ka <= a; ka++) {
+                        for (int kb = 0; kb <= b; kb++) {
+                            sum += mc[coef_index(ka, kb)] * powers[coef_index(a - ka, b - kb)];
+                        }
+                    }
+                    m[coef_index(a, b)] += sum;
+                }
+            }
+            reach = std::max(reach, radius_[child] + std::hypot(dx, dy));
+        }
+        radius_[i] = reach;
+    }
+
+    // every task accumulates the field on its own subtree from the whole tree, so no two threads
+    // write to the same expansion or body
+    tasks_.clear();
+    collect_tasks(nodes, 0, 0, tasks_);
+    std::atomic<std::uint64_t> total = 0;
+    parallel_for(pool, tasks_.size(), 1, [&](std::size_t begin, std::size_t end) {
+        std::uint64_t count = 0;
+        for (std::size_t t = begin; t < end; t++) {
+            interact(bodies, acc, tasks_[t], 0, dt, count);
+            evaluate(bodies, acc, tasks_[t]);
+        }
+        total.fetch_add(count, std::memory_order_relaxed);
+    });
+    interactions = total.load(std::memory_order_relaxed);
+    if (with_potential) {
+        potential_energy = sum_potential_rows();
+    }
+}
+
+void FmmEngine::interact(std::span<const Body> bodies, std::span<Vector2> acc, int target,
+                         int source, float dt, std::uint64_t& interactions) {
+    const auto nodes = tree_.nodes();
+    const QuadNode& t = nodes[target];
+    const QuadNode& s = nodes[source];
+    const double dx = t.com.x - s.com.x;
+    const double dy = t.com.y - s.com.y;
+    const double reach = radius_[target] + radius_[source];
+
+    if (reach * reach < theta * theta * (dx * dx + dy * dy)) {
+        double derivatives[MAX_COEFS];
+        kernel_derivatives(dx, dy, p_, derivatives);
+        const double* m = &multipoles_[source * coefs_];
+        double* l = &locals_[target * coefs_];
+        for (int n = 0; n <= p_; n++) {
+            for (int b = 0; b <= n; b++) {
+                const int a = n - b;
+                double sum = 0.0;
+                for (int k = 0; k <= p_ - n; k++) {
+                    double term = 0.0;
+                    for (int kb = 0; kb <= k; kb++) {
+                        term += m[coef_index(k - kb, kb)] *
+                                derivatives[coef_index(a + k - kb, b + kb)];
+                    }
+                    sum += k % 2 ? -term : term;
+                }
+                l[coef_index(a, b)] += sum;
+            }
+        }
+        interactions++;
+    } else if (t.is_leaf() && s.is_leaf()) {
+        const auto sorted = tree_.order();
+        for (int k = t.first; k < t.first + t.count; k++) {
+            const int i = sorted[k];
+            Vector2 sum = {};
+            float phi = 0.0f;
+            for (int j = s.first; j < s.first + s.count; j++) {
+                if (sorted[j] != i) {
+                    sum += pair_acceleration(bodies[i], bodies[sorted[j]], dt);
+                    if (!potential_.empty()) {
+                        phi += pair_potential(bodies[i], bodies[sorted[j]]);
+                    }
+                    interactions++;
+                }
+            }
+            acc[i] += sum;
+            if (!potential_.empty()) {
+                potential_[i] += 0.5 * GRAVITY * bodies[i].mass * phi;
+            }
+        }
+    } else if (s.is_leaf() || (!t.is_leaf() && radius_[target] > radius_[source])) {
+        for (int child : t.children) {
+            if (child >= 0) {
+                interact(bodies, acc, child, source, dt, interactions);
+            }
+        }
+    } else {
+        for (int child : s.children) {
+            if (child >= 0) {
+                interact(bodies, acc, target, child, dt, interactions);
+            }
+        }
+    }
+}
+
+void FmmEngine::evaluate(std::span<const Body> bodies, std::span<Vector2> acc, int index) {
+    const auto nodes = tree_.nodes();
+    const QuadNode& node = nodes[index];
+    const double* l = &locals_[index * coefs_];
+    double powers[MAX_COEFS];
+
+    if (node.is_leaf()) {
+        // the acceleration is minus the gradient of the potential, whose expansion in u has the
+        // coefficients of L shifted by one order along each axis
+        const auto sorted = tree_.order();
+        const int power_order = potential_.empty() ? p_ - 1 : p_;
+        for (int k = node.first; k < node.first + node.count; k++) {
+            const int i = sorted[k];
+            scaled_powers(bodies[i].pos.x - node.com.x, bodies[i].pos.y - node.com.y, power_order,
+                          powers);
+            double ax = 0.0, ay = 0.0;
+            for (int n = 0; n < p_; n++) {
+                for (int b = 0; b <= n; b++) {
+                    const double power = powers[coef_index(n - b, b)];
+                    ax += l[coef_index(n - b + 1, b)] * power;
+                    ay += l[coef_index(n - b, b + 1)] * power;
+                }
+            }
+            acc[i] += Vector2 {static_cast<float>(GRAVITY * ax), static_cast<float>(GRAVITY * ay)};
+            if (!potential_.empty()) {
+                double phi = 0.0;
+                for (int c = 0; c < coefs_; c++) {
+                    phi -= l[c] * powers[c];
+                }
+                potential_[i] += 0.5 * GRAVITY * bodies[i].mass * phi;
+            }
+        }
+        return;
+    }
+
+    for (int child : node.children) {
+        if (child < 0) {
+            continue;
+        }
+        scaled_powers(nodes[child].com.x - node.com.x, nodes[child].com.y - node.com.y, p_,
+                      powers);
+        double* lc = &locals_[child * coefs_];
+        for (int n = 0; n <= p_; n++) {
+            for (int b = 0; b <= n; b++) {
+                const int a = n - b;
+                double sum = 0.0;
+                for (int ka = a; ka <= p_; ka++) {
+                    for (int kb = b; ka + kb <= p_; kb++) {
+                        sum += l[coef_index(ka, kb)] * powers[coef_index(ka - a, kb - b)];
+                    }
+                }
+                lc[coef_index(a, b)] += sum;
+            }
+        }
+        evaluate(bodies, acc, child);
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "gravity.hpp"
+#include "quadtree.hpp"
+
+// O(N) fast multipole method over the Barnes-Hut quadtree. Every cell carries a multipole
+// expansion of its mass about its center of mass and a local (Taylor) expansion of the field of the
+// distant cells, both to `order` in the offsets. Pairs of cells whose radii add up to less than
+// `theta` times their separation interact through one expansion-to-expansion translation, closer
+// leaves sum their bodies directly (collisions included), and the local expansions are passed
+// down to the bodies at the end. Higher orders and smaller angles trade time for accuracy. The
+// potential energy, when asked for, comes from the same expansions evaluated one order further.
+//
+// The gravity here falls off as 1 / r^2 in the plane, the field of a 1 / r potential, which is
+// not the logarithmic potential that complex expansions describe, so the expansions are Cartesian
+// in the two coordinates.
+class FmmEngine final : public ForceEngine {
+public:
+    static constexpr int MAX_ORDER = 12;
+
+    explicit FmmEngine(int order = 4, float theta = 0.5f, int leaf_size = 16) :
+        order(order), theta(theta), leaf_size(leaf_size) {}
+
+    const char* name() const override {
+        return "fmm";
+    }
+    void compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) override;
+
+    const QuadTree& tree() const {
+        return tree_;
+    }
+
+    int order; // clamped to [1, MAX_ORDER]
+    float theta;
+    int leaf_size;
+    float max_drift = 0.25f; // as for BarnesHutEngine
+
+private:
+    // accumulates the interactions of the bodies in `target` with those in `source`
+    void interact(std::span<const Body> bodies, std::span<Vector2> acc, int target, int source,
+                  float dt, std::uint64_t& interactions);
+    // passes the local expansion of `index` on to its children and evaluates it at its bodies
+    void evaluate(std::span<const Body> bodies, std::span<Vector2> acc, int index);
+
+    QuadTree tree_;
+    int p_ = 0;
+    int coefs_ = 0; // coefficients per expansion
+    std::vector<double> multipoles_; // coefs_ per node
+    std::vector<double> locals_;
+    std::vector<double> radius_; // bound on the distance of a node's bodies from its com
+    std::vector<int> tasks_;     // disjoint subtrees handled by one thread each
+    std::span<double> potential_; // rows of the potential while one is summed, empty otherwise
+};
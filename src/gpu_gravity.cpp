@@ -0,0 +1,274 @@
+#include "gpu_gravity.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <format>
+#include <limits>
+#include <string>
+
+#include <rlgl.h>
+
+// rlgl has no wrapper for glMemoryBarrier, so it is loaded through GLFW, which raylib's desktop
+// platform is built on
+using GlProc = void (*)();
+extern "C" GlProc glfwGetProcAddress(const char* name);
+
+constexpr unsigned int GL_SHADER_STORAGE_BARRIER_BIT = 0x2000;
+constexpr unsigned int GL_BUFFER_UPDATE_BARRIER_BIT = 0x200;
+
+// makes the storage buffer writes of earlier dispatches visible to the accesses in `bits`
+static void memory_barrier(unsigned int bits) {
+    using MemoryBarrier = void (*)(unsigned int);
+    static const auto memory_barrier_fn =
+        reinterpret_cast<MemoryBarrier>(glfwGetProcAddress("glMemoryBarrier"));
+    memory_barrier_fn(bits);
+}
+
+constexpr unsigned int GROUP_SIZE = 256;
+
+// the physics constants are prepended so the shaders stay in sync with body.hpp
+static std::string shader_source(const char* body) {
+    return std::format("#version 430\n"
+                       "#define GROUP_SIZE {}\n"
+                       "const float GRAVITY = {:e};\n"
+                       "const float DIST_EPS = {:e};\n"
+                       "const float COLL_EPS = {:e};\n",
+                       GROUP_SIZE, GRAVITY, DIST_EPS, COLL_EPS) +
+           body;
+}
+
+// each workgroup stages GROUP_SIZE bodies at a time in shared memory and every invocation sums its
+// body's acceleration over them, exactly like pair_acceleration
+static const char* FORCE_SHADER = R"(
+layout(local_size_x = GROUP_SIZE) in;
+
+layout(std430, binding = 0) readonly buffer Positions { vec4 pos[]; }; // x, y, mass, radius
+layout(std430, binding = 1) readonly buffer Velocities { vec2 vel[]; };
+layout(std430, binding = 2) writeonly buffer Accelerations { vec2 acc[]; };
+
+uniform int n;
+uniform float idt; // 1 / dt, or 0 without collisions
+
+shared vec4 tile_pos[GROUP_SIZE];
+shared vec2 tile_vel[GROUP_SIZE];
+
+void main() {
+    uint count = uint(n);
+    uint i = gl_GlobalInvocationID.x;
+    uint lane = gl_LocalInvocationID.x;
+    vec4 body = i < count ? pos[i] : vec4(0.0);
+    vec2 body_vel = i < count ? vel[i] : vec2(0.0);
+
+    vec2 sum = vec2(0.0);
+    for (uint tile = 0u; tile < count; tile += GROUP_SIZE) {
+        uint j = tile + lane;
+        tile_pos[lane] = j < count ? pos[j] : vec4(0.0);
+        tile_vel[lane] = j < count ? vel[j] : vec2(0.0);
+        barrier();
+
+        uint tile_count = min(uint(GROUP_SIZE), count - tile);
+        for (uint k = 0u; k < tile_count; k++) {
+            if (tile + k == i) {
+                continue;
+            }
+            vec4 other = tile_pos[k];
+            vec2 xrel = other.xy - body.xy + DIST_EPS;
+            float dist_sqr = dot(xrel, xrel);
+            float dist = sqrt(dist_sqr);
+            float coef = GRAVITY * other.z / (dist_sqr * dist);
+            if (dist < body.w + other.w - COLL_EPS) {
+                vec2 vrel = body_vel - tile_vel[k];
+                float v_proj_mag = -dot(vrel, xrel) / dist_sqr;
+                coef += 2.0 * other.z / (body.z + other.z) * v_proj_mag * idt;
+            }
+            sum += xrel * coef;
+        }
+        barrier();
+    }
+    if (i < count) {
+        acc[i] = sum;
+    }
+}
+)";
+
+// vel += acc * kick, then pos += vel * drift; kick = drift = dt is Body::update
+static const char* INTEGRATE_SHADER = R"(
+layout(local_size_x = GROUP_SIZE) in;
+
+layout(std430, binding = 0) buffer Positions { vec4 pos[]; };
+layout(std430, binding = 1) buffer Velocities { vec2 vel[]; };
+layout(std430, binding = 2) readonly buffer Accelerations { vec2 acc[]; };
+
+uniform int n;
+uniform float kick;
+uniform float drift;
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= uint(n)) {
+        return;
+    }
+    vec2 v = vel[i] + acc[i] * kick;
+    vel[i] = v;
+    pos[i].xy += v * drift;
+}
+)";
+
+static unsigned int load_compute_program(const char* body) {
+    const std::string source = shader_source(body);
+    const unsigned int shader = rlCompileShader(source.c_str(), RL_COMPUTE_SHADER);
+    assert(shader != 0);
+    return rlLoadComputeShaderProgram(shader);
+}
+
+bool GpuPairwiseEngine::available() {
+    return rlGetVersion() == RL_OPENGL_43;
+}
+
+GpuPairwiseEngine::GpuPairwiseEngine() {
+    assert(available());
+    force_program_ = load_compute_program(FORCE_SHADER);
+    force_n_loc_ = rlGetLocationUniform(force_program_, "n");
+    force_idt_loc_ = rlGetLocationUniform(force_program_, "idt");
+    integrate_program_ = load_compute_program(INTEGRATE_SHADER);
+    integrate_n_loc_ = rlGetLocationUniform(integrate_program_, "n");
+    integrate_kick_loc_ = rlGetLocationUniform(integrate_program_, "kick");
+    integrate_drift_loc_ = rlGetLocationUniform(integrate_program_, "drift");
+    reserve(1024);
+}
+
+GpuPairwiseEngine::~GpuPairwiseEngine() {
+    for (unsigned int buf : {pos_buf_, vel_buf_, acc_buf_, color_buf_}) {
+        rlUnloadShaderBuffer(buf);
+    }
+    rlUnloadShaderProgram(force_program_);
+    rlUnloadShaderProgram(integrate_program_);
+}
+
+void GpuPairwiseEngine::reserve(std::size_t n) {
+    if (n <= capacity_) {
+        return;
+    }
+    if (capacity_ != 0) {
+        for (unsigned int buf : {pos_buf_, vel_buf_, acc_buf_, color_buf_}) {
+            rlUnloadShaderBuffer(buf);
+        }
+    }
+    capacity_ = std::bit_ceil(n);
+    const auto size = [&](std::size_t elem) { return static_cast<unsigned int>(capacity_ * elem); };
+    pos_buf_ = rlLoadShaderBuffer(size(sizeof(Vector4)), nullptr, RL_DYNAMIC_COPY);
+    vel_buf_ = rlLoadShaderBuffer(size(sizeof(Vector2)), nullptr, RL_DYNAMIC_COPY);
+    acc_buf_ = rlLoadShaderBuffer(size(sizeof(Vector2)), nullptr, RL_DYNAMIC_COPY);
+    color_buf_ = rlLoadShaderBuffer(size(sizeof(std::uint32_t)), nullptr, RL_DYNAMIC_COPY);
+}
+
+void GpuPairwiseEngine::upload(std::span<const Body> bodies) {
+    const std::size_t n = bodies.size();
+    reserve(n);
+    pos_staging_.resize(n);
+    vel_staging_.resize(n);
+    color_staging_.resize(n);
+    for (std::size_t i = 0; i < n; i++) {
+        const Body& body = bodies[i];
+        pos_staging_[i] = {body.pos.x, body.pos.y, body.mass, body.radius};
+        vel_staging_[i] = body.vel;
+        const Color c = body.color;
+        color_staging_[i] = c.r | c.g << 8 | c.b << 16 | static_cast<std::uint32_t>(c.a) << 24;
+    }
+    if (n != 0) {
+        const auto bytes = [&](const auto& v) {
+            return static_cast<unsigned int>(v.size() * sizeof(v[0]));
+        };
+        rlUpdateShaderBuffer(pos_buf_, pos_staging_.data(), bytes(pos_staging_), 0);
+        rlUpdateShaderBuffer(vel_buf_, vel_staging_.data(), bytes(vel_staging_), 0);
+        rlUpdateShaderBuffer(color_buf_, color_staging_.data(), bytes(color_staging_), 0);
+    }
+    count_ = n;
+    acc_valid_ = false;
+}
+
+void GpuPairwiseEngine::download(std::vector<Body>& bodies) {
+    // colors, masses and radii never change on the device, so they are taken from the staging
+    // copies of the last upload
+    const std::size_t n = count_;
+    pos_staging_.resize(n);
+    vel_staging_.resize(n);
+    memory_barrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    if (n != 0) {
+        rlReadShaderBuffer(pos_buf_, pos_staging_.data(),
+                           static_cast<unsigned int>(n * sizeof(Vector4)), 0);
+        rlReadShaderBuffer(vel_buf_, vel_staging_.data(),
+                           static_cast<unsigned int>(n * sizeof(Vector2)), 0);
+    }
+    bodies.resize(n);
+    for (std::size_t i = 0; i < n; i++) {
+        const std::uint32_t c = color_staging_[i];
+        bodies[i] = {
+            .mass = pos_staging_[i].z,
+            .radius = pos_staging_[i].w,
+            .pos = {pos_staging_[i].x, pos_staging_[i].y},
+            .vel = vel_staging_[i],
+            .color = {static_cast<unsigned char>(c), static_cast<unsigned char>(c >> 8),
+                      static_cast<unsigned char>(c >> 16), static_cast<unsigned char>(c >> 24)},
+        };
+    }
+}
+
+void GpuPairwiseEngine::dispatch_forces(float dt) {
+    dt = collision_dt(dt);
+    const float idt = dt ? 1.0f / dt : 0.0f;
+    const int n = static_cast<int>(count_);
+    rlEnableShader(force_program_);
+    rlSetUniform(force_n_loc_, &n, RL_SHADER_UNIFORM_INT, 1);
+    rlSetUniform(force_idt_loc_, &idt, RL_SHADER_UNIFORM_FLOAT, 1);
+    rlBindShaderBuffer(pos_buf_, 0);
+    rlBindShaderBuffer(vel_buf_, 1);
+    rlBindShaderBuffer(acc_buf_, 2);
+    rlComputeShaderDispatch((count_ + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+    rlDisableShader();
+    memory_barrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    interactions = count_ * (count_ - std::min<std::size_t>(count_, 1));
+    acc_valid_ = !collisions;
+}
+
+void GpuPairwiseEngine::dispatch_integrate(float kick, float drift) {
+    const int n = static_cast<int>(count_);
+    rlEnableShader(integrate_program_);
+    rlSetUniform(integrate_n_loc_, &n, RL_SHADER_UNIFORM_INT, 1);
+    rlSetUniform(integrate_kick_loc_, &kick, RL_SHADER_UNIFORM_FLOAT, 1);
+    rlSetUniform(integrate_drift_loc_, &drift, RL_SHADER_UNIFORM_FLOAT, 1);
+    rlBindShaderBuffer(pos_buf_, 0);
+    rlBindShaderBuffer(vel_buf_, 1);
+    rlBindShaderBuffer(acc_buf_, 2);
+    rlComputeShaderDispatch((count_ + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+    rlDisableShader();
+    memory_barrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GpuPairwiseEngine::compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) {
+    assert(acc.size() == bodies.size());
+    // the shader does not sum the potential
+    potential_energy = std::numeric_limits<double>::quiet_NaN();
+    upload(bodies);
+    if (bodies.empty()) {
+        interactions = 0;
+        return;
+    }
+    dispatch_forces(dt);
+    memory_barrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    rlReadShaderBuffer(acc_buf_, acc.data(), static_cast<unsigned int>(acc.size_bytes()), 0);
+}
+
+// kick-drift-kick leapfrog, one force dispatch per step once the accelerations are known
+void GpuPairwiseEngine::step(float dt) {
+    if (count_ == 0) {
+        return;
+    }
+    if (!acc_valid_) {
+        dispatch_forces(dt);
+    }
+    dispatch_integrate(dt * 0.5f, dt);
+    dispatch_forces(dt);
+    dispatch_integrate(dt * 0.5f, 0.0f);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "gravity.hpp"
+
+// PairwiseEngine in an OpenGL 4.3 compute shader, 256 bodies per shared memory tile. The bodies are
+// kept in shader storage buffers, so besides working as a ForceEngine (upload, dispatch, read back)
+// it can hold a whole system on the device and step it there with leapfrog, leaving the buffers
+// for drawing. Needs the window's GL context, so it is only built into the windowed app
+// (NBODY_GPU) and only constructed once available() says the context can run compute shaders.
+class GpuPairwiseEngine final : public ForceEngine {
+public:
+    GpuPairwiseEngine();
+    ~GpuPairwiseEngine() override;
+    GpuPairwiseEngine(const GpuPairwiseEngine&) = delete;
+    GpuPairwiseEngine& operator=(const GpuPairwiseEngine&) = delete;
+
+    static bool available();
+
+    const char* name() const override {
+        return "pairwise-gpu";
+    }
+    void compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) override;
+
+    // device resident stepping: upload once, step any number of times and download only when the
+    // CPU needs the state back. Bodies are not removed on the device.
+    void upload(std::span<const Body> bodies);
+    void step(float dt);
+    void download(std::vector<Body>& bodies);
+    std::size_t size() const {
+        return count_;
+    }
+
+    // vec4 (x, y, mass, radius) and packed RGBA per body, for drawing straight from the device
+    unsigned int position_buffer() const {
+        return pos_buf_;
+    }
+    unsigned int color_buffer() const {
+        return color_buf_;
+    }
+
+private:
+    void reserve(std::size_t n);
+    void dispatch_forces(float dt);
+    void dispatch_integrate(float kick, float drift);
+
+    unsigned int force_program_ = 0;
+    int force_n_loc_ = -1;
+    int force_idt_loc_ = -1;
+    unsigned int integrate_program_ = 0;
+    int integrate_n_loc_ = -1;
+    int integrate_kick_loc_ = -1;
+    int integrate_drift_loc_ = -1;
+
+    unsigned int pos_buf_ = 0;
+    unsigned int vel_buf_ = 0;
+    unsigned int acc_buf_ = 0;
+    unsigned int color_buf_ = 0;
+    std::size_t capacity_ = 0;
+    std::size_t count_ = 0;
+    // acc_buf_ matches the positions on the device (leapfrog reuses it)
+    bool acc_valid_ = false;
+
+    std::vector<Vector4> pos_staging_;
+    std::vector<Vector2> vel_staging_;
+    std::vector<std::uint32_t> color_staging_;
+};
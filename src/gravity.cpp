@@ -0,0 +1,478 @@
+#include "gravity.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+
+#include "fmm_gravity.hpp"
+#include "pm_gravity.hpp"
+#include "simd_gravity.hpp"
+
+// rows handed to a thread at a time; small enough to steal around rows made costly by collisions
+constexpr std::size_t ROW_GRAIN = 16;
+
+void ForceEngine::compute_subset(std::span<const Body> bodies,
+                                 std::span<const std::uint32_t> targets, std::span<Vector2> acc,
+                                 float dt) {
+    assert(acc.size() == bodies.size());
+    subset_acc_.resize(bodies.size());
+    compute(bodies, subset_acc_, dt);
+    for (std::uint32_t i : targets) {
+        acc[i] = subset_acc_[i];
+    }
+}
+
+std::span<double> ForceEngine::potential_rows(std::size_t n) {
+    potential_rows_.assign(n, 0.0);
+    return potential_rows_;
+}
+
+double ForceEngine::sum_potential_rows() const {
+    double sum = 0.0;
+    for (double row : potential_rows_) {
+        sum += row;
+    }
+    return sum;
+}
+
+const char* precision_name(Precision precision) {
+    switch (precision) {
+        case Precision::FLOAT:
+            return "float";
+        case Precision::DOUBLE:
+            return "double";
+    }
+    return "?";
+}
+
+const char* softening_name(Softening softening) {
+    switch (softening) {
+        case Softening::NONE:
+            return "none";
+        case Softening::PLUMMER:
+            return "plummer";
+    }
+    return "?";
+}
+
+// sum over all the other bodies for rows row(0) .. row(rows - 1); the loop skips the body itself
+// by splitting around it rather than testing every pair. With POTENTIAL each row also leaves its
+// share of the potential energy in `potential`.
+template<class Real, bool COLLIDE, Softening SOFTENING, bool POTENTIAL, class Row>
+static void pairwise_kernel_rows(std::span<const Body> bodies, std::size_t rows, Row row,
+                                 std::span<Vector2> acc, std::span<double> potential, float dt,
+                                 ThreadPool* pool) {
+    const Real idt = dt ? Real(1) / Real(dt) : Real(0);
+    parallel_for(pool, rows, ROW_GRAIN, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t t = begin; t < end; t++) {
+            const std::size_t i = row(t);
+            const Body& body = bodies[i];
+            Real ax = 0, ay = 0, phi = 0;
+            for (std::size_t j = 0; j < i; j++) {
+                accumulate_pair<Real, COLLIDE, SOFTENING, POTENTIAL>(body, bodies[j], idt, ax, ay,
+                                                                     &phi);
+            }
+            for (std::size_t j = i + 1; j < bodies.size(); j++) {
+                accumulate_pair<Real, COLLIDE, SOFTENING, POTENTIAL>(body, bodies[j], idt, ax, ay,
+                                                                     &phi);
+            }
+            acc[i] = {static_cast<float>(ax), static_cast<float>(ay)};
+            if constexpr (POTENTIAL) {
+                potential[i] = 0.5 * GRAVITY * body.mass * static_cast<double>(phi);
+            }
+        }
+    });
+}
+
+// pairwise_kernel_rows specialized for the given precision and softening, with the collision
+// response whenever dt is nonzero and the potential whenever `potential` is not empty
+template<class Row>
+static void pairwise_rows(Precision precision, Softening softening,
+                          std::span<const Body> bodies, std::size_t rows, Row row,
+                          std::span<Vector2> acc, std::span<double> potential, float dt,
+                          ThreadPool* pool) {
+    const auto with_potential = [&]<class Real, bool COLLIDE, Softening SOFTENING>() {
+        if (!potential.empty()) {
+            pairwise_kernel_rows<Real, COLLIDE, SOFTENING, true>(bodies, rows, row, acc,
+                                                                 potential, dt, pool);
+        } else {
+            pairwise_kernel_rows<Real, COLLIDE, SOFTENING, false>(bodies, rows, row, acc,
+                                                                  potential, dt, pool);
+        }
+    };
+    const auto with_softening = [&]<class Real, bool COLLIDE>() {
+        if (softening == Softening::PLUMMER) {
+            with_potential.template operator()<Real, COLLIDE, Softening::PLUMMER>();
+        } else {
+            with_potential.template operator()<Real, COLLIDE, Softening::NONE>();
+        }
+    };
+    const auto with_collisions = [&]<class Real>() {
+        if (dt) {
+            with_softening.template operator()<Real, true>();
+        } else {
+            with_softening.template operator()<Real, false>();
+        }
+    };
+    if (precision == Precision::DOUBLE) {
+        with_collisions.template operator()<double>();
+    } else {
+        with_collisions.template operator()<float>();
+    }
+}
+
+// the full sum over every other body for each of the target rows
+static void pairwise_rows(std::span<const Body> bodies, std::span<const std::uint32_t> targets,
+                          std::span<Vector2> acc, std::span<double> potential, float dt,
+                          ThreadPool* pool) {
+    pairwise_rows(Precision::FLOAT, Softening::NONE, bodies, targets.size(),
+                  [targets](std::size_t t) { return targets[t]; }, acc, potential, dt, pool);
+}
+
+void PairwiseEngine::compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) {
+    assert(acc.size() == bodies.size());
+    const std::span<double> potential =
+        with_potential ? potential_rows(bodies.size()) : std::span<double> {};
+    pairwise_rows(precision, softening, bodies, bodies.size(), [](std::size_t t) { return t; },
+                  acc, potential, collision_dt(dt), pool);
+    if (with_potential) {
+        potential_energy = sum_potential_rows();
+    }
+    interactions = bodies.size() * (bodies.size() - std::min<std::size_t>(bodies.size(), 1));
+}
+
+void PairwiseEngine::compute_subset(std::span<const Body> bodies,
+                                    std::span<const std::uint32_t> targets, std::span<Vector2> acc,
+                                    float dt) {
+    assert(acc.size() == bodies.size());
+    const std::span<double> potential =
+        with_potential ? potential_rows(bodies.size()) : std::span<double> {};
+    pairwise_rows(precision, softening, bodies, targets.size(),
+                  [targets](std::size_t t) { return targets[t]; }, acc, potential,
+                  collision_dt(dt), pool);
+    if (with_potential) {
+        potential_energy = sum_potential_rows();
+    }
+    interactions = targets.size() * (bodies.size() - std::min<std::size_t>(bodies.size(), 1));
+}
+
+// accumulates the interaction of bodies i and j (i != j) into both of them, and with POTENTIAL
+// their potential energy per unit GRAVITY into `energy`
+template<bool POTENTIAL>
+static void add_symmetric_pair(std::span<const Body> bodies, std::size_t i, std::size_t j,
+                               float idt, Vector2& acc_i, Vector2& acc_j, float& energy) {
+    const Body& body = bodies[i];
+    const Body& other = bodies[j];
+    const Vector2 xrel = Vector2AddValue(other.pos - body.pos, DIST_EPS);
+    const float dist_sqr = Vector2LengthSqr(xrel);
+    const float dist = std::sqrt(dist_sqr);
+    // per unit mass of the partner
+    float coef = GRAVITY / (dist_sqr * dist);
+    if (dist < body.radius + other.radius - COLL_EPS) {
+        const Vector2 vrel = body.vel - other.vel;
+        const float v_proj_mag = -Vector2DotProduct(vrel, xrel) / dist_sqr;
+        coef += 2.0f / (body.mass + other.mass) * v_proj_mag * idt;
+    }
+    if constexpr (POTENTIAL) {
+        energy -= body.mass * other.mass / dist;
+    }
+    acc_i += xrel * (coef * other.mass);
+    acc_j -= xrel * (coef * body.mass);
+}
+
+void SymmetricPairwiseEngine::compute(std::span<const Body> bodies, std::span<Vector2> acc,
+                                      float dt) {
+    assert(acc.size() == bodies.size());
+    const std::size_t n = bodies.size();
+    dt = collision_dt(dt);
+    const float idt = dt ? 1.0f / dt : 0.0f;
+    std::fill(acc.begin(), acc.end(), Vector2 {});
+    interactions = n * (n - std::min<std::size_t>(n, 1)) / 2;
+    if (with_potential) {
+        sum_pairs<true>(bodies, acc, idt);
+    } else {
+        sum_pairs<false>(bodies, acc, idt);
+    }
+}
+
+template<bool POTENTIAL>
+void SymmetricPairwiseEngine::sum_pairs(std::span<const Body> bodies, std::span<Vector2> acc,
+                                        float idt) {
+    const std::size_t n = bodies.size();
+    if (!deterministic && (!pool || pool->size() == 1)) {
+        double total = 0.0;
+        for (std::size_t i = 0; i < n; i++) {
+            float energy = 0.0f;
+            for (std::size_t j = i + 1; j < n; j++) {
+                add_symmetric_pair<POTENTIAL>(bodies, i, j, idt, acc[i], acc[j], energy);
+            }
+            total += energy;
+        }
+        if constexpr (POTENTIAL) {
+            potential_energy = GRAVITY * total;
+        }
+        return;
+    }
+
+    // a task owns one row tile and walks the tiles of the upper triangle to its right, so both
+    // sides of a block stay in cache
+    constexpr std::size_t TILE = 64;
+    const std::size_t n_tiles = (n + TILE - 1) / TILE;
+    // returns the potential energy of the tile's pairs per unit GRAVITY, with POTENTIAL
+    const auto add_tile = [&](std::size_t tile, std::span<Vector2> out) {
+        double energy = 0.0;
+        const std::size_t row_end = std::min(n, (tile + 1) * TILE);
+        for (std::size_t col_tile = tile; col_tile < n_tiles; col_tile++) {
+            const std::size_t col_end = std::min(n, (col_tile + 1) * TILE);
+            for (std::size_t i = tile * TILE; i < row_end; i++) {
+                Vector2 acc_i = {};
+                float energy_i = 0.0f;
+                for (std::size_t j = std::max(i + 1, col_tile * TILE); j < col_end; j++) {
+                    add_symmetric_pair<POTENTIAL>(bodies, i, j, idt, acc_i, out[j], energy_i);
+                }
+                out[i] += acc_i;
+                energy += energy_i;
+            }
+        }
+        return energy;
+    };
+
+    const std::size_t slices = deterministic ? DETERMINISTIC_SLICES : pool->size();
+    thread_acc_.assign(slices * n, Vector2 {});
+    slice_energy_.assign(slices, 0.0);
+    if (deterministic) {
+        // slice s always sums the same tiles in the same order, dealt back and forth (s, 2S - 1 -
+        // s, 2S + s, ...) so that the long rows at the top spread over all the slices
+        parallel_for(pool, slices, 1, [&](std::size_t slice_begin, std::size_t slice_end) {
+            for (std::size_t s = slice_begin; s < slice_end; s++) {
+                const std::span<Vector2> out(thread_acc_.data() + s * n, n);
+                for (std::size_t base = 0; base < n_tiles; base += 2 * slices) {
+                    for (std::size_t tile : {base + s, base + 2 * slices - 1 - s}) {
+                        if (tile < n_tiles) {
+                            slice_energy_[s] += add_tile(tile, out);
+                        }
+                    }
+                }
+            }
+        });
+    } else {
+        // each tile writes into the slice of whichever thread runs it
+        pool->parallel_for(n_tiles, 1, [&](std::size_t tile_begin, std::size_t tile_end) {
+            const unsigned thread = ThreadPool::thread_index();
+            const std::span<Vector2> out(thread_acc_.data() + thread * n, n);
+            for (std::size_t tile = tile_begin; tile < tile_end; tile++) {
+                slice_energy_[thread] += add_tile(tile, out);
+            }
+        });
+    }
+    if constexpr (POTENTIAL) {
+        double total = 0.0;
+        for (double energy : slice_energy_) {
+            total += energy;
+        }
+        potential_energy = GRAVITY * total;
+    }
+    parallel_for(pool, n, 4096, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t s = 0; s < slices; s++) {
+            for (std::size_t i = begin; i < end; i++) {
+                acc[i] += thread_acc_[s * n + i];
+            }
+        }
+    });
+}
+
+void SymmetricPairwiseEngine::compute_subset(std::span<const Body> bodies,
+                                             std::span<const std::uint32_t> targets,
+                                             std::span<Vector2> acc, float dt) {
+    // the full symmetric sum costs N^2 / 2 evaluations, the rows T * N
+    if (2 * targets.size() >= bodies.size()) {
+        ForceEngine::compute_subset(bodies, targets, acc, dt);
+        return;
+    }
+    const std::span<double> potential =
+        with_potential ? potential_rows(bodies.size()) : std::span<double> {};
+    pairwise_rows(bodies, targets, acc, potential, collision_dt(dt), pool);
+    if (with_potential) {
+        potential_energy = sum_potential_rows();
+    }
+    interactions = targets.size() * (bodies.size() - std::min<std::size_t>(bodies.size(), 1));
+}
+
+void SimdPairwiseEngine::compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) {
+    assert(acc.size() == bodies.size());
+    soa_.assign(bodies);
+    dt = collision_dt(dt);
+    const std::span<double> potential =
+        with_potential ? potential_rows(bodies.size()) : std::span<double> {};
+    parallel_for(pool, bodies.size(), ROW_GRAIN, [&](std::size_t begin, std::size_t end) {
+        simd_pairwise_accelerations(soa_, acc, potential, dt, begin, end);
+    });
+    if (with_potential) {
+        potential_energy = sum_potential_rows();
+    }
+    interactions = bodies.size() * (bodies.size() - std::min<std::size_t>(bodies.size(), 1));
+}
+
+void SimdPairwiseEngine::compute_subset(std::span<const Body> bodies,
+                                        std::span<const std::uint32_t> targets,
+                                        std::span<Vector2> acc, float dt) {
+    assert(acc.size() == bodies.size());
+    soa_.assign(bodies);
+    dt = collision_dt(dt);
+    const std::span<double> potential =
+        with_potential ? potential_rows(bodies.size()) : std::span<double> {};
+    parallel_for(pool, targets.size(), ROW_GRAIN, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t t = begin; t < end; t++) {
+            simd_pairwise_accelerations(soa_, acc, potential, dt, targets[t], targets[t] + 1);
+        }
+    });
+    if (with_potential) {
+        potential_energy = sum_potential_rows();
+    }
+    interactions = targets.size() * (bodies.size() - std::min<std::size_t>(bodies.size(), 1));
+}
+
+void BarnesHutEngine::compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) {
+    assert(acc.size() == bodies.size());
+    dt = collision_dt(dt);
+    tree_.update(bodies, leaf_size, max_drift, pool);
+    const std::span<double> potential =
+        with_potential ? potential_rows(bodies.size()) : std::span<double> {};
+    std::atomic<std::uint64_t> total = 0;
+    parallel_for(pool, bodies.size(), ROW_GRAIN * 4, [&](std::size_t begin, std::size_t end) {
+        std::uint64_t count = 0;
+        for (std::size_t i = begin; i < end; i++) {
+            float phi = 0.0f;
+            acc[i] = body_acceleration(bodies, static_cast<int>(i), dt, count,
+                                       potential.empty() ? nullptr : &phi);
+            if (!potential.empty()) {
+                potential[i] = 0.5 * GRAVITY * bodies[i].mass * phi;
+            }
+        }
+        total.fetch_add(count, std::memory_order_relaxed);
+    });
+    if (with_potential) {
+        potential_energy = sum_potential_rows();
+    }
+    interactions = total.load(std::memory_order_relaxed);
+}
+
+void BarnesHutEngine::compute_subset(std::span<const Body> bodies,
+                                     std::span<const std::uint32_t> targets,
+                                     std::span<Vector2> acc, float dt) {
+    assert(acc.size() == bodies.size());
+    dt = collision_dt(dt);
+    tree_.update(bodies, leaf_size, max_drift, pool);
+    const std::span<double> potential =
+        with_potential ? potential_rows(bodies.size()) : std::span<double> {};
+    std::atomic<std::uint64_t> total = 0;
+    parallel_for(pool, targets.size(), ROW_GRAIN * 4, [&](std::size_t begin, std::size_t end) {
+        std::uint64_t count = 0;
+        for (std::size_t t = begin; t < end; t++) {
+            const int i = static_cast<int>(targets[t]);
+            float phi = 0.0f;
+            acc[i] = body_acceleration(bodies, i, dt, count, potential.empty() ? nullptr : &phi);
+            if (!potential.empty()) {
+                potential[i] = 0.5 * GRAVITY * bodies[i].mass * phi;
+            }
+        }
+        total.fetch_add(count, std::memory_order_relaxed);
+    });
+    if (with_potential) {
+        potential_energy = sum_potential_rows();
+    }
+    interactions = total.load(std::memory_order_relaxed);
+}
+
+Vector2 BarnesHutEngine::body_acceleration(std::span<const Body> bodies, int i, float dt,
+                                           std::uint64_t& interactions, float* potential) const {
+    const Body& body = bodies[i];
+    const auto nodes = tree_.nodes();
+    const auto order = tree_.order();
+
+    // every level pops one node and pushes at most four
+    int stack[4 * QuadTree::MAX_DEPTH + 4];
+    int top = 0;
+    stack[top++] = 0;
+
+    Vector2 acc = {};
+    while (top > 0) {
+        const QuadNode& node = nodes[stack[--top]];
+        const Vector2 xrel = Vector2AddValue(node.com - body.pos, DIST_EPS);
+        const float dist_sqr = Vector2LengthSqr(xrel);
+        // opening distance grows with the offset of the center of mass from the cell center,
+        // which keeps lopsided cells from being accepted too early
+        const float open_dist =
+            2.0f * node.half_size / theta + Vector2Distance(node.com, node.center);
+
+        // a cell holding the body itself is always opened so it never attracts itself
+        if (open_dist * open_dist < dist_sqr && !node.contains(body.pos)) {
+            const float inv_dist = inverse_sqrt(dist_sqr);
+            acc += xrel * (GRAVITY * node.mass * inv_dist * inv_dist * inv_dist);
+            if (potential) {
+                *potential -= node.mass * inv_dist;
+            }
+            interactions++;
+        } else if (node.is_leaf()) {
+            for (int k = node.first; k < node.first + node.count; k++) {
+                if (order[k] != i) {
+                    acc += pair_acceleration(body, bodies[order[k]], dt);
+                    if (potential) {
+                        *potential += pair_potential(body, bodies[order[k]]);
+                    }
+                    interactions++;
+                }
+            }
+        } else {
+            for (int child : node.children) {
+                if (child >= 0) {
+                    stack[top++] = child;
+                }
+            }
+        }
+    }
+    return acc;
+}
+
+static constexpr std::string_view ENGINE_NAMES[] = {
+    "pairwise", "pairwise-symmetric", "pairwise-simd", "barnes-hut", "fmm", "pm", "p3m"};
+
+std::unique_ptr<ForceEngine> make_force_engine(std::string_view name) {
+    if (name == "pairwise") {
+        return std::make_unique<PairwiseEngine>();
+    } else if (name == "pairwise-symmetric") {
+        return std::make_unique<SymmetricPairwiseEngine>();
+    } else if (name == "pairwise-simd") {
+        return std::make_unique<SimdPairwiseEngine>();
+    } else if (name == "barnes-hut") {
+        return std::make_unique<BarnesHutEngine>();
+    } else if (name == "fmm") {
+        return std::make_unique<FmmEngine>();
+    } else if (name == "pm" || name == "p3m") {
+        return std::make_unique<PmEngine>(name == "p3m");
+    }
+    return nullptr;
+}
+
+std::span<const std::string_view> force_engine_names() {
+    return ENGINE_NAMES;
+}
+
+AccuracyReport compare_accelerations(std::span<const Vector2> reference,
+                                     std::span<const Vector2> approx) {
+    assert(reference.size() == approx.size());
+    AccuracyReport report {0.0f, 0.0f};
+    if (reference.empty()) {
+        return report;
+    }
+
+    double sum_sqr = 0.0;
+    for (std::size_t i = 0; i < reference.size(); i++) {
+        const float ref_mag = Vector2Length(reference[i]);
+        const float err = Vector2Length(approx[i] - reference[i]) / std::max(ref_mag, 1e-12f);
+        report.max_rel_err = std::max(report.max_rel_err, err);
+        sum_sqr += static_cast<double>(err) * err;
+    }
+    report.rms_rel_err = static_cast<float>(std::sqrt(sum_sqr / reference.size()));
+    return report;
+}
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "body.hpp"
+#include "body_arrays.hpp"
+#include "quadtree.hpp"
+#include "thread_pool.hpp"
+
+enum class Precision {
+    FLOAT,
+    DOUBLE, // for reference sums the float kernels are checked against
+};
+
+const char* precision_name(Precision precision);
+
+enum class Softening {
+    NONE,    // only the DIST_EPS offset keeps coincident bodies finite
+    PLUMMER, // 1 / (r^2 + PLUMMER_EPS^2)^(3/2)
+};
+
+const char* softening_name(Softening softening);
+
+// 1 / sqrt(x); in float the hardware estimate refined by one Newton step (within 2 ulp)
+template<class Real>
+inline Real inverse_sqrt(Real x) {
+#ifdef __SSE__
+    if constexpr (std::is_same_v<Real, float>) {
+        const float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+        return y * (1.5f - 0.5f * x * y * y);
+    }
+#endif
+    return Real(1) / std::sqrt(x);
+}
+
+// adds the acceleration of `body` due to `other` to (ax, ay): gravity, softened or not, and with
+// COLLIDE the elastic collision response scaled by `idt` when the two overlap. The response is
+// computed for every pair and selected, so the loop over pairs has no branch. With POTENTIAL the
+// potential of `other` per unit GRAVITY, -m / r softened alike, is added to `*phi`.
+template<class Real, bool COLLIDE, Softening SOFTENING = Softening::NONE, bool POTENTIAL = false>
+inline void accumulate_pair(const Body& body, const Body& other, Real idt, Real& ax, Real& ay,
+                            Real* phi = nullptr) {
+    const Real dx = Real(other.pos.x) - Real(body.pos.x) + Real(DIST_EPS);
+    const Real dy = Real(other.pos.y) - Real(body.pos.y) + Real(DIST_EPS);
+    const Real dist_sqr = dx * dx + dy * dy;
+    const Real inv_dist = inverse_sqrt(dist_sqr);
+    Real inv_soft = inv_dist;
+    if constexpr (SOFTENING == Softening::PLUMMER) {
+        inv_soft = inverse_sqrt(dist_sqr + Real(PLUMMER_EPS) * Real(PLUMMER_EPS));
+    }
+    Real coef = Real(GRAVITY) * Real(other.mass) * inv_soft * inv_soft * inv_soft;
+    if constexpr (COLLIDE) {
+        const Real dist = dist_sqr * inv_dist;
+        const Real inv_sqr = inv_dist * inv_dist;
+        const Real v_dot = (Real(body.vel.x) - Real(other.vel.x)) * dx +
+                           (Real(body.vel.y) - Real(other.vel.y)) * dy;
+        const Real response = Real(2) * Real(other.mass) / (Real(body.mass) + Real(other.mass)) *
+                              -v_dot * inv_sqr * idt;
+        const Real reach = Real(body.radius) + Real(other.radius) - Real(COLL_EPS);
+        coef += dist < reach ? response : Real(0);
+    }
+    if constexpr (POTENTIAL) {
+        *phi -= Real(other.mass) * inv_soft;
+    }
+    ax += dx * coef;
+    ay += dy * coef;
+}
+
+// potential at `body` due to `other` per unit GRAVITY, over the separation accumulate_pair uses
+inline float pair_potential(const Body& body, const Body& other) {
+    const float dx = other.pos.x - body.pos.x + DIST_EPS;
+    const float dy = other.pos.y - body.pos.y + DIST_EPS;
+    return -other.mass * inverse_sqrt(dx * dx + dy * dy);
+}
+
+// acceleration of `body` due to `other`: gravity plus the elastic collision response when the two
+// overlap, which a zero dt leaves out
+inline Vector2 pair_acceleration(const Body& body, const Body& other, float dt) {
+    float ax = 0.0f, ay = 0.0f;
+    if (dt) {
+        accumulate_pair<float, true>(body, other, 1.0f / dt, ax, ay);
+    } else {
+        accumulate_pair<float, false>(body, other, 0.0f, ax, ay);
+    }
+    return {ax, ay};
+}
+
+// the collision term of pair_acceleration on its own
+inline Vector2 collision_acceleration(const Body& body, const Body& other, float dt) {
+    const Vector2 xrel = Vector2AddValue(other.pos - body.pos, DIST_EPS);
+    const float dist_sqr = Vector2LengthSqr(xrel);
+    if (!(std::sqrt(dist_sqr) < body.radius + other.radius - COLL_EPS) || !dt) {
+        return {};
+    }
+    const Vector2 vrel = body.vel - other.vel;
+    const float v_proj_mag = -Vector2DotProduct(vrel, xrel) / dist_sqr;
+    const float m_tot = body.mass + other.mass;
+    return xrel * 2.0f * other.mass / m_tot * v_proj_mag * (1.0f / dt);
+}
+
+class ForceEngine {
+public:
+    virtual ~ForceEngine() = default;
+
+    virtual const char* name() const = 0;
+    // overwrites acc[i] with the acceleration of bodies[i]
+    virtual void compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) = 0;
+    // overwrites acc[i] for every i in `targets` with the acceleration of bodies[i] due to all the
+    // bodies, leaving the rest of acc alone. The default runs compute and copies the targets out.
+    virtual void compute_subset(std::span<const Body> bodies,
+                                std::span<const std::uint32_t> targets, std::span<Vector2> acc,
+                                float dt);
+
+    // threads to split the bodies over, or nullptr to run on the calling thread
+    ThreadPool* pool = nullptr;
+    // whether the elastic collision response is part of the accelerations; turned off when
+    // collisions are resolved elsewhere (e.g. by a broadphase)
+    bool collisions = true;
+    // body-body and body-cell evaluations performed by the last compute
+    std::uint64_t interactions = 0;
+    // sum in an order that depends on neither the thread count nor the scheduling, so runs are
+    // bitwise reproducible. The engines that sum every row on one thread always do; the others
+    // give up some speed for it.
+    bool deterministic = false;
+    // when set, compute also sums the potential energy, -GRAVITY m_i m_j / r over every pair
+    // (softened like the forces), into `potential_energy`. The kernels take it from the distances
+    // they compute anyway, and evaluations without it do not pay for it at all. compute_subset
+    // gives it when the targets are all of the bodies. NaN from engines that cannot sum it.
+    bool with_potential = false;
+    double potential_energy = 0.0;
+
+protected:
+    // the kernels scale the collision impulse by 1 / dt and drop it for a zero dt
+    float collision_dt(float dt) const {
+        return collisions ? dt : 0.0f;
+    }
+    // the engines that sum by rows leave m_i phi_i / 2 of every row here, to be added up in a
+    // fixed order whatever the threads did
+    std::span<double> potential_rows(std::size_t n);
+    // the rows added up, the rows left out of a subset being zero
+    double sum_potential_rows() const;
+
+private:
+    std::vector<Vector2> subset_acc_;
+    std::vector<double> potential_rows_;
+};
+
+// exact O(N^2) sum over all pairs, kept as the reference the approximate engines are checked
+// against. The kernel is specialized on the precision, the softening and whether collisions are
+// on, and the specialization is picked per compute.
+class PairwiseEngine final : public ForceEngine {
+public:
+    explicit PairwiseEngine(Precision precision = Precision::FLOAT,
+                            Softening softening = Softening::NONE) :
+        precision(precision), softening(softening) {}
+
+    const char* name() const override {
+        return "pairwise";
+    }
+    void compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) override;
+    void compute_subset(std::span<const Body> bodies, std::span<const std::uint32_t> targets,
+                        std::span<Vector2> acc, float dt) override;
+
+    Precision precision;
+    Softening softening;
+};
+
+// exact sum visiting every pair once and applying equal and opposite forces to both bodies, which
+// halves the distance and inverse-cube work. Both sides use the separation as seen from the lower
+// index, so results differ from PairwiseEngine by the DIST_EPS offset only. With a pool, tiles of
+// rows are accumulated into per-thread buffers that are summed at the end; a deterministic engine
+// deals the tiles to a fixed number of buffers instead, whichever the thread count.
+class SymmetricPairwiseEngine final : public ForceEngine {
+public:
+    const char* name() const override {
+        return "pairwise-symmetric";
+    }
+    void compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) override;
+    // the symmetric sum only pays off for most of the rows; smaller subsets are summed per row
+    void compute_subset(std::span<const Body> bodies, std::span<const std::uint32_t> targets,
+                        std::span<Vector2> acc, float dt) override;
+
+private:
+    static constexpr std::size_t DETERMINISTIC_SLICES = 32;
+
+    template<bool POTENTIAL>
+    void sum_pairs(std::span<const Body> bodies, std::span<Vector2> acc, float idt);
+
+    std::vector<Vector2> thread_acc_; // one slice of bodies.size() per thread or fixed slice
+    std::vector<double> slice_energy_; // the potential summed by each slice
+};
+
+// PairwiseEngine over a structure-of-arrays copy of the bodies, evaluated by the SIMD kernel in
+// simd_gravity.cpp. The O(N) repack per step is negligible next to the O(N^2) sum.
+class SimdPairwiseEngine final : public ForceEngine {
+public:
+    const char* name() const override {
+        return "pairwise-simd";
+    }
+    void compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) override;
+    void compute_subset(std::span<const Body> bodies, std::span<const std::uint32_t> targets,
+                        std::span<Vector2> acc, float dt) override;
+
+private:
+    BodyArrays soa_;
+};
+
+// O(N log N) approximation: cells that look smaller than `theta` radians from a body are replaced
+// by their center of mass. Collisions are only resolved against bodies in opened leaves, so an
+// overlapping pair is missed only if its radii are large compared to the cells holding it.
+class BarnesHutEngine final : public ForceEngine {
+public:
+    explicit BarnesHutEngine(float theta = 0.5f, int leaf_size = 8) :
+        theta(theta), leaf_size(leaf_size) {}
+
+    const char* name() const override {
+        return "barnes-hut";
+    }
+    void compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) override;
+    // updates the tree over all the bodies and walks it for the targets only
+    void compute_subset(std::span<const Body> bodies, std::span<const std::uint32_t> targets,
+                        std::span<Vector2> acc, float dt) override;
+
+    const QuadTree& tree() const {
+        return tree_;
+    }
+
+    float theta;
+    int leaf_size;
+    // share of the bodies that may change leaves before the tree is built again rather than
+    // refitted (see QuadTree::update), 0 to build it every time
+    float max_drift = 0.25f;
+
+private:
+    // with `potential`, also adds the potential at the body per unit GRAVITY to it
+    Vector2 body_acceleration(std::span<const Body> bodies, int i, float dt,
+                              std::uint64_t& interactions, float* potential) const;
+
+    QuadTree tree_;
+};
+
+// engine registered under `name` (one of force_engine_names()), or nullptr if there is none
+std::unique_ptr<ForceEngine> make_force_engine(std::string_view name);
+std::span<const std::string_view> force_engine_names();
+
+struct AccuracyReport {
+    float max_rel_err;
+    float rms_rel_err;
+};
+
+// per-body relative error of `approx` against `reference`
+AccuracyReport compare_accelerations(std::span<const Vector2> reference,
+                                     std::span<const Vector2> approx);
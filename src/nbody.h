@@ -0,0 +1,100 @@
+#pragma once
+
+// C interface to Simulation, for hosts that cannot use the C++ one (other languages, Python
+// through ctypes or cffi). Bodies are read and written where the simulation keeps them: the
+// arrays returned below are the simulation's own storage, so a host can step and draw (or wrap
+// them in a NumPy array) without copying anything. They last until the next call that steps,
+// resets or adds to the simulation, which may move or reorder them; nbody_structure_version
+// changes whenever indices stop naming the same bodies, and nbody_ids follows them across that.
+//
+// A simulation is not safe to use from several threads at once, but separate ones are.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+#define NBODY_NOEXCEPT noexcept
+extern "C" {
+#else
+#define NBODY_NOEXCEPT
+#endif
+
+typedef struct nbody_vec2 {
+    float x;
+    float y;
+} nbody_vec2;
+
+typedef struct nbody_color {
+    unsigned char r;
+    unsigned char g;
+    unsigned char b;
+    unsigned char a;
+} nbody_color;
+
+// laid out exactly as Body, 28 bytes with no padding
+typedef struct nbody_body {
+    float mass;
+    float radius;
+    nbody_vec2 pos;
+    nbody_vec2 vel;
+    nbody_color color;
+} nbody_body;
+
+// the conserved quantities of the latest sample and their relative drift since the first one
+typedef struct nbody_diagnostics {
+    uint64_t step;
+    double time;
+    double kinetic;
+    double potential; // NaN if the engine does not sum it
+    double momentum_x;
+    double momentum_y;
+    double angular_momentum;
+    double energy_drift;
+    double momentum_drift;
+    double angular_momentum_drift;
+} nbody_diagnostics;
+
+typedef struct nbody_simulation nbody_simulation;
+
+// a simulation of a copy of `count` bodies, with the exact pairwise engine, broadphase collisions
+// and the euler integrator, stepping on `threads` threads (counting the caller, 0 for all of them)
+nbody_simulation* nbody_create(const nbody_body* bodies, size_t count,
+                               unsigned threads) NBODY_NOEXCEPT;
+// the same with one of the built-in systems ("solar", "disk", "plummer", "galaxy-pair", "cloud")
+// of `bodies` bodies in a `size` by `size` area, or NULL if there is no such system or `bodies` is
+// below 2 (4 for galaxy-pair)
+nbody_simulation* nbody_create_system(const char* system, uint64_t seed, int bodies, float size,
+                                      unsigned threads) NBODY_NOEXCEPT;
+void nbody_destroy(nbody_simulation* sim) NBODY_NOEXCEPT;
+
+// each of these returns false and changes nothing if there is no such engine, integrator or mode;
+// the names are those of nbody_headless --engine, --integrator and --collisions
+bool nbody_set_engine(nbody_simulation* sim, const char* engine) NBODY_NOEXCEPT;
+bool nbody_set_integrator(nbody_simulation* sim, const char* integrator) NBODY_NOEXCEPT;
+bool nbody_set_collisions(nbody_simulation* sim, const char* collisions) NBODY_NOEXCEPT;
+// steps between samples of nbody_diagnostics, 0 for none
+void nbody_set_diagnostics_every(nbody_simulation* sim, uint64_t steps) NBODY_NOEXCEPT;
+// bodies further than their radius outside of the rectangle are removed after each step; a
+// width or height of 0 removes the bounds
+void nbody_set_bounds(nbody_simulation* sim, float x, float y, float width,
+                      float height) NBODY_NOEXCEPT;
+
+void nbody_step(nbody_simulation* sim, float dt, uint64_t steps) NBODY_NOEXCEPT;
+void nbody_reset(nbody_simulation* sim, const nbody_body* bodies, size_t count) NBODY_NOEXCEPT;
+void nbody_add_body(nbody_simulation* sim, const nbody_body* body) NBODY_NOEXCEPT;
+
+size_t nbody_body_count(const nbody_simulation* sim) NBODY_NOEXCEPT;
+const nbody_body* nbody_bodies(const nbody_simulation* sim) NBODY_NOEXCEPT;
+// the bodies for changing in place between steps, see Simulation::edit_bodies
+nbody_body* nbody_edit_bodies(nbody_simulation* sim) NBODY_NOEXCEPT;
+const uint32_t* nbody_ids(const nbody_simulation* sim) NBODY_NOEXCEPT;
+uint64_t nbody_structure_version(const nbody_simulation* sim) NBODY_NOEXCEPT;
+uint64_t nbody_step_count(const nbody_simulation* sim) NBODY_NOEXCEPT;
+double nbody_time(const nbody_simulation* sim) NBODY_NOEXCEPT;
+// fills `out` and returns true if the simulation has sampled its diagnostics yet
+bool nbody_get_diagnostics(const nbody_simulation* sim, nbody_diagnostics* out) NBODY_NOEXCEPT;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,177 @@
+#include "nbody.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "gravity.hpp"
+#include "simulation.hpp"
+#include "system.hpp"
+#include "thread_pool.hpp"
+
+// the arrays are handed out as they are, so the C structs have to match the C++ ones field for
+// field
+static_assert(sizeof(nbody_body) == sizeof(Body));
+static_assert(offsetof(nbody_body, mass) == offsetof(Body, mass));
+static_assert(offsetof(nbody_body, radius) == offsetof(Body, radius));
+static_assert(offsetof(nbody_body, pos) == offsetof(Body, pos));
+static_assert(offsetof(nbody_body, vel) == offsetof(Body, vel));
+static_assert(offsetof(nbody_body, color) == offsetof(Body, color));
+static_assert(sizeof(nbody_vec2) == sizeof(Vector2) && sizeof(nbody_color) == sizeof(Color));
+
+struct nbody_simulation {
+    explicit nbody_simulation(unsigned threads) :
+        pool(threads != 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u)) {
+        sim.pool = &pool;
+    }
+
+    ThreadPool pool;
+    std::unique_ptr<ForceEngine> engine; // nullptr for the simulation's own
+    Simulation sim;
+};
+
+namespace {
+
+std::vector<Body> copy_bodies(const nbody_body* bodies, std::size_t count) {
+    const Body* first = reinterpret_cast<const Body*>(bodies);
+    return std::vector<Body>(first, first + count);
+}
+
+} // namespace
+
+nbody_simulation* nbody_create(const nbody_body* bodies, size_t count, unsigned threads) noexcept {
+    auto* sim = new nbody_simulation(threads);
+    sim->sim.reset(copy_bodies(bodies, count));
+    return sim;
+}
+
+nbody_simulation* nbody_create_system(const char* system, uint64_t seed, int bodies, float size,
+                                      unsigned threads) noexcept {
+    const auto names = system_names();
+    // the limits nbody_headless --bodies has, below which the generators have nothing to place
+    if (std::find(names.begin(), names.end(), system) == names.end() || bodies < 2 ||
+        (std::string_view(system) == "galaxy-pair" && bodies < 4)) {
+        return nullptr;
+    }
+    auto* sim = new nbody_simulation(threads);
+    sim->sim.reset(make_system(system, seed, bodies, {size, size}, &sim->pool));
+    return sim;
+}
+
+void nbody_destroy(nbody_simulation* sim) noexcept {
+    delete sim;
+}
+
+bool nbody_set_engine(nbody_simulation* sim, const char* engine) noexcept {
+    auto made = make_force_engine(engine);
+    if (!made) {
+        return false;
+    }
+    made->pool = &sim->pool;
+    // the old one goes only once the simulation stopped pointing at it
+    sim->sim.set_engine(made.get());
+    sim->engine = std::move(made);
+    return true;
+}
+
+bool nbody_set_integrator(nbody_simulation* sim, const char* integrator) noexcept {
+    for (auto candidate : {Integrator::EULER, Integrator::LEAPFROG, Integrator::YOSHIDA4,
+                           Integrator::BLOCK}) {
+        if (std::string_view(integrator) == integrator_name(candidate)) {
+            sim->sim.integrator = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool nbody_set_collisions(nbody_simulation* sim, const char* collisions) noexcept {
+    for (auto mode : {CollisionMode::NONE, CollisionMode::KERNEL, CollisionMode::BROADPHASE,
+                      CollisionMode::MERGE}) {
+        if (std::string_view(collisions) == collision_mode_name(mode)) {
+            sim->sim.collisions = mode;
+            return true;
+        }
+    }
+    return false;
+}
+
+void nbody_set_diagnostics_every(nbody_simulation* sim, uint64_t steps) noexcept {
+    sim->sim.diagnostics_every = steps;
+}
+
+void nbody_set_bounds(nbody_simulation* sim, float x, float y, float width,
+                      float height) noexcept {
+    if (width > 0.0f && height > 0.0f) {
+        sim->sim.bounds = Rectangle {x, y, width, height};
+    } else {
+        sim->sim.bounds.reset();
+    }
+}
+
+void nbody_step(nbody_simulation* sim, float dt, uint64_t steps) noexcept {
+    for (uint64_t s = 0; s < steps; s++) {
+        sim->sim.step(dt);
+    }
+}
+
+void nbody_reset(nbody_simulation* sim, const nbody_body* bodies, size_t count) noexcept {
+    sim->sim.reset(copy_bodies(bodies, count));
+}
+
+void nbody_add_body(nbody_simulation* sim, const nbody_body* body) noexcept {
+    sim->sim.add_body(*reinterpret_cast<const Body*>(body));
+}
+
+size_t nbody_body_count(const nbody_simulation* sim) noexcept {
+    return sim->sim.bodies().size();
+}
+
+const nbody_body* nbody_bodies(const nbody_simulation* sim) noexcept {
+    return reinterpret_cast<const nbody_body*>(sim->sim.bodies().data());
+}
+
+nbody_body* nbody_edit_bodies(nbody_simulation* sim) noexcept {
+    return reinterpret_cast<nbody_body*>(sim->sim.edit_bodies().data());
+}
+
+const uint32_t* nbody_ids(const nbody_simulation* sim) noexcept {
+    return sim->sim.ids().data();
+}
+
+uint64_t nbody_structure_version(const nbody_simulation* sim) noexcept {
+    return sim->sim.structure_version();
+}
+
+uint64_t nbody_step_count(const nbody_simulation* sim) noexcept {
+    return sim->sim.step_count();
+}
+
+double nbody_time(const nbody_simulation* sim) noexcept {
+    return sim->sim.time();
+}
+
+bool nbody_get_diagnostics(const nbody_simulation* sim, nbody_diagnostics* out) noexcept {
+    const auto& current = sim->sim.diagnostics();
+    const auto& initial = sim->sim.initial_diagnostics();
+    if (!current || !initial) {
+        return false;
+    }
+    const DiagnosticsDrift drift = diagnostics_drift(*initial, *current);
+    *out = {
+        .step = current->step,
+        .time = current->time,
+        .kinetic = current->kinetic,
+        .potential = current->potential,
+        .momentum_x = current->momentum_x,
+        .momentum_y = current->momentum_y,
+        .angular_momentum = current->angular_momentum,
+        .energy_drift = drift.energy,
+        .momentum_drift = drift.momentum,
+        .angular_momentum_drift = drift.angular_momentum,
+    };
+    return true;
+}
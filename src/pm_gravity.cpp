@@ -0,0 +1,486 @@
+#include "pm_gravity.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <numbers>
+
+namespace {
+
+// rows of the mesh per deposit strip: a body writes its row and the next, so strips two apart
+// never touch the same cell
+constexpr int STRIP_ROWS = 8;
+// share of the bodies on either side of each axis outside of the core that the mesh is fitted to,
+// and the core widths by which it reaches past the core on every side
+constexpr double TAIL = 0.01;
+constexpr float MARGIN = 1.0f;
+
+// long-range part of the potential of a unit mass at `r` cells, -erf(r / 2 r_s) / r, which tends
+// to -1 / (r_s sqrt(pi)) at 0
+double long_range_potential(double r) {
+    constexpr double split = PmEngine::SPLIT;
+    if (r == 0.0) {
+        return -1.0 / (split * std::sqrt(std::numbers::pi));
+    }
+    return -std::erf(r / (2.0 * split)) / r;
+}
+
+// the short-range force and potential of a unit mass are those of gravity times erfc(x) +
+// 2 x exp(-x^2) / sqrt(pi) and erfc(x), for x = r / 2 r_s; both tabulated up to the cutoff and
+// interpolated linearly, which is well within the accuracy of the mesh
+struct ShortRangeTable {
+    static constexpr int SIZE = 1024;
+    static constexpr float RANGE = PmEngine::CUTOFF / 2.0f;
+
+    ShortRangeTable() {
+        for (int k = 0; k <= SIZE + 1; k++) {
+            const double x = RANGE * k / SIZE;
+            potential[k] = static_cast<float>(std::erfc(x));
+            force[k] = static_cast<float>(std::erfc(x) + 2.0 * x * std::exp(-x * x) /
+                                                             std::sqrt(std::numbers::pi));
+        }
+    }
+
+    // of `x` up to RANGE
+    static float lookup(const float* table, float x) {
+        const float t = x * (SIZE / RANGE);
+        const int k = std::min(static_cast<int>(t), SIZE);
+        return table[k] + (t - static_cast<float>(k)) * (table[k + 1] - table[k]);
+    }
+
+    float force[SIZE + 2];
+    float potential[SIZE + 2];
+};
+
+// the mesh node below and to the left of a body and its offset from it, in cells
+struct CellWeights {
+    int x;
+    int y;
+    float fx;
+    float fy;
+};
+
+CellWeights cell_weights(Vector2 pos, Vector2 origin, float inv_spacing, int cells) {
+    const float u = (pos.x - origin.x) * inv_spacing;
+    const float v = (pos.y - origin.y) * inv_spacing;
+    // the mesh leaves two cells on every side for the field's stencil
+    const int x = std::clamp(static_cast<int>(std::floor(u)), 2, cells - 4);
+    const int y = std::clamp(static_cast<int>(std::floor(v)), 2, cells - 4);
+    return {x, y, std::clamp(u - x, 0.0f, 1.0f), std::clamp(v - y, 0.0f, 1.0f)};
+}
+
+// in-place radix-2 transform of one row; the inverse is left unscaled
+void transform_row(std::complex<float>* row, std::span<const std::uint32_t> reversed,
+                   std::span<const std::complex<float>> twiddles, bool inverse) {
+    const std::size_t n = reversed.size();
+    for (std::size_t i = 0; i < n; i++) {
+        const std::size_t j = reversed[i];
+        if (i < j) {
+            std::swap(row[i], row[j]);
+        }
+    }
+    for (std::size_t half = 1; half < n; half *= 2) {
+        const std::size_t stride = n / (2 * half);
+        for (std::size_t start = 0; start < n; start += 2 * half) {
+            for (std::size_t k = 0; k < half; k++) {
+                // spelled out, as std::complex multiplication checks for infinities
+                const std::complex<float> w = twiddles[k * stride];
+                const float wi = inverse ? -w.imag() : w.imag();
+                const std::complex<float> v = row[start + k + half];
+                const std::complex<float> t = {v.real() * w.real() - v.imag() * wi,
+                                               v.real() * wi + v.imag() * w.real()};
+                const std::complex<float> u = row[start + k];
+                row[start + k] = {u.real() + t.real(), u.imag() + t.imag()};
+                row[start + k + half] = {u.real() - t.real(), u.imag() - t.imag()};
+            }
+        }
+    }
+}
+
+} // namespace
+
+void PmEngine::prepare(int cells) {
+    if (cells == cells_) {
+        return;
+    }
+    cells_ = cells;
+    padded_ = 2 * cells;
+    const std::size_t n = padded_;
+    const int bits = std::countr_zero(n);
+    reversed_.resize(n);
+    for (std::size_t i = 0; i < n; i++) {
+        std::uint32_t r = 0;
+        for (int b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1u) << (bits - 1 - b);
+        }
+        reversed_[i] = r;
+    }
+    twiddles_.resize(n / 2);
+    for (std::size_t k = 0; k < n / 2; k++) {
+        const double angle = -2.0 * std::numbers::pi * static_cast<double>(k) / n;
+        twiddles_[k] = {static_cast<float>(std::cos(angle)), static_cast<float>(std::sin(angle))};
+    }
+    field_x_.assign(static_cast<std::size_t>(cells) * cells, 0.0f);
+    field_y_.assign(static_cast<std::size_t>(cells) * cells, 0.0f);
+
+    // the potential over the offsets of the padded grid, which wrap around at its middle. It is
+    // symmetric, so its transform is real, and the inverse transform's 1 / n^2 goes in with it.
+    grid_.resize(n * n);
+    parallel_for(pool, n, 16, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t y = begin; y < end; y++) {
+            const double dy = static_cast<double>(std::min(y, n - y));
+            for (std::size_t x = 0; x < n; x++) {
+                const double dx = static_cast<double>(std::min(x, n - x));
+                grid_[y * n + x] = {static_cast<float>(long_range_potential(std::hypot(dx, dy))),
+                                    0.0f};
+            }
+        }
+    });
+    transform_rows(0, n, false);
+    transpose();
+    transform_rows(0, n, false);
+    // divided by the transform of the cloud-in-cell weights, once for the deposit and once for the
+    // interpolation, so that the two do not smooth the force at a few cells on top of the split
+    std::vector<double> window(n);
+    for (std::size_t i = 0; i < n; i++) {
+        const double f = std::numbers::pi * static_cast<double>(std::min(i, n - i)) / n;
+        const double sinc = i == 0 ? 1.0 : std::sin(f) / f;
+        window[i] = sinc * sinc * sinc * sinc;
+    }
+    kernel_.resize(n * n);
+    const double scale = 1.0 / static_cast<double>(n * n);
+    for (std::size_t y = 0; y < n; y++) {
+        for (std::size_t x = 0; x < n; x++) {
+            kernel_[y * n + x] =
+                static_cast<float>(grid_[y * n + x].real() * scale / (window[x] * window[y]));
+        }
+    }
+}
+
+void PmEngine::deposit(std::span<const Body> bodies) {
+    const std::size_t count = bodies.size();
+    Vector2 lo = bodies[0].pos, hi = bodies[0].pos;
+    for (const Body& body : bodies) {
+        lo = Vector2Min(lo, body.pos);
+        hi = Vector2Max(hi, body.pos);
+    }
+    // the bodies between the TAIL and 1 - TAIL quantiles along each axis, so that a few bodies
+    // flung far out do not coarsen the mesh for all the others
+    const auto quantiles = [&](float Vector2::*axis) {
+        scratch_.resize(count);
+        for (std::size_t i = 0; i < count; i++) {
+            scratch_[i] = bodies[i].pos.*axis;
+        }
+        const std::size_t low = static_cast<std::size_t>(TAIL * static_cast<double>(count));
+        const std::size_t high = count - 1 - low;
+        std::nth_element(scratch_.begin(), scratch_.begin() + low, scratch_.end());
+        const float first = scratch_[low];
+        std::nth_element(scratch_.begin() + low + 1, scratch_.begin() + high, scratch_.end());
+        return std::pair {first, scratch_[high]};
+    };
+    const auto [x0, x1] = quantiles(&Vector2::x);
+    const auto [y0, y1] = quantiles(&Vector2::y);
+    const float core = std::max(x1 - x0, y1 - y0);
+    if (core > 0.0f) {
+        lo = Vector2Max(lo, {x0 - MARGIN * core, y0 - MARGIN * core});
+        hi = Vector2Min(hi, {x1 + MARGIN * core, y1 + MARGIN * core});
+    }
+    outlier_.assign(count, 0);
+    outliers_.clear();
+    double mass = 0.0, moment_x = 0.0, moment_y = 0.0;
+    for (std::size_t i = 0; i < count; i++) {
+        const Vector2 pos = bodies[i].pos;
+        if (pos.x < lo.x || pos.x > hi.x || pos.y < lo.y || pos.y > hi.y) {
+            outlier_[i] = 1;
+            outliers_.push_back(static_cast<std::uint32_t>(i));
+            continue;
+        }
+        mass += bodies[i].mass;
+        moment_x += static_cast<double>(bodies[i].mass) * pos.x;
+        moment_y += static_cast<double>(bodies[i].mass) * pos.y;
+    }
+    mesh_mass_ = static_cast<float>(mass);
+    mesh_center_ = mass > 0.0 ? Vector2 {static_cast<float>(moment_x / mass),
+                                         static_cast<float>(moment_y / mass)}
+                              : Vector2 {};
+
+    const float extent = std::max(hi.x - lo.x, hi.y - lo.y);
+    spacing_ = extent > 0.0f ? extent / static_cast<float>(cells_ - 6) : 1.0f;
+    origin_ = Vector2AddValue(lo, -2.0f * spacing_);
+    const float inv_spacing = 1.0f / spacing_;
+
+    // bodies counting-sorted by strip, in index order within each
+    const std::size_t strips = (cells_ + STRIP_ROWS - 1) / STRIP_ROWS;
+    strip_starts_.assign(strips + 1, 0);
+    for (std::size_t i = 0; i < count; i++) {
+        if (!outlier_[i]) {
+            const CellWeights c = cell_weights(bodies[i].pos, origin_, inv_spacing, cells_);
+            strip_starts_[c.y / STRIP_ROWS + 1]++;
+        }
+    }
+    for (std::size_t s = 0; s < strips; s++) {
+        strip_starts_[s + 1] += strip_starts_[s];
+    }
+    strip_order_.resize(count - outliers_.size());
+    for (std::size_t i = 0; i < count; i++) {
+        if (outlier_[i]) {
+            continue;
+        }
+        const int strip = cell_weights(bodies[i].pos, origin_, inv_spacing, cells_).y / STRIP_ROWS;
+        strip_order_[strip_starts_[strip]++] = static_cast<std::uint32_t>(i);
+    }
+    for (std::size_t s = strips; s > 0; s--) {
+        strip_starts_[s] = strip_starts_[s - 1];
+    }
+    strip_starts_[0] = 0;
+
+    const std::size_t n = padded_;
+    parallel_for(pool, n, 16, [&](std::size_t begin, std::size_t end) {
+        std::fill(grid_.begin() + begin * n, grid_.begin() + end * n, std::complex<float> {});
+    });
+    // the even strips and then the odd ones, each on one thread, so that no two threads add to
+    // the same cell and every cell adds its bodies in the same order
+    for (std::size_t parity = 0; parity < 2; parity++) {
+        parallel_for(pool, (strips + 1 - parity) / 2, 1, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t t = begin; t < end; t++) {
+                const std::size_t s = 2 * t + parity;
+                for (std::uint32_t k = strip_starts_[s]; k < strip_starts_[s + 1]; k++) {
+                    const Body& body = bodies[strip_order_[k]];
+                    const CellWeights c = cell_weights(body.pos, origin_, inv_spacing, cells_);
+                    std::complex<float>* row = &grid_[c.y * n + c.x];
+                    const float low = body.mass * (1.0f - c.fy), high = body.mass * c.fy;
+                    row[0] += low * (1.0f - c.fx);
+                    row[1] += low * c.fx;
+                    row[n] += high * (1.0f - c.fx);
+                    row[n + 1] += high * c.fx;
+                }
+            }
+        });
+    }
+}
+
+void PmEngine::convolve() {
+    // the rows past the mesh hold no mass and transform to zero
+    transform_rows(0, cells_, false);
+    transpose();
+    transform_rows(0, padded_, false);
+    const std::size_t n = padded_;
+    parallel_for(pool, n, 16, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t k = begin * n; k < end * n; k++) {
+            grid_[k] *= kernel_[k];
+        }
+    });
+    transform_rows(0, padded_, true);
+    transpose();
+    // and only the mesh's own rows of the potential are read
+    transform_rows(0, cells_, true);
+}
+
+void PmEngine::interpolate(std::span<const Body> bodies, std::span<Vector2> acc) {
+    const std::size_t n = padded_;
+    const std::size_t cells = cells_;
+    // minus the fourth order central difference of the potential, d/dx ~ 2/3 (f(x + 1) -
+    // f(x - 1)) - 1/12 (f(x + 2) - f(x - 2)), where the potential is mass per cell
+    const float scale = -1.0f / (spacing_ * spacing_);
+    parallel_for(pool, cells - 4, 16, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t y = begin + 2; y < end + 2; y++) {
+            const std::complex<float>* phi = &grid_[y * n];
+            for (std::size_t x = 2; x < cells - 2; x++) {
+                field_x_[y * cells + x] =
+                    scale * (2.0f / 3.0f * (phi[x + 1].real() - phi[x - 1].real()) -
+                             1.0f / 12.0f * (phi[x + 2].real() - phi[x - 2].real()));
+                field_y_[y * cells + x] =
+                    scale * (2.0f / 3.0f * (phi[x + n].real() - phi[x - n].real()) -
+                             1.0f / 12.0f * (phi[x + 2 * n].real() - phi[x - 2 * n].real()));
+            }
+        }
+    });
+
+    // a body's own mass spread over the cells and gathered back again, which the potential has to
+    // leave out
+    const float self[3] = {static_cast<float>(long_range_potential(0.0)),
+                           static_cast<float>(long_range_potential(1.0)),
+                           static_cast<float>(long_range_potential(std::numbers::sqrt2))};
+    const float inv_spacing = 1.0f / spacing_;
+    parallel_for(pool, bodies.size(), 1024, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            if (outlier_[i]) {
+                continue;
+            }
+            const Body& body = bodies[i];
+            const CellWeights c = cell_weights(body.pos, origin_, inv_spacing, cells_);
+            const float w[4] = {(1.0f - c.fx) * (1.0f - c.fy), c.fx * (1.0f - c.fy),
+                                (1.0f - c.fx) * c.fy, c.fx * c.fy};
+            const std::size_t nodes[4] = {0, 1, cells, cells + 1};
+            const std::size_t first = c.y * cells + c.x;
+            float ax = 0.0f, ay = 0.0f;
+            for (int k = 0; k < 4; k++) {
+                ax += w[k] * field_x_[first + nodes[k]];
+                ay += w[k] * field_y_[first + nodes[k]];
+            }
+            acc[i] += Vector2 {GRAVITY * ax, GRAVITY * ay};
+            if (!potential_.empty()) {
+                const std::complex<float>* phi = &grid_[c.y * n + c.x];
+                const float sum = w[0] * phi[0].real() + w[1] * phi[1].real() +
+                                  w[2] * phi[n].real() + w[3] * phi[n + 1].real();
+                // weight of the pairs of a body's cells one apart along x, and along y
+                const float px = 2.0f * c.fx * (1.0f - c.fx), py = 2.0f * c.fy * (1.0f - c.fy);
+                const float own = (1.0f - px) * (1.0f - py) * self[0] +
+                                  (px * (1.0f - py) + (1.0f - px) * py) * self[1] +
+                                  px * py * self[2];
+                potential_[i] += 0.5 * GRAVITY * body.mass * (sum - body.mass * own) * inv_spacing;
+            }
+        }
+    });
+}
+
+void PmEngine::add_short_range(std::span<const Body> bodies, std::span<Vector2> acc, float dt) {
+    const float cutoff = short_range ? CUTOFF * SPLIT * spacing_ : 0.0f;
+    float max_radius = 0.0f;
+    if (dt) {
+        for (const Body& body : bodies) {
+            max_radius = std::max(max_radius, body.radius);
+        }
+    }
+    const float reach = std::max(cutoff, 2.0f * max_radius);
+    if (reach <= 0.0f) {
+        return;
+    }
+    neighbours_.build(bodies, reach);
+
+    // what the mesh leaves out of the potential, -erfc(r / 2 r_s) / r, and of its gradient
+    static const ShortRangeTable table;
+    const float inv_split = 1.0f / (2.0f * SPLIT * spacing_);
+    std::atomic<std::uint64_t> total = 0;
+    parallel_for(pool, bodies.size(), 256, [&](std::size_t begin, std::size_t end) {
+        std::uint64_t count = 0;
+        for (std::size_t i = begin; i < end; i++) {
+            if (outlier_[i]) {
+                continue;
+            }
+            const Body& body = bodies[i];
+            float ax = 0.0f, ay = 0.0f, phi = 0.0f;
+            Vector2 response = {};
+            neighbours_.for_each_neighbour(static_cast<int>(i), [&](int j) {
+                if (outlier_[j]) {
+                    return;
+                }
+                const Body& other = bodies[j];
+                if (dt) {
+                    response += collision_acceleration(body, other, dt);
+                }
+                const float dx = other.pos.x - body.pos.x + DIST_EPS;
+                const float dy = other.pos.y - body.pos.y + DIST_EPS;
+                const float dist_sqr = dx * dx + dy * dy;
+                if (dist_sqr >= cutoff * cutoff) {
+                    return;
+                }
+                const float inv_dist = inverse_sqrt(dist_sqr);
+                const float x = dist_sqr * inv_dist * inv_split;
+                const float coef = other.mass * inv_dist * inv_dist * inv_dist *
+                                   ShortRangeTable::lookup(table.force, x);
+                ax += dx * coef;
+                ay += dy * coef;
+                if (!potential_.empty()) {
+                    phi -= other.mass * inv_dist * ShortRangeTable::lookup(table.potential, x);
+                }
+                count++;
+            });
+            acc[i] += Vector2 {GRAVITY * ax, GRAVITY * ay} + response;
+            if (!potential_.empty()) {
+                potential_[i] += 0.5 * GRAVITY * body.mass * phi;
+            }
+        }
+        total.fetch_add(count, std::memory_order_relaxed);
+    });
+    interactions += total.load(std::memory_order_relaxed);
+}
+
+// the outliers are summed exactly among themselves and see the bodies on the mesh as one mass at
+// their center, and those bodies in turn all feel the outliers as that center does
+void PmEngine::add_outliers(std::span<const Body> bodies, std::span<Vector2> acc, float dt) {
+    if (outliers_.empty()) {
+        return;
+    }
+    const Body center = {.mass = mesh_mass_,
+                         .radius = 0.0f,
+                         .pos = mesh_center_,
+                         .vel = {},
+                         .color = {}};
+    Vector2 pull = {};
+    float center_phi = 0.0f;
+    for (std::uint32_t i : outliers_) {
+        const Body& body = bodies[i];
+        Vector2 sum = mesh_mass_ > 0.0f ? pair_acceleration(body, center, 0.0f) : Vector2 {};
+        float phi = pair_potential(body, center);
+        for (std::uint32_t j : outliers_) {
+            if (j != i) {
+                sum += pair_acceleration(body, bodies[j], dt);
+                phi += pair_potential(body, bodies[j]);
+            }
+        }
+        acc[i] += sum;
+        pull += pair_acceleration(center, body, 0.0f);
+        center_phi += pair_potential(center, body);
+        if (!potential_.empty()) {
+            potential_[i] += 0.5 * GRAVITY * body.mass * phi;
+        }
+    }
+    parallel_for(pool, bodies.size(), 4096, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            if (outlier_[i]) {
+                continue;
+            }
+            acc[i] += pull;
+            if (!potential_.empty()) {
+                potential_[i] += 0.5 * GRAVITY * bodies[i].mass * center_phi;
+            }
+        }
+    });
+    interactions += outliers_.size() * (outliers_.size() + 1) + bodies.size();
+}
+
+void PmEngine::transform_rows(std::size_t first, std::size_t count, bool inverse) {
+    const std::size_t n = padded_;
+    parallel_for(pool, count, 8, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t r = first + begin; r < first + end; r++) {
+            transform_row(&grid_[r * n], reversed_, twiddles_, inverse);
+        }
+    });
+}
+
+void PmEngine::transpose() {
+    const std::size_t n = padded_;
+    // row y swaps the cells right of the diagonal with those below it, which no other row touches
+    parallel_for(pool, n, 16, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t y = begin; y < end; y++) {
+            for (std::size_t x = y + 1; x < n; x++) {
+                std::swap(grid_[y * n + x], grid_[x * n + y]);
+            }
+        }
+    });
+}
+
+void PmEngine::compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) {
+    assert(acc.size() == bodies.size());
+    dt = collision_dt(dt);
+    std::fill(acc.begin(), acc.end(), Vector2 {});
+    interactions = bodies.size();
+    potential_ = with_potential ? potential_rows(bodies.size()) : std::span<double> {};
+    potential_energy = 0.0;
+    if (bodies.empty()) {
+        return;
+    }
+    prepare(static_cast<int>(std::bit_ceil(
+        static_cast<unsigned>(std::clamp(mesh, MIN_MESH, MAX_MESH)))));
+    deposit(bodies);
+    convolve();
+    interpolate(bodies, acc);
+    add_short_range(bodies, acc, dt);
+    add_outliers(bodies, acc, dt);
+    if (with_potential) {
+        potential_energy = sum_potential_rows();
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <complex>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "gravity.hpp"
+#include "uniform_grid.hpp"
+
+// particle-mesh gravity: the masses are spread over a `mesh` x `mesh` grid around the bodies with
+// cloud-in-cell weights, convolved by FFT with the potential of a unit mass on a grid twice as wide
+// (so that the far side of the system does not wrap around onto the near one), differentiated on
+// the grid and interpolated back to the bodies with the same weights. That is O(N + G log G) for G
+// cells, and every pass splits over the threads in an order that does not depend on them.
+//
+// The mesh carries the long-range part -erf(r / 2 r_s) / r of the potential, with r_s = SPLIT
+// cells, which is smooth enough for the grid to resolve. With `short_range` (P3M) the remainder
+// -erfc(r / 2 r_s) / r is summed exactly over the bodies within CUTOFF r_s, found through a
+// uniform grid, which puts the forces close to the exact sum at every distance; plain PM leaves it
+// out, softening gravity over a few cells. Collisions are resolved against the same neighbours.
+//
+// As for FmmEngine, the potential is the 1 / r one of the gravity here rather than the logarithm a
+// Poisson solve in the plane would give, so the mesh is convolved with that potential directly
+// instead of dividing its transform by k^2.
+//
+// The mesh is fitted to the core of the system rather than to all of it, so that a few bodies
+// thrown far out neither coarsen it nor widen the short-range search for the rest. Those outside
+// are summed exactly among themselves and exchange forces with the bodies on the mesh through
+// the mesh's center of mass, which is accurate that far out.
+class PmEngine final : public ForceEngine {
+public:
+    static constexpr int MIN_MESH = 16;
+    static constexpr int MAX_MESH = 2048;
+    static constexpr float SPLIT = 1.25f;
+    static constexpr float CUTOFF = 4.5f;
+
+    explicit PmEngine(bool short_range = true, int mesh = 256) :
+        short_range(short_range), mesh(mesh) {}
+
+    const char* name() const override {
+        return short_range ? "p3m" : "pm";
+    }
+    void compute(std::span<const Body> bodies, std::span<Vector2> acc, float dt) override;
+
+    bool short_range;
+    int mesh; // cells per side, rounded up to a power of two within [MIN_MESH, MAX_MESH]
+
+private:
+    // sizes the grids for a mesh of `cells` per side and transforms the potential onto them
+    void prepare(int cells);
+    // places the mesh over the core of the bodies and spreads their masses over it
+    void deposit(std::span<const Body> bodies);
+    // replaces the masses by their potential, in mass per cell
+    void convolve();
+    void interpolate(std::span<const Body> bodies, std::span<Vector2> acc);
+    void add_short_range(std::span<const Body> bodies, std::span<Vector2> acc, float dt);
+    void add_outliers(std::span<const Body> bodies, std::span<Vector2> acc, float dt);
+    void transform_rows(std::size_t first, std::size_t count, bool inverse);
+    void transpose();
+
+    int cells_ = 0;   // of the mesh per side
+    int padded_ = 0;  // of the transforms per side, twice cells_
+    float spacing_ = 1.0f;
+    Vector2 origin_ = {};
+    std::vector<std::complex<float>> grid_;   // padded_^2, masses and then their potential
+    std::vector<float> kernel_;               // transform of the potential, real by symmetry
+    std::vector<std::complex<float>> twiddles_;
+    std::vector<std::uint32_t> reversed_;     // bit reversal permutation of a row
+    std::vector<float> field_x_, field_y_;    // cells_^2 accelerations per unit GRAVITY
+    std::vector<std::uint32_t> strip_starts_; // bodies by strip of rows they deposit into
+    std::vector<std::uint32_t> strip_order_;
+    std::vector<float> scratch_;                // coordinates for the quantiles of the core
+    std::vector<std::uint8_t> outlier_;         // whether a body is off the mesh
+    std::vector<std::uint32_t> outliers_;
+    float mesh_mass_ = 0.0f;
+    Vector2 mesh_center_ = {};
+    UniformGrid neighbours_;
+    std::span<double> potential_; // rows of the potential while one is summed, empty otherwise
+};
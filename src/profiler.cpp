@@ -0,0 +1,195 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <iterator>
+
+const char* phase_name(Phase phase) {
+    switch (phase) {
+        case Phase::INPUT:
+            return "input";
+        case Phase::FORCE:
+            return "force";
+        case Phase::COLLISION:
+            return "collision";
+        case Phase::INTEGRATION:
+            return "integration";
+        case Phase::REMOVAL:
+            return "removal";
+        case Phase::REORDER:
+            return "reorder";
+        case Phase::DRAW:
+            return "draw";
+    }
+    return "?";
+}
+
+const char* phase_count_name(Phase phase) {
+    switch (phase) {
+        case Phase::INPUT:
+            return "events";
+        case Phase::FORCE:
+            return "interactions";
+        case Phase::COLLISION:
+            return "pairs";
+        case Phase::INTEGRATION:
+            return "kicks";
+        case Phase::REMOVAL:
+            return "removed";
+        case Phase::REORDER:
+            return "sorted";
+        case Phase::DRAW:
+            return "drawn";
+    }
+    return "?";
+}
+
+PhaseProfile& PhaseProfile::operator+=(const PhaseProfile& other) {
+    for (std::size_t p = 0; p < PHASE_COUNT; p++) {
+        seconds[p] += other.seconds[p];
+        counts[p] += other.counts[p];
+    }
+    return *this;
+}
+
+PhaseProfile& PhaseProfile::operator-=(const PhaseProfile& other) {
+    for (std::size_t p = 0; p < PHASE_COUNT; p++) {
+        seconds[p] -= other.seconds[p];
+        counts[p] -= other.counts[p];
+    }
+    return *this;
+}
+
+void RollingSamples::push(float value) {
+    samples_[next_] = value;
+    next_ = (next_ + 1) % CAPACITY;
+    size_ = std::min(size_ + 1, CAPACITY);
+}
+
+float RollingSamples::max() const {
+    float result = 0.0f;
+    for (std::size_t i = 0; i < size_; i++) {
+        result = std::max(result, (*this)[i]);
+    }
+    return result;
+}
+
+float RollingSamples::percentile(float p) const {
+    if (size_ == 0) {
+        return 0.0f;
+    }
+    for (std::size_t i = 0; i < size_; i++) {
+        scratch_[i] = (*this)[i];
+    }
+    const auto rank = static_cast<std::size_t>(std::clamp(p, 0.0f, 1.0f) * (size_ - 1) + 0.5f);
+    std::nth_element(scratch_.begin(), scratch_.begin() + rank, scratch_.begin() + size_);
+    return scratch_[rank];
+}
+
+void DurationHistogram::add(double seconds) {
+    const double decades = std::log10(std::max(seconds, MIN_SECONDS) / MIN_SECONDS);
+    const auto bucket = static_cast<std::size_t>(std::ceil(decades * BUCKETS_PER_DECADE));
+    buckets_[std::min(bucket, buckets_.size() - 1)]++;
+    total_++;
+}
+
+double DurationHistogram::percentile(double p) const {
+    if (total_ == 0) {
+        return 0.0;
+    }
+    const auto rank = static_cast<std::uint64_t>(std::clamp(p, 0.0, 1.0) * (total_ - 1));
+    std::uint64_t seen = 0;
+    std::size_t bucket = 0;
+    for (; bucket + 1 < buckets_.size(); bucket++) {
+        seen += buckets_[bucket];
+        if (seen > rank) {
+            break;
+        }
+    }
+    return MIN_SECONDS * std::pow(10.0, static_cast<double>(bucket) / BUCKETS_PER_DECADE);
+}
+
+std::expected<TelemetryWriter, std::string>
+TelemetryWriter::open(const std::filesystem::path& path, bool diagnostics) {
+    TelemetryWriter writer;
+    writer.path_ = path.string();
+    writer.json_ = path.extension() == ".json";
+    writer.diagnostics_ = diagnostics;
+    writer.out_.open(path, std::ios::trunc);
+    if (!writer.out_) {
+        return std::unexpected(std::format("cannot create {}", writer.path_));
+    }
+    if (writer.json_) {
+        writer.out_ << "[";
+    } else {
+        writer.out_ << "step,time";
+        for (Phase phase : STEP_PHASES) {
+            writer.out_ << std::format(",{0}_s,{0}_{1}", phase_name(phase),
+                                       phase_count_name(phase));
+        }
+        if (diagnostics) {
+            writer.out_ << ",kinetic,potential,momentum_x,momentum_y,angular_momentum,"
+                           "energy_drift,momentum_drift,angular_momentum_drift";
+        }
+        writer.out_ << '\n';
+    }
+    return writer;
+}
+
+void TelemetryWriter::write(std::uint64_t step, double time, const PhaseProfile& profile,
+                            const Diagnostics* sample, const Diagnostics* initial) {
+    // formatted straight into the stream, so that a record does not allocate
+    std::ostreambuf_iterator<char> out(out_);
+    const bool sampled = diagnostics_ && sample != nullptr && initial != nullptr;
+    const DiagnosticsDrift drift = sampled ? diagnostics_drift(*initial, *sample)
+                                           : DiagnosticsDrift {};
+    if (json_) {
+        out = std::format_to(out, "{}\n{{\"step\":{},\"time\":{}", first_ ? "" : ",", step, time);
+        for (Phase phase : STEP_PHASES) {
+            out = std::format_to(out, ",\"{0}_s\":{2:.9g},\"{0}_{1}\":{3}", phase_name(phase),
+                                 phase_count_name(phase), profile.time(phase),
+                                 profile.count(phase));
+        }
+        if (sampled) {
+            out = std::format_to(out,
+                                 ",\"kinetic\":{:.9g},\"potential\":{:.9g},\"momentum_x\":{:.9g},"
+                                 "\"momentum_y\":{:.9g},\"angular_momentum\":{:.9g},"
+                                 "\"energy_drift\":{:.6e},\"momentum_drift\":{:.6e},"
+                                 "\"angular_momentum_drift\":{:.6e}",
+                                 sample->kinetic, sample->potential, sample->momentum_x,
+                                 sample->momentum_y, sample->angular_momentum, drift.energy,
+                                 drift.momentum, drift.angular_momentum);
+        }
+        *out++ = '}';
+    } else {
+        out = std::format_to(out, "{},{}", step, time);
+        for (Phase phase : STEP_PHASES) {
+            out = std::format_to(out, ",{:.9g},{}", profile.time(phase), profile.count(phase));
+        }
+        if (sampled) {
+            out = std::format_to(out, ",{:.9g},{:.9g},{:.9g},{:.9g},{:.9g},{:.6e},{:.6e},{:.6e}",
+                                 sample->kinetic, sample->potential, sample->momentum_x,
+                                 sample->momentum_y, sample->angular_momentum, drift.energy,
+                                 drift.momentum, drift.angular_momentum);
+        } else if (diagnostics_) {
+            out = std::format_to(out, ",,,,,,,,");
+        }
+        *out++ = '\n';
+    }
+    first_ = false;
+}
+
+std::expected<void, std::string> TelemetryWriter::close() {
+    if (!out_.is_open()) {
+        return {};
+    }
+    if (json_) {
+        out_ << "\n]\n";
+    }
+    out_.close();
+    if (!out_) {
+        return std::unexpected(std::format("cannot write {}", path_));
+    }
+    return {};
+}
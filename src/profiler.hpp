@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "diagnostics.hpp"
+
+// Where the time of a frame or step goes. Every phase has a time and a count of the work it did:
+// force interactions, collision pairs, body kicks, removed bodies, sorted bodies and drawn bodies
+// and cluster sprites.
+enum class Phase { INPUT, FORCE, COLLISION, INTEGRATION, REMOVAL, REORDER, DRAW };
+constexpr std::size_t PHASE_COUNT = 7;
+// the phases Simulation::step() is split into
+constexpr Phase STEP_PHASES[] = {Phase::FORCE, Phase::COLLISION, Phase::INTEGRATION,
+                                 Phase::REMOVAL, Phase::REORDER};
+
+const char* phase_name(Phase phase);
+// what the count of `phase` counts, e.g. "interactions"
+const char* phase_count_name(Phase phase);
+
+struct PhaseProfile {
+    std::array<double, PHASE_COUNT> seconds {};
+    std::array<std::uint64_t, PHASE_COUNT> counts {};
+
+    double& time(Phase phase) {
+        return seconds[static_cast<std::size_t>(phase)];
+    }
+    double time(Phase phase) const {
+        return seconds[static_cast<std::size_t>(phase)];
+    }
+    std::uint64_t& count(Phase phase) {
+        return counts[static_cast<std::size_t>(phase)];
+    }
+    std::uint64_t count(Phase phase) const {
+        return counts[static_cast<std::size_t>(phase)];
+    }
+
+    PhaseProfile& operator+=(const PhaseProfile& other);
+    PhaseProfile& operator-=(const PhaseProfile& other);
+};
+
+// adds the time from its construction to its destruction to one phase
+class PhaseTimer {
+public:
+    PhaseTimer(PhaseProfile& profile, Phase phase) :
+        profile_(profile), phase_(phase), start_(std::chrono::steady_clock::now()) {}
+    ~PhaseTimer() {
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+        profile_.time(phase_) += elapsed.count();
+    }
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+    PhaseProfile& profile_;
+    Phase phase_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// the last CAPACITY samples of a series, oldest first, for plotting and percentiles
+class RollingSamples {
+public:
+    static constexpr std::size_t CAPACITY = 240;
+
+    void push(float value);
+    std::size_t size() const {
+        return size_;
+    }
+    float operator[](std::size_t i) const {
+        return samples_[(next_ + CAPACITY - size_ + i) % CAPACITY];
+    }
+    float max() const;
+    // the p-quantile (p in [0, 1]) of the samples held, 0 without any
+    float percentile(float p) const;
+
+private:
+    std::array<float, CAPACITY> samples_ {};
+    mutable std::array<float, CAPACITY> scratch_ {};
+    std::size_t next_ = 0;
+    std::size_t size_ = 0;
+};
+
+// percentiles of any number of durations, from logarithmic buckets (about 2% wide) between 100 ns
+// and 1000 s
+class DurationHistogram {
+public:
+    void add(double seconds);
+    std::uint64_t size() const {
+        return total_;
+    }
+    // upper edge of the bucket holding the p-quantile, 0 without any samples
+    double percentile(double p) const;
+
+private:
+    static constexpr int BUCKETS_PER_DECADE = 100;
+    static constexpr int DECADES = 10;
+    static constexpr double MIN_SECONDS = 1e-7;
+
+    std::array<std::uint64_t, BUCKETS_PER_DECADE * DECADES + 1> buckets_ {};
+    std::uint64_t total_ = 0;
+};
+
+// time series of the step phases, one record per step: CSV, or a JSON array of objects when the
+// path ends in .json. With `diagnostics` the records also have the conserved quantities and their
+// drift, left empty (CSV) or out (JSON) on the steps without a sample.
+class TelemetryWriter {
+public:
+    static std::expected<TelemetryWriter, std::string> open(const std::filesystem::path& path,
+                                                            bool diagnostics = false);
+
+    // `sample` is the step's sample of the conserved quantities, if it took one, and `initial`
+    // what its drift is measured from
+    void write(std::uint64_t step, double time, const PhaseProfile& profile,
+               const Diagnostics* sample = nullptr, const Diagnostics* initial = nullptr);
+    // finishes the file; the writer takes no more records afterwards
+    std::expected<void, std::string> close();
+
+private:
+    std::ofstream out_;
+    std::string path_;
+    bool json_ = false;
+    bool diagnostics_ = false;
+    bool first_ = true;
+};
@@ -0,0 +1,332 @@
+#include "quadtree.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// depth at which a parallel build hands the remaining subtrees to the pool (up to 4^3 tasks)
+constexpr int SPLIT_DEPTH = 3;
+// root of a tree that is going to be refitted, relative to the bounding box of the bodies, so
+// that the outermost ones do not leave it on the next step
+constexpr float REFIT_MARGIN = 1.0625f;
+
+void QuadTree::build(std::span<const Body> bodies, int leaf_size, ThreadPool* pool) {
+    // pad slightly so that the extreme bodies quantize strictly inside the root cell
+    build(bodies, leaf_size, 1.001f, pool);
+}
+
+void QuadTree::build(std::span<const Body> bodies, int leaf_size, float margin,
+                     ThreadPool* pool) {
+    assert(leaf_size >= 1);
+    leaf_size_ = leaf_size;
+    drifted_ = 0;
+    refitted_ = false;
+    nodes_.clear();
+    sorted_.clear();
+    order_.clear();
+    subtrees_.clear();
+    if (bodies.empty()) {
+        return;
+    }
+
+    Vector2 lo = bodies[0].pos;
+    Vector2 hi = bodies[0].pos;
+    for (const auto& body : bodies) {
+        lo = Vector2Min(lo, body.pos);
+        hi = Vector2Max(hi, body.pos);
+    }
+    const Vector2 center = (lo + hi) * 0.5f;
+    const float half_size = std::max(std::max(hi.x - lo.x, hi.y - lo.y) * 0.5f, 1.0f) * margin;
+    origin_ = center - Vector2 {half_size, half_size};
+    to_grid_ = 65536.0f / (2.0f * half_size);
+
+    sorted_.resize(bodies.size());
+    parallel_for(pool, bodies.size(), 4096, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            sorted_[i] = {key(bodies[i].pos), static_cast<int>(i)};
+        }
+    });
+    std::sort(sorted_.begin(), sorted_.end());
+
+    order_.resize(sorted_.size());
+    std::transform(sorted_.begin(), sorted_.end(), order_.begin(),
+                   [](const auto& entry) { return entry.second; });
+
+    const int count = static_cast<int>(bodies.size());
+    if (!pool || pool->size() == 1) {
+        build_node(nodes_, bodies, 0, count, center, half_size, 0, MAX_DEPTH + 1);
+        return;
+    }
+
+    // build the top levels here, leaving the cells at SPLIT_DEPTH in subtrees_
+    build_node(nodes_, bodies, 0, count, center, half_size, 0, SPLIT_DEPTH);
+    const int top_count = static_cast<int>(nodes_.size());
+    if (subtree_nodes_.size() < subtrees_.size()) {
+        subtree_nodes_.resize(subtrees_.size());
+    }
+    pool->parallel_for(subtrees_.size(), 1, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t t = begin; t < end; t++) {
+            const Subtree& sub = subtrees_[t];
+            subtree_nodes_[t].clear();
+            build_node(subtree_nodes_[t], bodies, sub.first, sub.count, sub.center,
+                       sub.half_size, sub.depth, MAX_DEPTH + 1);
+        }
+    });
+    // a cell lands in a different slot from one build to the next, so every slot is kept at
+    // twice the largest subtree seen; once that settles, builds no longer allocate
+    std::size_t largest = 0;
+    for (const auto& sub_nodes : subtree_nodes_) {
+        largest = std::max(largest, sub_nodes.size());
+    }
+    for (auto& sub_nodes : subtree_nodes_) {
+        if (sub_nodes.capacity() < largest) {
+            sub_nodes.reserve(2 * largest);
+        }
+    }
+
+    for (std::size_t t = 0; t < subtrees_.size(); t++) {
+        const int offset = static_cast<int>(nodes_.size());
+        for (QuadNode node : subtree_nodes_[t]) {
+            for (int& child : node.children) {
+                child = child < 0 ? child : child + offset;
+            }
+            nodes_.push_back(node);
+        }
+        nodes_[subtrees_[t].parent].children[subtrees_[t].quadrant] = offset;
+    }
+
+    // children of the top nodes always come after them, so one reverse sweep fills in the top
+    for (int index = top_count - 1; index >= 0; index--) {
+        if (!nodes_[index].is_leaf()) {
+            sum_children(nodes_[index]);
+        }
+    }
+}
+
+void QuadTree::update(std::span<const Body> bodies, int leaf_size, float max_drift,
+                      ThreadPool* pool) {
+    if (max_drift <= 0.0f) {
+        build(bodies, leaf_size, pool);
+    } else if (leaf_size != leaf_size_ || !refit(bodies, max_drift, pool)) {
+        build(bodies, leaf_size, REFIT_MARGIN, pool);
+    }
+}
+
+bool QuadTree::refit(std::span<const Body> bodies, float max_drift, ThreadPool* pool) {
+    if (nodes_.empty() || bodies.size() != order_.size()) {
+        return false;
+    }
+    const std::size_t n = bodies.size();
+    const QuadNode& root = nodes_.front();
+    for (const auto& body : bodies) {
+        if (!root.contains(body.pos)) {
+            return false;
+        }
+    }
+
+    // fresh keys on the grid of the last build, flagging the bodies whose key no longer shares
+    // the prefix of the leaf they are in
+    moved_.assign(n, 0);
+    parallel_for(pool, nodes_.size(), 256, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            const QuadNode& node = nodes_[i];
+            if (!node.is_leaf() || node.count == 0) {
+                continue;
+            }
+            // 64 bits so that the root's shift by 32 is defined
+            const int shift = 2 * (MAX_DEPTH - node.depth);
+            const std::uint64_t prefix = std::uint64_t {sorted_[node.first].first} >> shift;
+            for (int k = node.first; k < node.first + node.count; k++) {
+                sorted_[k].first = key(bodies[sorted_[k].second].pos);
+                moved_[k] = (std::uint64_t {sorted_[k].first} >> shift) != prefix;
+            }
+        }
+    });
+    const auto moved = static_cast<std::size_t>(std::count(moved_.begin(), moved_.end(), 1));
+    drifted_ += moved;
+    if (static_cast<float>(drifted_) > max_drift * static_cast<float>(n)) {
+        return false;
+    }
+
+    if (moved > 0) {
+        movers_.clear();
+        std::size_t kept = 0;
+        for (std::size_t k = 0; k < n; k++) {
+            if (moved_[k]) {
+                movers_.push_back(sorted_[k]);
+            } else {
+                sorted_[kept++] = sorted_[k];
+            }
+        }
+        std::sort(movers_.begin(), movers_.end());
+        // the kept keys are only ordered between leaves, not within them, which is all the cells
+        // need: a mover lands in the range of the leaf whose prefix it shares, or between leaves
+        // where a new cell will hold it
+        merged_.resize(n);
+        std::size_t a = 0, b = 0;
+        for (std::size_t k = 0; k < n; k++) {
+            if (b == movers_.size() || (a < kept && sorted_[a].first <= movers_[b].first)) {
+                merged_[k] = sorted_[a++];
+            } else {
+                merged_[k] = movers_[b++];
+            }
+        }
+        std::swap(sorted_, merged_);
+        std::transform(sorted_.begin(), sorted_.end(), order_.begin(),
+                       [](const auto& entry) { return entry.second; });
+        relink(bodies, 0, 0, static_cast<int>(n));
+    }
+
+    parallel_for(pool, nodes_.size(), 256, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            QuadNode& node = nodes_[i];
+            if (!node.is_leaf()) {
+                continue;
+            }
+            float mass = 0.0f;
+            Vector2 weighted = {};
+            for (int k = node.first; k < node.first + node.count; k++) {
+                const Body& body = bodies[order_[k]];
+                mass += body.mass;
+                weighted += body.pos * body.mass;
+            }
+            node.mass = mass;
+            node.com = mass > 0.0f ? weighted / mass : node.center;
+        }
+    });
+    for (std::size_t index = nodes_.size(); index-- > 0;) {
+        if (!nodes_[index].is_leaf()) {
+            sum_children(nodes_[index]);
+        }
+    }
+    refitted_ = true;
+    return true;
+}
+
+void QuadTree::relink(std::span<const Body> bodies, int index, int first, int count) {
+    nodes_[index].first = first;
+    nodes_[index].count = count;
+    const int depth = nodes_[index].depth;
+    // a leaf may be left with fewer bodies than leaf_size_, down to none, but one that gained too
+    // many is split like the build would
+    if (nodes_[index].is_leaf() && (count <= leaf_size_ || depth == MAX_DEPTH)) {
+        return;
+    }
+    if (nodes_[index].is_leaf()) {
+        // the keys within a leaf are left unordered by the refit, and the split below partitions
+        // them by quadrant
+        const auto begin = sorted_.begin() + first;
+        std::sort(begin, begin + count);
+        std::transform(begin, begin + count, order_.begin() + first,
+                       [](const auto& entry) { return entry.second; });
+    }
+    const int shift = 2 * (MAX_DEPTH - 1 - depth);
+    const auto end = sorted_.begin() + first + count;
+    auto child_begin = sorted_.begin() + first;
+    for (int q = 0; q < 4; q++) {
+        const auto child_end = std::partition_point(child_begin, end, [&](const auto& entry) {
+            return static_cast<int>((entry.first >> shift) & 3) <= q;
+        });
+        const int child_first = static_cast<int>(child_begin - sorted_.begin());
+        const int child_count = static_cast<int>(child_end - child_begin);
+        child_begin = child_end;
+
+        const int child = nodes_[index].children[q];
+        if (child >= 0) {
+            relink(bodies, child, child_first, child_count);
+        } else if (child_count > 0) {
+            // an empty quadrant (or one of a leaf being split) gets a subtree of its own at the
+            // end of the nodes, which is still after its parent
+            const float h = nodes_[index].half_size * 0.5f;
+            const Vector2 child_center =
+                nodes_[index].center + Vector2 {q & 1 ? h : -h, q & 2 ? h : -h};
+            const int built = build_node(nodes_, bodies, child_first, child_count, child_center,
+                                         h, depth + 1, MAX_DEPTH + 1);
+            nodes_[index].children[q] = built;
+        }
+    }
+}
+
+void QuadTree::sum_children(QuadNode& node) {
+    float mass = 0.0f;
+    Vector2 weighted = {};
+    for (int child : node.children) {
+        if (child >= 0) {
+            mass += nodes_[child].mass;
+            weighted += nodes_[child].com * nodes_[child].mass;
+        }
+    }
+    node.mass = mass;
+    node.com = mass > 0.0f ? weighted / mass : node.center;
+}
+
+std::uint32_t QuadTree::key(Vector2 pos) const {
+    const Vector2 cell = (pos - origin_) * to_grid_;
+    const auto qx = static_cast<std::uint16_t>(std::clamp(cell.x, 0.0f, 65535.0f));
+    const auto qy = static_cast<std::uint16_t>(std::clamp(cell.y, 0.0f, 65535.0f));
+    return morton_encode(qx, qy);
+}
+
+int QuadTree::build_node(std::vector<QuadNode>& out, std::span<const Body> bodies, int first,
+                         int count, Vector2 center, float half_size, int depth, int split_depth) {
+    const int index = static_cast<int>(out.size());
+    out.push_back({
+        .center = center,
+        .half_size = half_size,
+        .depth = depth,
+        .mass = 0.0f,
+        .com = center,
+        .first = first,
+        .count = count,
+        .children = {-1, -1, -1, -1},
+    });
+
+    float mass = 0.0f;
+    Vector2 weighted = {};
+    if (count <= leaf_size_ || depth == MAX_DEPTH) {
+        for (int k = first; k < first + count; k++) {
+            const Body& body = bodies[order_[k]];
+            mass += body.mass;
+            weighted += body.pos * body.mass;
+        }
+    } else {
+        // keys in this cell share their top 2 * depth bits, the next two select the quadrant
+        const int shift = 2 * (MAX_DEPTH - 1 - depth);
+        const auto begin = sorted_.begin() + first;
+        const auto end = begin + count;
+        auto child_begin = begin;
+        for (int q = 0; q < 4; q++) {
+            const auto child_end = std::partition_point(child_begin, end, [&](const auto& entry) {
+                return static_cast<int>((entry.first >> shift) & 3) <= q;
+            });
+            const int child_first = static_cast<int>(child_begin - sorted_.begin());
+            const int child_count = static_cast<int>(child_end - child_begin);
+            child_begin = child_end;
+            if (child_count == 0) {
+                continue;
+            }
+
+            const float h = half_size * 0.5f;
+            const Vector2 child_center = center + Vector2 {q & 1 ? h : -h, q & 2 ? h : -h};
+            if (depth + 1 == split_depth) {
+                // linked and accounted for once the subtree has been built
+                subtrees_.push_back(
+                    {index, q, child_first, child_count, child_center, h, depth + 1});
+                continue;
+            }
+            const int child = build_node(out, bodies, child_first, child_count, child_center, h,
+                                         depth + 1, split_depth);
+            // out may have reallocated during the recursion
+            out[index].children[q] = child;
+            mass += out[child].mass;
+            weighted += out[child].com * out[child].mass;
+        }
+    }
+
+    QuadNode& node = out[index];
+    node.mass = mass;
+    if (mass > 0.0f) {
+        node.com = weighted / mass;
+    }
+    return index;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "body.hpp"
+#include "thread_pool.hpp"
+
+// interleaves the bits of x and y into a Z-order (Morton) key, x taking the even bits
+constexpr std::uint32_t morton_encode(std::uint16_t x, std::uint16_t y) {
+    auto spread = [](std::uint32_t v) {
+        v = (v | (v << 8)) & 0x00FF00FF;
+        v = (v | (v << 4)) & 0x0F0F0F0F;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+struct QuadNode {
+    Vector2 center; // geometric center of the cell
+    float half_size;
+    int depth; // levels below the root
+    float mass;
+    Vector2 com;
+    // range of QuadTree::order() holding the bodies inside this cell
+    int first;
+    int count;
+    int children[4]; // quadrant q = (x >= center.x) | (y >= center.y) << 1, -1 if empty
+
+    bool is_leaf() const {
+        return children[0] < 0 && children[1] < 0 && children[2] < 0 && children[3] < 0;
+    }
+
+    bool contains(Vector2 p) const {
+        return std::abs(p.x - center.x) <= half_size && std::abs(p.y - center.y) <= half_size;
+    }
+};
+
+// pointer-free quadtree over body positions, built by sorting bodies along the Z-curve so that
+// every cell owns a contiguous range of the sorted order
+class QuadTree {
+public:
+    static constexpr int MAX_DEPTH = 16; // one level per bit of each Morton coordinate
+
+    // with a pool, the Morton keys and the subtrees below the first few levels are built in
+    // parallel; the cells and their sums come out the same either way
+    void build(std::span<const Body> bodies, int leaf_size = 8, ThreadPool* pool = nullptr);
+    // refits the tree of the last build to the moved bodies instead of building it again: the
+    // cells stay where they are, the bodies that left their leaf are merged back into the Z-order,
+    // leaves that gained more than `leaf_size` are split and the sums are redone from the bottom
+    // up. Leaves that lost bodies stay, so it builds from scratch once more than `max_drift` times
+    // the body count have changed leaves since the last build, as well as when a body left the
+    // root or the body count or leaf size changed. A `max_drift` of 0 builds every time.
+    void update(std::span<const Body> bodies, int leaf_size, float max_drift,
+                ThreadPool* pool = nullptr);
+
+    bool empty() const {
+        return nodes_.empty();
+    }
+    const QuadNode& root() const {
+        return nodes_.front();
+    }
+    std::span<const QuadNode> nodes() const {
+        return nodes_;
+    }
+    // body indices sorted along the Z-curve
+    std::span<const int> order() const {
+        return order_;
+    }
+    // whether the last update() refitted the tree rather than building it
+    bool refitted() const {
+        return refitted_;
+    }
+
+private:
+    // cell whose subtree is left for a parallel task by the top levels of the build
+    struct Subtree {
+        int parent;
+        int quadrant;
+        int first;
+        int count;
+        Vector2 center;
+        float half_size;
+        int depth;
+    };
+
+    // `margin` scales the root cell beyond the bounding box of the bodies
+    void build(std::span<const Body> bodies, int leaf_size, float margin, ThreadPool* pool);
+    int build_node(std::vector<QuadNode>& out, std::span<const Body> bodies, int first, int count,
+                   Vector2 center, float half_size, int depth, int split_depth);
+    // false if the tree has to be built again instead
+    bool refit(std::span<const Body> bodies, float max_drift, ThreadPool* pool);
+    // hands the ranges of the re-sorted order down the existing cells
+    void relink(std::span<const Body> bodies, int index, int first, int count);
+    void sum_children(QuadNode& node);
+    std::uint32_t key(Vector2 pos) const;
+
+    int leaf_size_ = 8;
+    Vector2 origin_ = {}; // corner of the root cell and grid scale of the last build's keys
+    float to_grid_ = 0.0f;
+    std::size_t drifted_ = 0; // leaf changes since the last build
+    bool refitted_ = false;
+    std::vector<QuadNode> nodes_;
+    std::vector<Subtree> subtrees_;
+    std::vector<std::vector<QuadNode>> subtree_nodes_;
+    std::vector<std::pair<std::uint32_t, int>> sorted_; // (key, body index)
+    std::vector<int> order_;
+    std::vector<std::uint8_t> moved_; // per slot of sorted_, during a refit
+    std::vector<std::pair<std::uint32_t, int>> movers_;
+    std::vector<std::pair<std::uint32_t, int>> merged_;
+};
@@ -0,0 +1,440 @@
+#include "simd_gravity.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+
+#include "cpu_features.hpp"
+#include "gravity.hpp"
+
+#if defined(NBODY_X86)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define NBODY_SIMD_NEON
+#endif
+
+const char* simd_kernel_isa() {
+    return simd_isa_name(simd_isa());
+}
+
+// The x86 versions are compiled for their instruction sets whatever the flags of the build, and
+// the one the CPU supports best is picked at run time; NEON is part of every arm64 CPU.
+
+#if defined(NBODY_X86)
+
+NBODY_TARGET("sse2")
+static float horizontal_sum_sse2(__m128 v) {
+    const __m128 pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+}
+
+template<bool COLLIDE, bool POTENTIAL>
+NBODY_TARGET("sse2")
+static void accelerations_sse2(const BodyArrays& bodies, std::span<Vector2> acc,
+                               std::span<double> potential, float dt, std::size_t begin,
+                               std::size_t end) {
+    const int n = static_cast<int>(bodies.size());
+    const int padded = static_cast<int>(bodies.padded_size());
+    const __m128 eps = _mm_set1_ps(DIST_EPS);
+    const __m128 gravity = _mm_set1_ps(GRAVITY);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 three_halves = _mm_set1_ps(1.5f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 idt = _mm_set1_ps(dt ? 1.0f / dt : 0.0f);
+    const __m128i count = _mm_set1_epi32(n);
+    const __m128i lane_step = _mm_set1_epi32(4);
+
+    for (int i = static_cast<int>(begin); i < static_cast<int>(end); i++) {
+        const __m128 xi = _mm_set1_ps(bodies.x[i]);
+        const __m128 yi = _mm_set1_ps(bodies.y[i]);
+        const __m128 vxi = _mm_set1_ps(bodies.vx[i]);
+        const __m128 vyi = _mm_set1_ps(bodies.vy[i]);
+        const __m128 mi = _mm_set1_ps(bodies.mass[i]);
+        const __m128 ri = _mm_set1_ps(bodies.radius[i] - COLL_EPS);
+        const __m128i self = _mm_set1_epi32(i);
+
+        __m128 ax = _mm_setzero_ps();
+        __m128 ay = _mm_setzero_ps();
+        __m128 phi = _mm_setzero_ps();
+        __m128i j_idx = _mm_setr_epi32(0, 1, 2, 3);
+        for (int j = 0; j < padded; j += 4) {
+            const __m128 mj = _mm_loadu_ps(&bodies.mass[j]);
+            const __m128 dx = _mm_add_ps(_mm_sub_ps(_mm_loadu_ps(&bodies.x[j]), xi), eps);
+            const __m128 dy = _mm_add_ps(_mm_sub_ps(_mm_loadu_ps(&bodies.y[j]), yi), eps);
+            const __m128 dist_sqr = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+            // estimate of 1 / dist refined by one Newton step
+            __m128 inv_dist = _mm_rsqrt_ps(dist_sqr);
+            inv_dist = _mm_mul_ps(
+                inv_dist, _mm_sub_ps(three_halves, _mm_mul_ps(_mm_mul_ps(half, dist_sqr),
+                                                              _mm_mul_ps(inv_dist, inv_dist))));
+            const __m128 inv_sqr = _mm_mul_ps(inv_dist, inv_dist);
+            const __m128 inv_dist_cube = _mm_mul_ps(inv_sqr, inv_dist);
+            __m128 coef = _mm_mul_ps(_mm_mul_ps(gravity, mj), inv_dist_cube);
+
+            if constexpr (COLLIDE) {
+                const __m128 dist = _mm_mul_ps(dist_sqr, inv_dist);
+                const __m128 rj = _mm_loadu_ps(&bodies.radius[j]);
+                const __m128 overlap = _mm_cmplt_ps(dist, _mm_add_ps(ri, rj));
+                const __m128 vrx = _mm_sub_ps(vxi, _mm_loadu_ps(&bodies.vx[j]));
+                const __m128 vry = _mm_sub_ps(vyi, _mm_loadu_ps(&bodies.vy[j]));
+                const __m128 v_dot = _mm_add_ps(_mm_mul_ps(vrx, dx), _mm_mul_ps(vry, dy));
+                const __m128 v_proj_mag = _mm_mul_ps(v_dot, inv_sqr); // negated below
+                const __m128 mass_ratio = _mm_div_ps(_mm_mul_ps(two, mj), _mm_add_ps(mi, mj));
+                const __m128 coll = _mm_mul_ps(_mm_mul_ps(mass_ratio, v_proj_mag), idt);
+                coef = _mm_sub_ps(coef, _mm_and_ps(overlap, coll));
+            }
+
+            // drop the self pair and the zero padding past the last body
+            const __m128 valid = _mm_castsi128_ps(
+                _mm_andnot_si128(_mm_cmpeq_epi32(j_idx, self), _mm_cmplt_epi32(j_idx, count)));
+            coef = _mm_and_ps(valid, coef);
+            if constexpr (POTENTIAL) {
+                // the product is masked rather than the mass, as 0 * inf is NaN
+                phi = _mm_sub_ps(phi, _mm_and_ps(valid, _mm_mul_ps(mj, inv_dist)));
+            }
+
+            ax = _mm_add_ps(ax, _mm_mul_ps(dx, coef));
+            ay = _mm_add_ps(ay, _mm_mul_ps(dy, coef));
+            j_idx = _mm_add_epi32(j_idx, lane_step);
+        }
+        acc[i] = {horizontal_sum_sse2(ax), horizontal_sum_sse2(ay)};
+        if constexpr (POTENTIAL) {
+            potential[i] = 0.5 * GRAVITY * bodies.mass[i] * horizontal_sum_sse2(phi);
+        }
+    }
+}
+
+NBODY_TARGET("avx2,fma")
+static float horizontal_sum_avx2(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    return _mm_cvtss_f32(sum);
+}
+
+template<bool COLLIDE, bool POTENTIAL>
+NBODY_TARGET("avx2,fma")
+static void accelerations_avx2(const BodyArrays& bodies, std::span<Vector2> acc,
+                               std::span<double> potential, float dt, std::size_t begin,
+                               std::size_t end) {
+    const int n = static_cast<int>(bodies.size());
+    const int padded = static_cast<int>(bodies.padded_size());
+    const __m256 eps = _mm256_set1_ps(DIST_EPS);
+    const __m256 gravity = _mm256_set1_ps(GRAVITY);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 three_halves = _mm256_set1_ps(1.5f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 idt = _mm256_set1_ps(dt ? 1.0f / dt : 0.0f);
+    const __m256i count = _mm256_set1_epi32(n);
+    const __m256i lane_step = _mm256_set1_epi32(8);
+
+    for (int i = static_cast<int>(begin); i < static_cast<int>(end); i++) {
+        const __m256 xi = _mm256_set1_ps(bodies.x[i]);
+        const __m256 yi = _mm256_set1_ps(bodies.y[i]);
+        const __m256 vxi = _mm256_set1_ps(bodies.vx[i]);
+        const __m256 vyi = _mm256_set1_ps(bodies.vy[i]);
+        const __m256 mi = _mm256_set1_ps(bodies.mass[i]);
+        const __m256 ri = _mm256_set1_ps(bodies.radius[i] - COLL_EPS);
+        const __m256i self = _mm256_set1_epi32(i);
+
+        __m256 ax = _mm256_setzero_ps();
+        __m256 ay = _mm256_setzero_ps();
+        __m256 phi = _mm256_setzero_ps();
+        __m256i j_idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        for (int j = 0; j < padded; j += 8) {
+            const __m256 mj = _mm256_loadu_ps(&bodies.mass[j]);
+            const __m256 dx = _mm256_add_ps(_mm256_sub_ps(_mm256_loadu_ps(&bodies.x[j]), xi), eps);
+            const __m256 dy = _mm256_add_ps(_mm256_sub_ps(_mm256_loadu_ps(&bodies.y[j]), yi), eps);
+            const __m256 dist_sqr = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+            // estimate of 1 / dist refined by one Newton step
+            __m256 inv_dist = _mm256_rsqrt_ps(dist_sqr);
+            inv_dist = _mm256_mul_ps(
+                inv_dist, _mm256_fnmadd_ps(_mm256_mul_ps(half, dist_sqr),
+                                           _mm256_mul_ps(inv_dist, inv_dist), three_halves));
+            const __m256 inv_sqr = _mm256_mul_ps(inv_dist, inv_dist);
+            const __m256 inv_dist_cube = _mm256_mul_ps(inv_sqr, inv_dist);
+            __m256 coef = _mm256_mul_ps(_mm256_mul_ps(gravity, mj), inv_dist_cube);
+
+            if constexpr (COLLIDE) {
+                const __m256 dist = _mm256_mul_ps(dist_sqr, inv_dist);
+                const __m256 rj = _mm256_loadu_ps(&bodies.radius[j]);
+                const __m256 overlap = _mm256_cmp_ps(dist, _mm256_add_ps(ri, rj), _CMP_LT_OQ);
+                const __m256 vrx = _mm256_sub_ps(vxi, _mm256_loadu_ps(&bodies.vx[j]));
+                const __m256 vry = _mm256_sub_ps(vyi, _mm256_loadu_ps(&bodies.vy[j]));
+                const __m256 v_dot = _mm256_fmadd_ps(vrx, dx, _mm256_mul_ps(vry, dy));
+                const __m256 v_proj_mag = _mm256_mul_ps(v_dot, inv_sqr); // negated below
+                const __m256 mass_ratio =
+                    _mm256_div_ps(_mm256_mul_ps(two, mj), _mm256_add_ps(mi, mj));
+                const __m256 coll = _mm256_mul_ps(_mm256_mul_ps(mass_ratio, v_proj_mag), idt);
+                coef = _mm256_sub_ps(coef, _mm256_and_ps(overlap, coll));
+            }
+
+            // drop the self pair and the zero padding past the last body
+            const __m256i valid_i = _mm256_andnot_si256(_mm256_cmpeq_epi32(j_idx, self),
+                                                        _mm256_cmpgt_epi32(count, j_idx));
+            coef = _mm256_and_ps(_mm256_castsi256_ps(valid_i), coef);
+            if constexpr (POTENTIAL) {
+                phi = _mm256_blendv_ps(phi, _mm256_fnmadd_ps(mj, inv_dist, phi),
+                                       _mm256_castsi256_ps(valid_i));
+            }
+
+            ax = _mm256_fmadd_ps(dx, coef, ax);
+            ay = _mm256_fmadd_ps(dy, coef, ay);
+            j_idx = _mm256_add_epi32(j_idx, lane_step);
+        }
+        acc[i] = {horizontal_sum_avx2(ax), horizontal_sum_avx2(ay)};
+        if constexpr (POTENTIAL) {
+            potential[i] = 0.5 * GRAVITY * bodies.mass[i] * horizontal_sum_avx2(phi);
+        }
+    }
+}
+
+// the extracts that _mm512_reduce_add_ps and the unmasked 14 bit estimate build on start from
+// undefined vectors, which GCC 12 warns about as uninitialized; going through memory and the
+// masked estimate do not
+NBODY_TARGET("avx512f,fma")
+static float horizontal_sum_avx512(__m512 v) {
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, v);
+    return horizontal_sum_avx2(_mm256_add_ps(_mm256_load_ps(lanes), _mm256_load_ps(lanes + 8)));
+}
+
+// the padding of BodyArrays is a multiple of 16, so this needs no tail either
+template<bool COLLIDE, bool POTENTIAL>
+NBODY_TARGET("avx512f,fma")
+static void accelerations_avx512(const BodyArrays& bodies, std::span<Vector2> acc,
+                                 std::span<double> potential, float dt, std::size_t begin,
+                                 std::size_t end) {
+    const int n = static_cast<int>(bodies.size());
+    const int padded = static_cast<int>(bodies.padded_size());
+    const __m512 eps = _mm512_set1_ps(DIST_EPS);
+    const __m512 gravity = _mm512_set1_ps(GRAVITY);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 three_halves = _mm512_set1_ps(1.5f);
+    const __m512 two = _mm512_set1_ps(2.0f);
+    const __m512 idt = _mm512_set1_ps(dt ? 1.0f / dt : 0.0f);
+    const __m512i count = _mm512_set1_epi32(n);
+    const __m512i lane_step = _mm512_set1_epi32(16);
+
+    for (int i = static_cast<int>(begin); i < static_cast<int>(end); i++) {
+        const __m512 xi = _mm512_set1_ps(bodies.x[i]);
+        const __m512 yi = _mm512_set1_ps(bodies.y[i]);
+        const __m512 vxi = _mm512_set1_ps(bodies.vx[i]);
+        const __m512 vyi = _mm512_set1_ps(bodies.vy[i]);
+        const __m512 mi = _mm512_set1_ps(bodies.mass[i]);
+        const __m512 ri = _mm512_set1_ps(bodies.radius[i] - COLL_EPS);
+        const __m512i self = _mm512_set1_epi32(i);
+
+        __m512 ax = _mm512_setzero_ps();
+        __m512 ay = _mm512_setzero_ps();
+        __m512 phi = _mm512_setzero_ps();
+        __m512i j_idx = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+        for (int j = 0; j < padded; j += 16) {
+            const __m512 mj = _mm512_loadu_ps(&bodies.mass[j]);
+            const __m512 dx = _mm512_add_ps(_mm512_sub_ps(_mm512_loadu_ps(&bodies.x[j]), xi), eps);
+            const __m512 dy = _mm512_add_ps(_mm512_sub_ps(_mm512_loadu_ps(&bodies.y[j]), yi), eps);
+            const __m512 dist_sqr = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+            // the 14 bit estimate of 1 / dist refined by one Newton step
+            __m512 inv_dist = _mm512_maskz_rsqrt14_ps(0xFFFF, dist_sqr);
+            inv_dist = _mm512_mul_ps(
+                inv_dist, _mm512_fnmadd_ps(_mm512_mul_ps(half, dist_sqr),
+                                           _mm512_mul_ps(inv_dist, inv_dist), three_halves));
+            const __m512 inv_sqr = _mm512_mul_ps(inv_dist, inv_dist);
+            const __m512 inv_dist_cube = _mm512_mul_ps(inv_sqr, inv_dist);
+            __m512 coef = _mm512_mul_ps(_mm512_mul_ps(gravity, mj), inv_dist_cube);
+
+            if constexpr (COLLIDE) {
+                const __m512 dist = _mm512_mul_ps(dist_sqr, inv_dist);
+                const __m512 rj = _mm512_loadu_ps(&bodies.radius[j]);
+                const __mmask16 overlap =
+                    _mm512_cmp_ps_mask(dist, _mm512_add_ps(ri, rj), _CMP_LT_OQ);
+                const __m512 vrx = _mm512_sub_ps(vxi, _mm512_loadu_ps(&bodies.vx[j]));
+                const __m512 vry = _mm512_sub_ps(vyi, _mm512_loadu_ps(&bodies.vy[j]));
+                const __m512 v_dot = _mm512_fmadd_ps(vrx, dx, _mm512_mul_ps(vry, dy));
+                const __m512 v_proj_mag = _mm512_mul_ps(v_dot, inv_sqr); // negated below
+                const __m512 mass_ratio =
+                    _mm512_div_ps(_mm512_mul_ps(two, mj), _mm512_add_ps(mi, mj));
+                const __m512 coll = _mm512_mul_ps(_mm512_mul_ps(mass_ratio, v_proj_mag), idt);
+                coef = _mm512_mask_sub_ps(coef, overlap, coef, coll);
+            }
+
+            // drop the self pair and the zero padding past the last body
+            const __mmask16 valid = _mm512_mask_cmplt_epi32_mask(
+                _mm512_cmpneq_epi32_mask(j_idx, self), j_idx, count);
+            coef = _mm512_maskz_mov_ps(valid, coef);
+            if constexpr (POTENTIAL) {
+                phi = _mm512_mask3_fnmadd_ps(mj, inv_dist, phi, valid);
+            }
+
+            ax = _mm512_fmadd_ps(dx, coef, ax);
+            ay = _mm512_fmadd_ps(dy, coef, ay);
+            j_idx = _mm512_add_epi32(j_idx, lane_step);
+        }
+        acc[i] = {horizontal_sum_avx512(ax), horizontal_sum_avx512(ay)};
+        if constexpr (POTENTIAL) {
+            potential[i] = 0.5 * GRAVITY * bodies.mass[i] * horizontal_sum_avx512(phi);
+        }
+    }
+}
+
+#endif
+
+#if defined(NBODY_SIMD_NEON)
+
+template<bool COLLIDE, bool POTENTIAL>
+static void accelerations_neon(const BodyArrays& bodies, std::span<Vector2> acc,
+                               std::span<double> potential, float dt, std::size_t begin,
+                               std::size_t end) {
+    const int n = static_cast<int>(bodies.size());
+    const int padded = static_cast<int>(bodies.padded_size());
+    const float32x4_t eps = vdupq_n_f32(DIST_EPS);
+    const float32x4_t gravity = vdupq_n_f32(GRAVITY);
+    const float32x4_t two = vdupq_n_f32(2.0f);
+    const float32x4_t idt = vdupq_n_f32(dt ? 1.0f / dt : 0.0f);
+    const uint32x4_t count = vdupq_n_u32(static_cast<std::uint32_t>(n));
+    const uint32x4_t lane_step = vdupq_n_u32(4);
+    const std::uint32_t lanes[4] = {0, 1, 2, 3};
+
+    for (int i = static_cast<int>(begin); i < static_cast<int>(end); i++) {
+        const float32x4_t xi = vdupq_n_f32(bodies.x[i]);
+        const float32x4_t yi = vdupq_n_f32(bodies.y[i]);
+        const float32x4_t vxi = vdupq_n_f32(bodies.vx[i]);
+        const float32x4_t vyi = vdupq_n_f32(bodies.vy[i]);
+        const float32x4_t mi = vdupq_n_f32(bodies.mass[i]);
+        const float32x4_t ri = vdupq_n_f32(bodies.radius[i] - COLL_EPS);
+        const uint32x4_t self = vdupq_n_u32(static_cast<std::uint32_t>(i));
+
+        float32x4_t ax = vdupq_n_f32(0.0f);
+        float32x4_t ay = vdupq_n_f32(0.0f);
+        float32x4_t phi = vdupq_n_f32(0.0f);
+        uint32x4_t j_idx = vld1q_u32(lanes);
+        for (int j = 0; j < padded; j += 4) {
+            const float32x4_t mj = vld1q_f32(&bodies.mass[j]);
+            const float32x4_t dx = vaddq_f32(vsubq_f32(vld1q_f32(&bodies.x[j]), xi), eps);
+            const float32x4_t dy = vaddq_f32(vsubq_f32(vld1q_f32(&bodies.y[j]), yi), eps);
+            const float32x4_t dist_sqr = vfmaq_f32(vmulq_f32(dy, dy), dx, dx);
+            // the 8 bit estimate of 1 / dist needs two Newton steps to reach float precision
+            float32x4_t inv_dist = vrsqrteq_f32(dist_sqr);
+            inv_dist = vmulq_f32(inv_dist, vrsqrtsq_f32(vmulq_f32(dist_sqr, inv_dist), inv_dist));
+            inv_dist = vmulq_f32(inv_dist, vrsqrtsq_f32(vmulq_f32(dist_sqr, inv_dist), inv_dist));
+            const float32x4_t inv_sqr = vmulq_f32(inv_dist, inv_dist);
+            const float32x4_t inv_dist_cube = vmulq_f32(inv_sqr, inv_dist);
+            float32x4_t coef = vmulq_f32(vmulq_f32(gravity, mj), inv_dist_cube);
+
+            if constexpr (COLLIDE) {
+                const float32x4_t dist = vmulq_f32(dist_sqr, inv_dist);
+                const uint32x4_t overlap =
+                    vcltq_f32(dist, vaddq_f32(ri, vld1q_f32(&bodies.radius[j])));
+                const float32x4_t vrx = vsubq_f32(vxi, vld1q_f32(&bodies.vx[j]));
+                const float32x4_t vry = vsubq_f32(vyi, vld1q_f32(&bodies.vy[j]));
+                const float32x4_t v_dot = vfmaq_f32(vmulq_f32(vry, dy), vrx, dx);
+                const float32x4_t v_proj_mag = vmulq_f32(v_dot, inv_sqr); // negated below
+                const float32x4_t mass_ratio = vdivq_f32(vmulq_f32(two, mj), vaddq_f32(mi, mj));
+                const float32x4_t coll = vmulq_f32(vmulq_f32(mass_ratio, v_proj_mag), idt);
+                coef = vsubq_f32(coef, vreinterpretq_f32_u32(
+                                           vandq_u32(overlap, vreinterpretq_u32_f32(coll))));
+            }
+
+            // drop the self pair and the zero padding past the last body
+            const uint32x4_t valid = vbicq_u32(vcltq_u32(j_idx, count), vceqq_u32(j_idx, self));
+            coef = vreinterpretq_f32_u32(vandq_u32(valid, vreinterpretq_u32_f32(coef)));
+            if constexpr (POTENTIAL) {
+                phi = vbslq_f32(valid, vfmsq_f32(phi, mj, inv_dist), phi);
+            }
+
+            ax = vfmaq_f32(ax, dx, coef);
+            ay = vfmaq_f32(ay, dy, coef);
+            j_idx = vaddq_u32(j_idx, lane_step);
+        }
+        acc[i] = {vaddvq_f32(ax), vaddvq_f32(ay)};
+        if constexpr (POTENTIAL) {
+            potential[i] = 0.5 * GRAVITY * bodies.mass[i] * vaddvq_f32(phi);
+        }
+    }
+}
+
+#endif
+
+template<bool COLLIDE, bool POTENTIAL>
+static void accelerations_scalar(const BodyArrays& bodies, std::span<Vector2> acc,
+                                 std::span<double> potential, float dt, std::size_t begin,
+                                 std::size_t end) {
+    const std::size_t n = bodies.size();
+    const float idt = dt ? 1.0f / dt : 0.0f;
+    for (std::size_t i = begin; i < end; i++) {
+        float ax = 0.0f;
+        float ay = 0.0f;
+        float phi = 0.0f;
+        for (std::size_t j = 0; j < n; j++) {
+            if (i == j) {
+                continue;
+            }
+            const float dx = bodies.x[j] - bodies.x[i] + DIST_EPS;
+            const float dy = bodies.y[j] - bodies.y[i] + DIST_EPS;
+            const float dist_sqr = dx * dx + dy * dy;
+            const float inv_dist = inverse_sqrt(dist_sqr);
+            float coef = GRAVITY * bodies.mass[j] * inv_dist * inv_dist * inv_dist;
+            if constexpr (COLLIDE) {
+                const float dist = dist_sqr * inv_dist;
+                const float v_dot = (bodies.vx[i] - bodies.vx[j]) * dx +
+                                    (bodies.vy[i] - bodies.vy[j]) * dy;
+                const float m_tot = bodies.mass[i] + bodies.mass[j];
+                const float coll = 2.0f * bodies.mass[j] / m_tot * v_dot * inv_dist * inv_dist;
+                coef -= dist < bodies.radius[i] + bodies.radius[j] - COLL_EPS ? coll * idt : 0.0f;
+            }
+            if constexpr (POTENTIAL) {
+                // no padding, and the self pair is skipped before its inf, so nothing to mask
+                phi -= bodies.mass[j] * inv_dist;
+            }
+            ax += dx * coef;
+            ay += dy * coef;
+        }
+        acc[i] = {ax, ay};
+        if constexpr (POTENTIAL) {
+            potential[i] = 0.5 * GRAVITY * bodies.mass[i] * phi;
+        }
+    }
+}
+
+template<bool COLLIDE, bool POTENTIAL>
+static void accelerations(const BodyArrays& bodies, std::span<Vector2> acc,
+                          std::span<double> potential, float dt, std::size_t begin,
+                          std::size_t end) {
+    switch (simd_isa()) {
+#if defined(NBODY_X86)
+        case SimdIsa::AVX512:
+            return accelerations_avx512<COLLIDE, POTENTIAL>(bodies, acc, potential, dt, begin, end);
+        case SimdIsa::AVX2:
+            return accelerations_avx2<COLLIDE, POTENTIAL>(bodies, acc, potential, dt, begin, end);
+        case SimdIsa::SSE2:
+            return accelerations_sse2<COLLIDE, POTENTIAL>(bodies, acc, potential, dt, begin, end);
+#elif defined(NBODY_SIMD_NEON)
+        case SimdIsa::NEON:
+            return accelerations_neon<COLLIDE, POTENTIAL>(bodies, acc, potential, dt, begin, end);
+#endif
+        default:
+            return accelerations_scalar<COLLIDE, POTENTIAL>(bodies, acc, potential, dt, begin,
+                                                            end);
+    }
+}
+
+// the collision response and the potential are only compiled into the loop when they are needed
+void simd_pairwise_accelerations(const BodyArrays& bodies, std::span<Vector2> acc,
+                                 std::span<double> potential, float dt, std::size_t begin,
+                                 std::size_t end) {
+    assert(acc.size() == bodies.size() && begin <= end && end <= bodies.size());
+    assert(potential.empty() || potential.size() == bodies.size());
+    const auto with_potential = [&]<bool COLLIDE>() {
+        if (!potential.empty()) {
+            accelerations<COLLIDE, true>(bodies, acc, potential, dt, begin, end);
+        } else {
+            accelerations<COLLIDE, false>(bodies, acc, potential, dt, begin, end);
+        }
+    };
+    if (dt) {
+        with_potential.template operator()<true>();
+    } else {
+        with_potential.template operator()<false>();
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <span>
+
+#include "body_arrays.hpp"
+
+// name of the instruction set the SoA kernel runs with, simd_isa_name(simd_isa())
+const char* simd_kernel_isa();
+
+// same sum as PairwiseEngine over SoA storage, evaluating 16 (AVX-512), 8 (AVX2) or 4 (SSE2,
+// NEON) other bodies per iteration with the widest kernel the CPU has. Only rows [begin, end) of
+// acc are written, and of `potential` (m_i phi_i / 2, as in ForceEngine::potential_rows) unless it
+// is empty.
+void simd_pairwise_accelerations(const BodyArrays& bodies, std::span<Vector2> acc,
+                                 std::span<double> potential, float dt, std::size_t begin,
+                                 std::size_t end);
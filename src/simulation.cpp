@@ -0,0 +1,517 @@
+#include "simulation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <utility>
+
+#include "quadtree.hpp"
+
+Simulation::Simulation(std::vector<Body> bodies) {
+    reset(std::move(bodies));
+}
+
+void Simulation::reset(std::vector<Body> bodies) {
+    // copied when it fits, so that the reserved storage stays
+    if (bodies.size() <= bodies_.capacity()) {
+        bodies_.assign(bodies.begin(), bodies.end());
+    } else {
+        bodies_ = std::move(bodies);
+    }
+    ids_.resize(bodies_.size());
+    std::iota(ids_.begin(), ids_.end(), 0u);
+    next_id_ = static_cast<std::uint32_t>(bodies_.size());
+    id_epoch_++;
+    acc_.assign(bodies_.size(), {});
+    acc_valid_ = false;
+    structure_++;
+    steps_ = 0;
+    time_ = 0.0;
+    last_reorder_ = 0;
+    diagnostics_.reset();
+    initial_diagnostics_.reset();
+}
+
+void Simulation::restore(std::vector<Body> bodies, std::uint64_t steps, double time,
+                         std::span<const Vector2> acc, std::span<const std::uint8_t> levels,
+                         std::span<const std::uint32_t> ids) {
+    reset(std::move(bodies));
+    steps_ = steps;
+    time_ = time;
+    last_reorder_ = steps;
+    if (ids.size() == bodies_.size() && !ids.empty()) {
+        std::copy(ids.begin(), ids.end(), ids_.begin());
+        next_id_ = *std::max_element(ids.begin(), ids.end()) + 1;
+    }
+    if (acc.size() == bodies_.size()) {
+        std::copy(acc.begin(), acc.end(), acc_.begin());
+        acc_valid_ = true;
+    }
+    // without levels the block integrator picks them along with fresh accelerations
+    level_.assign(levels.begin(), levels.end());
+}
+
+void Simulation::reserve(std::size_t n) {
+    bodies_.reserve(n);
+    ids_.reserve(n);
+    acc_.reserve(n);
+    level_.reserve(n);
+    active_.reserve(n);
+    sort_keys_.reserve(n);
+    sorted_bodies_.reserve(n);
+    sorted_ids_.reserve(n);
+    sorted_acc_.reserve(n);
+    sorted_level_.reserve(n);
+    merge_parent_.reserve(n);
+    absorbed_.reserve(n);
+}
+
+void Simulation::add_body(const Body& body) {
+    bodies_.push_back(body);
+    ids_.push_back(next_id_++);
+    acc_.push_back({});
+    acc_valid_ = false;
+    structure_++;
+    initial_diagnostics_.reset();
+}
+
+const char* collision_mode_name(CollisionMode mode) {
+    switch (mode) {
+        case CollisionMode::NONE:
+            return "none";
+        case CollisionMode::KERNEL:
+            return "kernel";
+        case CollisionMode::BROADPHASE:
+            return "broadphase";
+        case CollisionMode::MERGE:
+            return "merge";
+    }
+    return "?";
+}
+
+const char* integrator_name(Integrator integrator) {
+    switch (integrator) {
+        case Integrator::BLOCK:
+            return "block";
+        case Integrator::EULER:
+            return "euler";
+        case Integrator::LEAPFROG:
+            return "leapfrog";
+        case Integrator::YOSHIDA4:
+            return "yoshida4";
+    }
+    return "?";
+}
+
+void Simulation::step(float dt) {
+    const auto start = std::chrono::steady_clock::now();
+    profile_ = {};
+    interactions_ = 0;
+    engine_->collisions = collisions == CollisionMode::KERNEL;
+    sampled_potential_.reset();
+    if (diagnostics_every != 0 && !initial_diagnostics_.has_value()) {
+        sample_diagnostics(dt);
+    }
+    // sampled at the end of the step
+    const bool sample = diagnostics_every != 0 && (steps_ + 1) % diagnostics_every == 0;
+    if (collisions == CollisionMode::BROADPHASE) {
+        PhaseTimer timer(profile_, Phase::COLLISION);
+        apply_collisions(dt);
+    } else {
+        pairs_.clear();
+    }
+
+    switch (integrator) {
+        case Integrator::EULER:
+            // left valid by a sample at the end of the last step
+            if (!acc_valid_) {
+                compute_forces(dt);
+            }
+            parallel_for(pool, bodies_.size(), 4096, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; i++) {
+                    bodies_[i].update(acc_[i], dt);
+                }
+            });
+            profile_.count(Phase::INTEGRATION) += bodies_.size();
+            // the bodies moved after the evaluation
+            acc_valid_ = false;
+            break;
+        case Integrator::LEAPFROG:
+            if (!acc_valid_) {
+                compute_forces(dt);
+            }
+            kick(dt * 0.5f);
+            drift(dt);
+            compute_forces(dt, sample);
+            kick(dt * 0.5f);
+            break;
+        case Integrator::YOSHIDA4: {
+            // Yoshida (1990): leapfrog composed with weights w1, w0, w1 where the middle one is
+            // negative; written as drift-kick-drift with four drifts and three kicks
+            const float cbrt2 = std::cbrt(2.0f);
+            const float w1 = 1.0f / (2.0f - cbrt2);
+            const float w0 = -cbrt2 * w1;
+            const float drifts[] = {w1 * 0.5f, (w0 + w1) * 0.5f, (w0 + w1) * 0.5f, w1 * 0.5f};
+            const float kicks[] = {w1, w0, w1};
+            for (int k = 0; k < 3; k++) {
+                drift(drifts[k] * dt);
+                compute_forces(dt);
+                kick(kicks[k] * dt);
+            }
+            drift(drifts[3] * dt);
+            acc_valid_ = false;
+            break;
+        }
+        case Integrator::BLOCK:
+            block_step(dt, sample);
+            break;
+    }
+
+    if (collisions == CollisionMode::MERGE) {
+        PhaseTimer timer(profile_, Phase::COLLISION);
+        merge_collisions();
+    }
+    {
+        PhaseTimer timer(profile_, Phase::REMOVAL);
+        remove_bodies();
+    }
+    steps_++;
+    time_ += dt;
+    if (sample) {
+        sample_diagnostics(dt);
+    }
+    if (reorder_every != 0 && steps_ - last_reorder_ >= reorder_every) {
+        PhaseTimer timer(profile_, Phase::REORDER);
+        reorder();
+    }
+
+    // whatever the other phases leave of the step went into integrating
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    profile_.time(Phase::INTEGRATION) = elapsed.count() - profile_.time(Phase::FORCE) -
+                                        profile_.time(Phase::COLLISION) -
+                                        profile_.time(Phase::REMOVAL) -
+                                        profile_.time(Phase::REORDER);
+    profile_.count(Phase::FORCE) = interactions_;
+    profile_.count(Phase::COLLISION) = pairs_.size();
+}
+
+void Simulation::compute_forces(float dt, bool potential) {
+    PhaseTimer timer(profile_, Phase::FORCE);
+    engine_->with_potential = potential;
+    engine_->compute(bodies_, acc_, dt);
+    engine_->with_potential = false;
+    if (potential) {
+        sampled_potential_ = engine_->potential_energy;
+    }
+    interactions_ += engine_->interactions;
+    // the kernel collision term depends on velocities, which the next kick changes
+    acc_valid_ = !engine_->collisions;
+}
+
+// euler and yoshida4 end on a drift, so their potential is evaluated here, at the new positions;
+// the accelerations stay valid for euler and leapfrog to start the next step with
+void Simulation::sample_diagnostics(float dt) {
+    if (!sampled_potential_.has_value()) {
+        compute_forces(dt, true);
+    }
+    diagnostics_ = measure_diagnostics(bodies_, *sampled_potential_);
+    diagnostics_->step = steps_;
+    diagnostics_->time = time_;
+    sampled_potential_.reset();
+    if (!initial_diagnostics_.has_value()) {
+        initial_diagnostics_ = diagnostics_;
+    }
+}
+
+void Simulation::apply_collisions(float dt) {
+    find_collision_pairs(bodies_, grid_, pairs_);
+    // impulses from the velocities at the start of the step, applied to both sides at once
+    for (const auto& [i, j] : pairs_) {
+        const Vector2 dv_i = collision_acceleration(bodies_[i], bodies_[j], dt) * dt;
+        const Vector2 dv_j = collision_acceleration(bodies_[j], bodies_[i], dt) * dt;
+        bodies_[i].vel += dv_i;
+        bodies_[j].vel += dv_j;
+    }
+}
+
+void Simulation::kick(float dt) {
+    parallel_for(pool, bodies_.size(), 4096, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            bodies_[i].vel += acc_[i] * dt;
+        }
+    });
+    profile_.count(Phase::INTEGRATION) += bodies_.size();
+}
+
+void Simulation::drift(float dt) {
+    parallel_for(pool, bodies_.size(), 4096, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            bodies_[i].pos += bodies_[i].vel * dt;
+        }
+    });
+}
+
+// smallest level whose step satisfies the accuracy criterion for body i
+std::uint8_t Simulation::block_level(std::size_t i, float dt) const {
+    // |v| / |a| is the orbital period over 2 pi for a circular orbit; the sqrt(radius / |a|) term
+    // keeps bodies at rest (like the sun) from being refined
+    const Body& body = bodies_[i];
+    const float acc = Vector2Length(acc_[i]);
+    const float t = std::max(Vector2Length(body.vel), std::sqrt(body.radius * acc)) / acc;
+    const float ratio = dt / (block_eta * t);
+    if (!(ratio > 1.0f)) {
+        return 0;
+    }
+    return static_cast<std::uint8_t>(std::min(
+        static_cast<int>(std::ceil(std::log2(ratio))), MAX_BLOCK_LEVEL));
+}
+
+// Hierarchical kick-drift-kick leapfrog. Time inside a step is counted in ticks of
+// dt / 2^MAX_BLOCK_LEVEL and a body on level l kicks every 2^(MAX_BLOCK_LEVEL - l) ticks, with its
+// steps aligned to multiples of their length. Every body drifts to each point where some step ends,
+// but only the bodies whose step ends there get new accelerations. A body may move to a finer
+// level at the end of any of its steps and to a coarser one only where the coarser steps align.
+// All the bodies are synchronised at the end of dt.
+void Simulation::block_step(float dt, bool potential) {
+    constexpr std::uint32_t TICKS = 1u << MAX_BLOCK_LEVEL;
+    const std::size_t n = bodies_.size();
+    if (n == 0) {
+        return;
+    }
+    // levels are only kept by this integrator, so they may be missing after switching to it
+    if (!acc_valid_ || level_.size() != n) {
+        compute_forces(dt);
+        acc_valid_ = true;
+        level_.resize(n);
+        for (std::size_t i = 0; i < n; i++) {
+            level_[i] = block_level(i, dt);
+        }
+    }
+    const auto step_dt = [&](std::size_t i) { return dt / static_cast<float>(1u << level_[i]); };
+    const auto stride = [&](std::size_t i) { return TICKS >> level_[i]; };
+
+    // every body opens a step at the start
+    parallel_for(pool, n, 4096, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            bodies_[i].vel += acc_[i] * (0.5f * step_dt(i));
+        }
+    });
+    profile_.count(Phase::INTEGRATION) += n;
+
+    std::uint32_t tick = 0;
+    while (tick < TICKS) {
+        // the steps of the finest level in use end first, and every coarser step ends on one of
+        // them
+        const std::uint8_t finest = *std::max_element(level_.begin(), level_.end());
+        const std::uint32_t finest_stride = TICKS >> finest;
+        const std::uint32_t next = (tick / finest_stride + 1) * finest_stride;
+        drift(static_cast<float>(next - tick) * (dt / TICKS));
+        tick = next;
+
+        active_.clear();
+        for (std::size_t i = 0; i < n; i++) {
+            if (tick % stride(i) == 0) {
+                active_.push_back(static_cast<std::uint32_t>(i));
+            }
+        }
+        {
+            PhaseTimer timer(profile_, Phase::FORCE);
+            // every body is active at the end, where a sample takes the potential of the pass
+            engine_->with_potential = potential && tick == TICKS;
+            engine_->compute_subset(bodies_, active_, acc_, dt / static_cast<float>(1u << finest));
+            engine_->with_potential = false;
+            if (potential && tick == TICKS) {
+                sampled_potential_ = engine_->potential_energy;
+            }
+            interactions_ += engine_->interactions;
+        }
+        profile_.count(Phase::INTEGRATION) += active_.size();
+
+        // close the step that ended, pick the level of the next one and open it
+        parallel_for(pool, active_.size(), 4096, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t a = begin; a < end; a++) {
+                const std::uint32_t i = active_[a];
+                bodies_[i].vel += acc_[i] * (0.5f * step_dt(i));
+                std::uint8_t level = block_level(i, dt);
+                while (tick % (TICKS >> level) != 0) {
+                    level++;
+                }
+                level_[i] = level;
+                if (tick < TICKS) {
+                    bodies_[i].vel += acc_[i] * (0.5f * step_dt(i));
+                }
+            }
+        });
+    }
+}
+
+// perfectly inelastic: every group of bodies connected by overlaps becomes one body at their
+// center of mass with their total mass and momentum and the sum of their areas, in the slot of
+// the group's first body. It keeps the color and id of the heaviest, so a star that swallows its
+// neighbours stays the same star.
+void Simulation::merge_collisions() {
+    find_collision_pairs(bodies_, grid_, pairs_);
+    if (pairs_.empty()) {
+        return;
+    }
+    merge_parent_.resize(bodies_.size());
+    for (const auto& [i, j] : pairs_) {
+        merge_parent_[i] = i;
+        merge_parent_[j] = j;
+    }
+    const auto find = [this](int i) {
+        while (merge_parent_[i] != i) {
+            merge_parent_[i] = merge_parent_[merge_parent_[i]];
+            i = merge_parent_[i];
+        }
+        return i;
+    };
+    // the smaller index is the root, so every group merges into its first body
+    for (const auto& [i, j] : pairs_) {
+        const int a = find(i), b = find(j);
+        if (a != b) {
+            merge_parent_[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+    merge_groups_.clear();
+    for (const auto& [i, j] : pairs_) {
+        merge_groups_.emplace_back(find(i), i);
+        merge_groups_.emplace_back(find(j), j);
+    }
+    std::sort(merge_groups_.begin(), merge_groups_.end());
+    merge_groups_.erase(std::unique(merge_groups_.begin(), merge_groups_.end()),
+                        merge_groups_.end());
+
+    absorbed_.assign(bodies_.size(), 0);
+    for (std::size_t first = 0; first < merge_groups_.size();) {
+        const int root = merge_groups_[first].first;
+        std::size_t last = first;
+        double mass = 0.0, area = 0.0;
+        double moment[2] = {}, momentum[2] = {};
+        int heaviest = root;
+        for (; last < merge_groups_.size() && merge_groups_[last].first == root; last++) {
+            const int i = merge_groups_[last].second;
+            const Body& body = bodies_[i];
+            mass += body.mass;
+            area += static_cast<double>(body.radius) * body.radius;
+            moment[0] += static_cast<double>(body.mass) * body.pos.x;
+            moment[1] += static_cast<double>(body.mass) * body.pos.y;
+            momentum[0] += static_cast<double>(body.mass) * body.vel.x;
+            momentum[1] += static_cast<double>(body.mass) * body.vel.y;
+            if (body.mass > bodies_[heaviest].mass) {
+                heaviest = i;
+            }
+            if (i != root) {
+                absorbed_[i] = 1;
+            }
+        }
+        Body merged = bodies_[heaviest];
+        merged.mass = static_cast<float>(mass);
+        merged.radius = static_cast<float>(std::sqrt(area));
+        merged.pos = {static_cast<float>(moment[0] / mass), static_cast<float>(moment[1] / mass)};
+        merged.vel = {static_cast<float>(momentum[0] / mass),
+                      static_cast<float>(momentum[1] / mass)};
+        bodies_[root] = merged;
+        ids_[root] = ids_[heaviest];
+        first = last;
+    }
+}
+
+// drops the bodies merged into others this step and those outside of `bounds` in one pass
+void Simulation::remove_bodies() {
+    const bool merged = !absorbed_.empty();
+    if (!bounds.has_value() && !merged) {
+        return;
+    }
+    const auto outside = [this](const Body& body) {
+        if (!bounds.has_value()) {
+            return false;
+        }
+        const Rectangle b = *bounds;
+        return body.pos.x > b.x + b.width + body.radius || body.pos.x < b.x - body.radius ||
+               body.pos.y > b.y + b.height + body.radius || body.pos.y < b.y - body.radius;
+    };
+    const std::size_t before = bodies_.size();
+    // the ids go along with the bodies that stay
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < before; i++) {
+        const Body& body = bodies_[i];
+        if ((merged && absorbed_[i] != 0) || outside(body)) {
+            continue;
+        }
+        bodies_[kept] = body;
+        ids_[kept] = ids_[i];
+        kept++;
+    }
+    bodies_.resize(kept);
+    ids_.resize(kept);
+    absorbed_.clear();
+    profile_.count(Phase::REMOVAL) = before - kept;
+    if (kept != before) {
+        acc_.resize(kept);
+        acc_valid_ = false;
+        structure_++;
+        sampled_potential_.reset();
+        initial_diagnostics_.reset();
+    }
+}
+
+// sorts every per-body array by the Morton key of the positions, quantized to 16 bits per axis
+// over the bounding box
+void Simulation::reorder() {
+    last_reorder_ = steps_;
+    const std::size_t n = bodies_.size();
+    if (n < 2) {
+        return;
+    }
+    Vector2 lo = bodies_[0].pos;
+    Vector2 hi = bodies_[0].pos;
+    for (const Body& body : bodies_) {
+        lo = Vector2Min(lo, body.pos);
+        hi = Vector2Max(hi, body.pos);
+    }
+    const float to_grid = 65535.0f / std::max(std::max(hi.x - lo.x, hi.y - lo.y), 1e-6f);
+    sort_keys_.resize(n);
+    parallel_for(pool, n, 4096, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            const Vector2 cell = (bodies_[i].pos - lo) * to_grid;
+            const auto qx = static_cast<std::uint16_t>(std::clamp(cell.x, 0.0f, 65535.0f));
+            const auto qy = static_cast<std::uint16_t>(std::clamp(cell.y, 0.0f, 65535.0f));
+            sort_keys_[i] = {morton_encode(qx, qy), static_cast<std::uint32_t>(i)};
+        }
+    });
+    std::sort(sort_keys_.begin(), sort_keys_.end());
+    profile_.count(Phase::REORDER) = n;
+
+    bool moved = false;
+    for (std::size_t i = 0; i < n && !moved; i++) {
+        moved = sort_keys_[i].second != i;
+    }
+    if (!moved) {
+        return;
+    }
+    // the integrator state moves along, so a reordering changes nothing about the results
+    const bool levels = level_.size() == n;
+    sorted_bodies_.resize(n);
+    sorted_ids_.resize(n);
+    sorted_acc_.resize(n);
+    sorted_level_.resize(levels ? n : 0);
+    for (std::size_t i = 0; i < n; i++) {
+        const std::uint32_t from = sort_keys_[i].second;
+        sorted_bodies_[i] = bodies_[from];
+        sorted_ids_[i] = ids_[from];
+        sorted_acc_[i] = acc_[from];
+        if (levels) {
+            sorted_level_[i] = level_[from];
+        }
+    }
+    bodies_.swap(sorted_bodies_);
+    ids_.swap(sorted_ids_);
+    acc_.swap(sorted_acc_);
+    if (levels) {
+        level_.swap(sorted_level_);
+    }
+    structure_++;
+}
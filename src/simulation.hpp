@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "body.hpp"
+#include "diagnostics.hpp"
+#include "gravity.hpp"
+#include "profiler.hpp"
+#include "thread_pool.hpp"
+#include "uniform_grid.hpp"
+
+enum class CollisionMode {
+    NONE,
+    KERNEL,     // inside the force engine's pair loop
+    BROADPHASE, // on the candidate pairs of a uniform grid, independent of the force engine
+    MERGE,      // overlapping bodies merge into one at the end of the step, see merge_collisions
+};
+
+const char* collision_mode_name(CollisionMode mode);
+
+enum class Integrator {
+    EULER,    // semi-implicit (symplectic) Euler, first order, one force evaluation per step
+    LEAPFROG, // kick-drift-kick velocity Verlet, second order, one evaluation (reused across steps)
+    YOSHIDA4, // Yoshida's fourth order composition of leapfrog, three evaluations per step
+    BLOCK,    // leapfrog with per-body power-of-two fractions of dt, see Simulation::block_step
+};
+
+const char* integrator_name(Integrator integrator);
+
+// the physics of one system, independent of any window: forces, integration and removal of
+// bodies that leave `bounds`. Broadphase collisions are applied as a velocity impulse at the start
+// of each step, so their strength does not depend on dt; merged ones are taken out along with the
+// removals, so the system shrinks as it collapses.
+class Simulation {
+public:
+    explicit Simulation(std::vector<Body> bodies = {});
+
+    // engine_ may point at default_engine_, which a copy would leave pointing into the source
+    Simulation(const Simulation&) = delete;
+    Simulation& operator=(const Simulation&) = delete;
+
+    std::span<const Body> bodies() const {
+        return bodies_;
+    }
+    // the bodies to change in place, e.g. from a host application between steps. The kept
+    // accelerations are dropped and the drift is measured from the next sample on, as after
+    // add_body. Like bodies(), the span only lasts until the next step, reset or added body.
+    std::span<Body> edit_bodies() {
+        acc_valid_ = false;
+        initial_diagnostics_.reset();
+        return bodies_;
+    }
+    // stable id of every body, which follows it through reordering and the removal of others. Ids
+    // count up in the order bodies were added since the last reset and are never reused.
+    std::span<const std::uint32_t> ids() const {
+        return ids_;
+    }
+    // changes when ids start over (reset, restore); only ids of the same epoch name the same body
+    std::uint64_t id_epoch() const {
+        return id_epoch_;
+    }
+    void reset(std::vector<Body> bodies);
+    void add_body(const Body& body);
+    // keeps room for `n` bodies, so that adding bodies or resetting to a system up to that size
+    // allocates nothing
+    void reserve(std::size_t n);
+    std::size_t capacity() const {
+        return bodies_.capacity();
+    }
+    // puts back a saved state; `acc` and `levels` (either may be empty) are the integrator state
+    // from accelerations() and timestep_levels(), which make the next steps come out as if the run
+    // had never stopped, and `ids` (may be empty) the ids of the bodies
+    void restore(std::vector<Body> bodies, std::uint64_t steps, double time,
+                 std::span<const Vector2> acc, std::span<const std::uint8_t> levels,
+                 std::span<const std::uint32_t> ids = {});
+
+    // engine used for the accelerations; it has to outlive the simulation, nullptr goes back to
+    // the built-in exact engine
+    void set_engine(ForceEngine* engine) {
+        engine_ = engine ? engine : &default_engine_;
+        acc_valid_ = false;
+    }
+    ForceEngine& engine() const {
+        return *engine_;
+    }
+
+    // advances every body by dt
+    void step(float dt);
+
+    std::uint64_t step_count() const {
+        return steps_;
+    }
+    double time() const {
+        return time_;
+    }
+    // changes whenever bodies are added, removed or reordered, i.e. whenever indices stop
+    // referring to the same bodies (ids() still do)
+    std::uint64_t structure_version() const {
+        return structure_;
+    }
+    // overlapping pairs the broadphase found in the last step
+    std::size_t collision_pairs() const {
+        return pairs_.size();
+    }
+    // engine interactions summed over the force evaluations of the last step
+    std::uint64_t interactions() const {
+        return interactions_;
+    }
+    // time and work of the STEP_PHASES in the last step
+    const PhaseProfile& profile() const {
+        return profile_;
+    }
+    // accelerations kept for the next step (leapfrog, block), or empty if there are none
+    std::span<const Vector2> accelerations() const {
+        return acc_valid_ ? std::span<const Vector2>(acc_) : std::span<const Vector2> {};
+    }
+    // with the block integrator, body i takes steps of dt / 2^timestep_levels()[i]
+    std::span<const std::uint8_t> timestep_levels() const {
+        return level_;
+    }
+    // the latest sample of the conserved quantities, and the one the drift is measured from: the
+    // state before the first step since the bodies were last reset, added or removed
+    const std::optional<Diagnostics>& diagnostics() const {
+        return diagnostics_;
+    }
+    const std::optional<Diagnostics>& initial_diagnostics() const {
+        return initial_diagnostics_;
+    }
+
+    // finest block timestep is dt / 2^MAX_BLOCK_LEVEL
+    static constexpr int MAX_BLOCK_LEVEL = 10;
+
+    // bodies further than their radius outside of this are removed after each step
+    std::optional<Rectangle> bounds;
+    // threads for the integration pass; the engine has its own pointer
+    ThreadPool* pool = nullptr;
+    CollisionMode collisions = CollisionMode::BROADPHASE;
+    Integrator integrator = Integrator::EULER;
+    // block integrator accuracy: a body steps at most block_eta * |vel| / |acc|, which is about
+    // 2 pi / block_eta steps per circular orbit
+    float block_eta = 0.1f;
+    // steps between sorts of the bodies along the Z-curve of their positions, 0 for never. Nearby
+    // bodies then sit next to each other in memory, which the tree, the broadphase grid and the
+    // tiled kernels all walk faster; the bodies drift apart again slowly, so an O(N log N) sort
+    // every few dozen steps keeps them close at a negligible cost per step.
+    std::uint64_t reorder_every = 64;
+    // steps between samples of the conserved quantities, 0 for none. The potential energy of a
+    // sample comes out of a force evaluation at the end of the step, which leapfrog and block do
+    // anyway and which euler then uses for its next step; only yoshida4 pays for one more.
+    std::uint64_t diagnostics_every = 0;
+
+private:
+    // with `potential`, also keeps the potential energy for the next sample
+    void compute_forces(float dt, bool potential = false);
+    void apply_collisions(float dt);
+    void kick(float dt);
+    void drift(float dt);
+    void block_step(float dt, bool potential);
+    void sample_diagnostics(float dt);
+    std::uint8_t block_level(std::size_t i, float dt) const;
+    void merge_collisions();
+    void remove_bodies();
+    void reorder();
+
+    std::vector<Body> bodies_;
+    std::vector<std::uint32_t> ids_;
+    std::uint32_t next_id_ = 0;
+    std::uint64_t id_epoch_ = 0;
+    std::vector<Vector2> acc_;
+    // acc_ holds the accelerations at the current positions (leapfrog reuses them)
+    bool acc_valid_ = false;
+    PairwiseEngine default_engine_;
+    ForceEngine* engine_ = &default_engine_;
+    std::vector<std::uint8_t> level_;
+    std::vector<std::uint32_t> active_;
+    UniformGrid grid_;
+    std::vector<std::pair<int, int>> pairs_;
+    // union-find parents of the bodies in a pair, (root, index) of every one of them and whether
+    // a body went into another one this step (empty if none did)
+    std::vector<int> merge_parent_;
+    std::vector<std::pair<int, int>> merge_groups_;
+    std::vector<std::uint8_t> absorbed_;
+    // (Morton key, index) of every body and the arrays permuted into, kept between reorderings
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> sort_keys_;
+    std::vector<Body> sorted_bodies_;
+    std::vector<std::uint32_t> sorted_ids_;
+    std::vector<Vector2> sorted_acc_;
+    std::vector<std::uint8_t> sorted_level_;
+    std::uint64_t last_reorder_ = 0;
+    std::uint64_t steps_ = 0;
+    double time_ = 0.0;
+    std::uint64_t structure_ = 0;
+    std::uint64_t interactions_ = 0;
+    PhaseProfile profile_;
+    // of the current positions, if the step evaluated it there
+    std::optional<double> sampled_potential_;
+    std::optional<Diagnostics> diagnostics_;
+    std::optional<Diagnostics> initial_diagnostics_;
+};
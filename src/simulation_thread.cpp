@@ -0,0 +1,93 @@
+#include "simulation_thread.hpp"
+
+#include <utility>
+
+SimulationThread::SimulationThread(Simulation& sim, FixedTimestep timestep,
+                                   std::function<void(const Simulation&)> on_step) :
+    sim_(sim), timestep_(timestep), on_step_(std::move(on_step)) {
+    // the reader has the current state right away
+    publish();
+    thread_ = std::thread([this] { run(); });
+}
+
+SimulationThread::~SimulationThread() {
+    stop_.store(true, std::memory_order_relaxed);
+    thread_.join();
+    run_commands();
+}
+
+void SimulationThread::post(std::function<void(Simulation&)> command) {
+    const std::lock_guard lock(commands_mutex_);
+    commands_.push_back(std::move(command));
+}
+
+void SimulationThread::set_timestep(FixedTimestep timestep) {
+    post([this, timestep](Simulation&) { timestep_ = timestep; });
+}
+
+bool SimulationThread::poll(SimulationSnapshot& out) {
+    if (!snapshots_.update()) {
+        return false;
+    }
+    // the slot gets overwritten as a whole before it is published again
+    std::swap(out, snapshots_.front());
+    return true;
+}
+
+bool SimulationThread::run_commands() {
+    {
+        const std::lock_guard lock(commands_mutex_);
+        std::swap(commands_, running_);
+    }
+    for (auto& command : running_) {
+        command(sim_);
+    }
+    const bool ran = !running_.empty();
+    running_.clear();
+    return ran;
+}
+
+void SimulationThread::publish() {
+    SimulationSnapshot& snapshot = snapshots_.back();
+    // every slot ends up with the simulation's capacity, so added bodies fit without allocating
+    snapshot.bodies.reserve(sim_.capacity());
+    snapshot.bodies.assign(sim_.bodies().begin(), sim_.bodies().end());
+    snapshot.ids.reserve(sim_.capacity());
+    snapshot.ids.assign(sim_.ids().begin(), sim_.ids().end());
+    snapshot.id_epoch = sim_.id_epoch();
+    snapshot.time = sim_.time();
+    snapshot.structure = sim_.structure_version();
+    snapshot.published = std::chrono::steady_clock::now();
+    snapshot.profile = profile_;
+    snapshot.diagnostics = sim_.diagnostics();
+    snapshot.initial_diagnostics = sim_.initial_diagnostics();
+    snapshots_.publish();
+}
+
+void SimulationThread::run() {
+    using clock = std::chrono::steady_clock;
+    auto last = clock::now();
+    while (!stop_.load(std::memory_order_relaxed)) {
+        const bool changed = run_commands();
+
+        const auto now = clock::now();
+        const std::chrono::duration<float> elapsed = now - last;
+        last = now;
+        const int steps = timestep_.advance(elapsed.count());
+        for (int s = 0; s < steps; s++) {
+            sim_.step(timestep_.dt);
+            profile_ += sim_.profile();
+            if (on_step_) {
+                on_step_(sim_);
+            }
+        }
+
+        if (steps > 0 || changed) {
+            publish();
+        } else {
+            // ahead of the wall clock: wait for the next step to come due
+            const float wait = timestep_.dt - timestep_.accumulator;
+            std::this_thread::sleep_for(std::chrono::duration<float>(wait));
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "body.hpp"
+#include "fixed_timestep.hpp"
+#include "profiler.hpp"
+#include "simulation.hpp"
+#include "triple_buffer.hpp"
+
+// the state of a Simulation as published by SimulationThread
+struct SimulationSnapshot {
+    std::vector<Body> bodies;
+    std::vector<std::uint32_t> ids; // Simulation::ids()
+    std::uint64_t id_epoch = 0;
+    double time = 0.0;
+    // Simulation::structure_version(); bodies of two snapshots with the same value correspond
+    std::uint64_t structure = 0;
+    std::chrono::steady_clock::time_point published {};
+    // Simulation::profile() summed over every step the thread has run; the difference between two
+    // snapshots is the work done in between
+    PhaseProfile profile;
+    // Simulation::diagnostics() and initial_diagnostics()
+    std::optional<Diagnostics> diagnostics;
+    std::optional<Diagnostics> initial_diagnostics;
+};
+
+// steps a Simulation on its own thread in fixed steps against the wall clock and publishes a
+// snapshot after each batch through a triple buffer, so a slow step never holds up a frame and
+// vsync never holds up the physics. While the thread runs the simulation must only be changed
+// through post().
+class SimulationThread {
+public:
+    // `on_step` is called on the simulation thread after every step
+    SimulationThread(Simulation& sim, FixedTimestep timestep,
+                     std::function<void(const Simulation&)> on_step = {});
+    // runs the commands posted so far before joining
+    ~SimulationThread();
+    SimulationThread(const SimulationThread&) = delete;
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    // runs `command` on the simulation thread before its next step, in posting order
+    void post(std::function<void(Simulation&)> command);
+    void set_timestep(FixedTimestep timestep);
+
+    // swaps the newest snapshot into `out` if one was published since the last call
+    bool poll(SimulationSnapshot& out);
+
+private:
+    void run();
+    bool run_commands();
+    void publish();
+
+    Simulation& sim_;
+    FixedTimestep timestep_;
+    std::function<void(const Simulation&)> on_step_;
+    PhaseProfile profile_;
+    std::mutex commands_mutex_;
+    std::vector<std::function<void(Simulation&)>> commands_;
+    std::vector<std::function<void(Simulation&)>> running_;
+    std::atomic<bool> stop_ = false;
+    TripleBuffer<SimulationSnapshot> snapshots_;
+    std::thread thread_;
+};
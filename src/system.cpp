@@ -0,0 +1,249 @@
+#include "system.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <ranges>
+
+#include "counter_rng.hpp"
+
+namespace stdv = std::views;
+
+namespace {
+
+// of the central body of a galaxy, and again of its disk
+constexpr float GALAXY_MASS = 1e4f;
+// bodies per parallel task
+constexpr std::size_t GENERATE_GRAIN = 4096;
+
+struct Disk {
+    Vector2 center;
+    Vector2 vel;
+    float radius;    // where the disk is cut off
+    float spin;      // 1 for counter-clockwise orbits, -1 for clockwise
+    float body_radius;
+};
+
+// radius of the bodies of a generated system: a tenth of their mean spacing in `area`
+float body_radius(int bodies, Vector2 area) {
+    return std::min(0.1f * std::sqrt(area.x * area.y / static_cast<float>(bodies)), 2.0f);
+}
+
+Color lerp_color(Color a, Color b, float t) {
+    const auto lerp = [t](unsigned char from, unsigned char to) {
+        return static_cast<unsigned char>(static_cast<float>(from) +
+                                          (static_cast<float>(to) - static_cast<float>(from)) * t);
+    };
+    return {lerp(a.r, b.r), lerp(a.g, b.g), lerp(a.b, b.b), 0xFF};
+}
+
+// a vector of `length` pointing uniformly over the sphere, projected onto the plane
+Vector2 projected_direction(CounterRng& rng, float length) {
+    const float z = rng.uniform(-1.0f, 1.0f);
+    const float angle = rng.uniform(0.0f, 2.0f * PI);
+    return Vector2 {std::cos(angle), std::sin(angle)} * (length * std::sqrt(1.0f - z * z));
+}
+
+// fills `out` with one disk galaxy: out[0] is its center, the rest draw from streams
+// first_stream + 1 onwards
+void fill_disk(std::span<Body> out, const Disk& disk, std::uint64_t seed,
+               std::uint64_t first_stream, ThreadPool* pool) {
+    assert(out.size() >= 2);
+    const float scale_length = disk.radius / 4.0f;
+    // share of an untruncated exponential disk's mass within x scale lengths
+    const auto disk_share = [](float x) { return 1.0f - (1.0f + x) * std::exp(-x); };
+    const float body_mass = GALAXY_MASS / static_cast<float>(out.size() - 1);
+    out[0] = {GALAXY_MASS, disk.radius * 0.02f, disk.center, disk.vel, {255, 250, 235, 255}};
+
+    parallel_for(pool, out.size() - 1, GENERATE_GRAIN, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin + 1; i < end + 1; i++) {
+            CounterRng rng(seed, first_stream + i);
+            // the surface density exp(-r / h) puts r * exp(-r / h) of the mass at radius r, a
+            // gamma distribution that is the sum of two exponential draws
+            float r;
+            do {
+                r = -scale_length * std::log((1.0f - rng.uniform()) * (1.0f - rng.uniform()));
+            } while (r > disk.radius);
+            r = std::max(r, disk.body_radius + out[0].radius);
+
+            const float x = r / scale_length;
+            const float enclosed = GALAXY_MASS * (1.0f + disk_share(x) / disk_share(4.0f));
+            const float speed = std::sqrt(GRAVITY * enclosed / r);
+            const Vector2 dir = Vector2Rotate(Vector2UnitX, rng.uniform(0.0f, 2.0f * PI));
+            const Vector2 tangent = Vector2 {-dir.y, dir.x} * disk.spin;
+            // a small dispersion around the circular orbit
+            const Vector2 kick = Vector2 {rng.normal(), rng.normal()} * (0.05f * speed);
+
+            out[i] = {
+                .mass = body_mass,
+                .radius = disk.body_radius,
+                .pos = disk.center + dir * r,
+                .vel = disk.vel + tangent * speed + kick,
+                .color = lerp_color({255, 220, 170, 255}, {140, 170, 255, 255}, r / disk.radius),
+            };
+        }
+    });
+}
+
+} // namespace
+
+Color get_random_color(std::default_random_engine& eng) {
+    std::uniform_int_distribution color_dist(0, 0xFFFFFF);
+    const unsigned rgb = color_dist(eng);
+    return {static_cast<unsigned char>(rgb >> 16), static_cast<unsigned char>(rgb >> 8),
+            static_cast<unsigned char>(rgb), 0xFF};
+}
+
+std::vector<Body> get_random_system(std::default_random_engine& eng, int min_planets,
+                                    int max_planets, Vector2 area) {
+    assert(1 <= min_planets && min_planets <= max_planets);
+    std::binomial_distribution planet_num_dist(max_planets - min_planets);
+    int n_planets = planet_num_dist(eng) + min_planets;
+
+    const float max_rad = std::min(area.x, area.y) / 2.0f;
+    // outermost orbit approaches max_rad (edge) as n_planets increases
+    const float mean_distance = max_rad / (n_planets + 1);
+    std::normal_distribution distance_dist(mean_distance, mean_distance * 0.1f);
+    std::uniform_real_distribution angle_dist(0.0f, 2.0f * PI);
+
+    constexpr float SOLAR_MASS = 1e4f;
+    const float sun_radius = /* starts at 0.2x mean distance and gradually approaches 0.5x */
+        mean_distance * (std::pow(0.3f, n_planets) - std::pow(0.6f, n_planets) + 0.5f);
+    const float density = SOLAR_MASS / (sun_radius * sun_radius);
+
+    const Vector2 center = area / 2.0f;
+    std::vector<Body> bodies(n_planets + 1);
+    bodies[0] = {SOLAR_MASS, sun_radius, center, {}, get_random_color(eng)};
+
+    float distance = 0.0f;
+    for (auto& body : bodies | stdv::drop(1)) {
+        distance += distance_dist(eng);
+        Vector2 pos_dir = Vector2Rotate(Vector2UnitX, angle_dist(eng));
+        body.pos = center + pos_dir * distance;
+
+        // outer planets are larger on average
+        const float mean_rad = (distance / max_rad * 0.4f + 0.2f) * sun_radius;
+        std::normal_distribution rad_dist(mean_rad, mean_rad * 0.2f);
+        body.radius = rad_dist(eng);
+        // pretend planets are much smaller for visual reasons
+        body.mass = body.radius * body.radius * density * 1e-2f;
+
+        Vector2 vel_dir = Vector2Rotate(pos_dir, PI / 2.0f);
+        body.vel = vel_dir * std::sqrt(GRAVITY * SOLAR_MASS / distance);
+        body.color = get_random_color(eng);
+    }
+    return bodies;
+}
+
+std::vector<Body> get_disk_galaxy(std::uint64_t seed, int bodies, Vector2 area, ThreadPool* pool) {
+    assert(bodies >= 2);
+    std::vector<Body> out(bodies);
+    const Disk disk = {
+        .center = area / 2.0f,
+        .vel = {},
+        .radius = std::min(area.x, area.y) / 2.0f,
+        .spin = 1.0f,
+        .body_radius = body_radius(bodies, area),
+    };
+    fill_disk(out, disk, seed, 0, pool);
+    return out;
+}
+
+std::vector<Body> get_plummer_sphere(std::uint64_t seed, int bodies, Vector2 area,
+                                     ThreadPool* pool) {
+    assert(bodies >= 2);
+    const float max_radius = std::min(area.x, area.y) / 2.0f;
+    const float scale = max_radius / 5.0f;
+    const float mass = 2.0f * GALAXY_MASS;
+    const float radius = body_radius(bodies, area);
+    const Vector2 center = area / 2.0f;
+
+    std::vector<Body> out(bodies);
+    parallel_for(pool, out.size(), GENERATE_GRAIN, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            CounterRng rng(seed, i);
+            // inverse of the enclosed mass fraction r^3 / (r^2 + a^2)^(3/2), cut off at the box
+            float r;
+            do {
+                const float u = 1.0f - rng.uniform();
+                r = scale / std::sqrt(std::pow(u, -2.0f / 3.0f) - 1.0f);
+            } while (!(r <= max_radius));
+            // speed as a fraction q of the escape speed, with density q^2 (1 - q^2)^(7/2) by
+            // rejection (Aarseth, Henon and Wielen 1974)
+            float q;
+            do {
+                q = rng.uniform();
+            } while (0.1f * rng.uniform() > q * q * std::pow(1.0f - q * q, 3.5f));
+            const float escape = std::sqrt(2.0f * GRAVITY * mass / std::hypot(r, scale));
+
+            out[i] = {
+                .mass = mass / static_cast<float>(bodies),
+                .radius = radius,
+                .pos = center + projected_direction(rng, r),
+                .vel = projected_direction(rng, q * escape),
+                .color = lerp_color({255, 200, 150, 255}, {255, 120, 90, 255}, r / max_radius),
+            };
+        }
+    });
+    return out;
+}
+
+std::vector<Body> get_galaxy_pair(std::uint64_t seed, int bodies, Vector2 area, ThreadPool* pool) {
+    assert(bodies >= 4);
+    const Vector2 center = area / 2.0f;
+    const float radius = std::min(area.x, area.y) / 5.0f;
+    const Vector2 offset = {area.x / 4.0f, radius / 2.0f};
+    // they close in at a third of the speed that would just let them escape each other
+    const float escape = std::sqrt(2.0f * GRAVITY * 4.0f * GALAXY_MASS / (2.0f * offset.x));
+    const Vector2 vel = {escape / 6.0f, 0.0f};
+    const float body_rad = body_radius(bodies, area);
+
+    std::vector<Body> out(bodies);
+    const std::size_t first = out.size() / 2;
+    fill_disk(std::span(out).first(first), {center - offset, vel, radius, 1.0f, body_rad}, seed,
+              0, pool);
+    fill_disk(std::span(out).subspan(first), {center + offset, -vel, radius, -1.0f, body_rad},
+              seed, first, pool);
+    return out;
+}
+
+std::vector<Body> get_uniform_cloud(std::uint64_t seed, int bodies, Vector2 area,
+                                    ThreadPool* pool) {
+    assert(bodies >= 2);
+    const float mass = 2.0f * GALAXY_MASS / static_cast<float>(bodies);
+    const float radius = body_radius(bodies, area);
+
+    std::vector<Body> out(bodies);
+    parallel_for(pool, out.size(), GENERATE_GRAIN, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            CounterRng rng(seed, i);
+            const Vector2 pos = {rng.uniform(0.0f, area.x), rng.uniform(0.0f, area.y)};
+            out[i] = {mass, radius, pos, {}, {220, 220, 230, 255}};
+        }
+    });
+    return out;
+}
+
+static constexpr std::string_view SYSTEM_NAMES[] = {"solar", "disk", "plummer", "galaxy-pair",
+                                                    "cloud"};
+
+std::vector<Body> make_system(std::string_view name, std::uint64_t seed, int bodies, Vector2 area,
+                              ThreadPool* pool) {
+    if (name == "solar") {
+        std::default_random_engine e(seed);
+        return get_random_system(e, bodies - 1, bodies - 1, area);
+    } else if (name == "disk") {
+        return get_disk_galaxy(seed, bodies, area, pool);
+    } else if (name == "plummer") {
+        return get_plummer_sphere(seed, bodies, area, pool);
+    } else if (name == "galaxy-pair") {
+        return get_galaxy_pair(seed, bodies, area, pool);
+    } else if (name == "cloud") {
+        return get_uniform_cloud(seed, bodies, area, pool);
+    }
+    return {};
+}
+
+std::span<const std::string_view> system_names() {
+    return SYSTEM_NAMES;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "body.hpp"
+#include "thread_pool.hpp"
+
+Color get_random_color(std::default_random_engine& eng);
+
+// one sun in the middle of an `area`-sized box with between min_planets and max_planets
+// (binomially distributed) on circular orbits filling the box
+std::vector<Body> get_random_system(std::default_random_engine& eng, int min_planets,
+                                    int max_planets, Vector2 area);
+
+// The generators below scale to millions of bodies: body i draws from its own CounterRng stream
+// and the bodies are filled in parallel, so a seed gives the same system on any thread count.
+// Each centers a system of `bodies` bodies (at least 2, 4 for the pair) on an `area`-sized box.
+
+// a heavy center inside an exponential disk of bodies on nearly circular orbits
+std::vector<Body> get_disk_galaxy(std::uint64_t seed, int bodies, Vector2 area,
+                                  ThreadPool* pool = nullptr);
+// Plummer sphere with the positions and velocities of the 3D model projected onto the plane
+std::vector<Body> get_plummer_sphere(std::uint64_t seed, int bodies, Vector2 area,
+                                     ThreadPool* pool = nullptr);
+// two disk galaxies, spinning in opposite directions, falling past each other
+std::vector<Body> get_galaxy_pair(std::uint64_t seed, int bodies, Vector2 area,
+                                  ThreadPool* pool = nullptr);
+// bodies at rest, spread evenly over the box
+std::vector<Body> get_uniform_cloud(std::uint64_t seed, int bodies, Vector2 area,
+                                    ThreadPool* pool = nullptr);
+
+// system registered under `name` (one of system_names()), or an empty one if there is none.
+// "solar" is get_random_system with a default_random_engine seeded with `seed`.
+std::vector<Body> make_system(std::string_view name, std::uint64_t seed, int bodies, Vector2 area,
+                              ThreadPool* pool = nullptr);
+std::span<const std::string_view> system_names();
@@ -0,0 +1,138 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+// set while the thread is executing chunks of a job
+static thread_local bool in_job = false;
+static thread_local unsigned current_index = 0;
+
+ThreadPool::ThreadPool(unsigned threads) {
+    threads = std::max(threads, 1u);
+    ranges_ = std::make_unique<Range[]>(threads);
+    workers_.reserve(threads - 1);
+    for (unsigned i = 1; i < threads; i++) {
+        workers_.emplace_back([this, i] { worker_loop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+unsigned ThreadPool::thread_index() {
+    return in_job ? current_index : 0;
+}
+
+void ThreadPool::run(std::size_t n, std::size_t grain, void* ctx, ChunkFn fn) {
+    if (n == 0) {
+        return;
+    }
+    if (in_job || workers_.empty() || n <= grain) {
+        fn(ctx, 0, n);
+        return;
+    }
+
+    const unsigned threads = size();
+    for (unsigned t = 0; t < threads; t++) {
+        std::lock_guard lock(ranges_[t].mutex);
+        ranges_[t].begin = n * t / threads;
+        ranges_[t].end = n * (t + 1) / threads;
+    }
+    {
+        std::lock_guard lock(mutex_);
+        ctx_ = ctx;
+        fn_ = fn;
+        grain_ = std::max(grain, std::size_t {1});
+        remaining_.store(n, std::memory_order_relaxed);
+        busy_ = threads - 1;
+        generation_++;
+    }
+    wake_.notify_all();
+
+    execute(0);
+
+    // workers may still be returning from their last chunk even once all items are done
+    std::unique_lock lock(mutex_);
+    done_.wait(lock, [this] { return busy_ == 0; });
+    assert(remaining_.load() == 0);
+}
+
+void ThreadPool::worker_loop(unsigned index) {
+    std::size_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock lock(mutex_);
+            wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if (stop_) {
+                return;
+            }
+            seen = generation_;
+        }
+
+        execute(index);
+
+        std::lock_guard lock(mutex_);
+        if (--busy_ == 0) {
+            done_.notify_one();
+        }
+    }
+}
+
+void ThreadPool::execute(unsigned index) {
+    in_job = true;
+    current_index = index;
+    Range& own = ranges_[index];
+    while (true) {
+        std::size_t begin;
+        std::size_t end;
+        {
+            std::lock_guard lock(own.mutex);
+            begin = own.begin;
+            end = std::min(own.end, begin + grain_);
+            own.begin = end;
+        }
+        if (begin == end) {
+            if (remaining_.load(std::memory_order_acquire) == 0 || !steal(index)) {
+                break;
+            }
+            continue;
+        }
+        fn_(ctx_, begin, end);
+        remaining_.fetch_sub(end - begin, std::memory_order_acq_rel);
+    }
+    in_job = false;
+    current_index = 0;
+}
+
+bool ThreadPool::steal(unsigned thief) {
+    const unsigned threads = size();
+    for (unsigned offset = 1; offset < threads; offset++) {
+        Range& victim = ranges_[(thief + offset) % threads];
+        std::size_t begin;
+        std::size_t end;
+        {
+            std::lock_guard lock(victim.mutex);
+            const std::size_t left = victim.end - victim.begin;
+            if (left == 0) {
+                continue;
+            }
+            // take the back half, or everything if it is no more than one chunk
+            end = victim.end;
+            begin = left <= grain_ ? victim.begin : victim.end - left / 2;
+            victim.end = begin;
+        }
+        std::lock_guard lock(ranges_[thief].mutex);
+        ranges_[thief].begin = begin;
+        ranges_[thief].end = end;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// persistent pool of worker threads for data-parallel loops. Each parallel_for hands every thread
+// an equal contiguous share of the index range; a thread that runs out steals the back half of
+// the fullest-looking neighbour, so uneven rows (e.g. bodies in a collision) still balance out.
+// Dispatching a loop performs no heap allocation.
+class ThreadPool {
+public:
+    // `threads` counts the calling thread, so 1 runs everything inline
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const {
+        return static_cast<unsigned>(workers_.size()) + 1;
+    }
+
+    // calls fn(begin, end) on disjoint chunks of at most `grain` indices covering [0, n) and
+    // returns once all of them have finished. Calls made from inside a chunk run inline.
+    template<class F>
+    void parallel_for(std::size_t n, std::size_t grain, F&& fn) {
+        using Fn = std::remove_reference_t<F>;
+        run(n, grain, const_cast<void*>(static_cast<const void*>(&fn)),
+            [](void* ctx, std::size_t begin, std::size_t end) {
+                (*static_cast<Fn*>(ctx))(begin, end);
+            });
+    }
+
+    // index of the calling thread in [0, size()) while inside a chunk, 0 outside of one
+    static unsigned thread_index();
+
+private:
+    using ChunkFn = void (*)(void*, std::size_t, std::size_t);
+
+    struct alignas(64) Range {
+        std::mutex mutex;
+        std::size_t begin = 0;
+        std::size_t end = 0;
+    };
+
+    void run(std::size_t n, std::size_t grain, void* ctx, ChunkFn fn);
+    void worker_loop(unsigned index);
+    void execute(unsigned index);
+    bool steal(unsigned thief);
+
+    std::vector<std::thread> workers_;
+    std::unique_ptr<Range[]> ranges_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    std::size_t generation_ = 0;
+    unsigned busy_ = 0; // workers still inside the current job
+    bool stop_ = false;
+
+    void* ctx_ = nullptr;
+    ChunkFn fn_ = nullptr;
+    std::size_t grain_ = 1;
+    std::atomic<std::size_t> remaining_ {0};
+};
+
+// runs fn(begin, end) over [0, n) on `pool`, or inline when there is no pool
+template<class F>
+void parallel_for(ThreadPool* pool, std::size_t n, std::size_t grain, F&& fn) {
+    if (pool) {
+        pool->parallel_for(n, grain, fn);
+    } else if (n > 0) {
+        fn(std::size_t {0}, n);
+    }
+}
@@ -0,0 +1,362 @@
+#include "trajectory_writer.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <utility>
+
+#ifdef NBODY_HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef NBODY_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static_assert(std::endian::native == std::endian::little, "trajectories are little-endian");
+
+namespace {
+
+struct FileHeader {
+    static constexpr char MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'T', 'R', 'J'};
+    static constexpr std::uint32_t VERSION = 1;
+    static constexpr std::uint32_t HAS_VELOCITIES = 1;
+    static constexpr std::uint32_t HAS_IDS = 2;
+
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t precision;
+    std::uint32_t compression;
+    std::uint32_t flags;
+    std::uint32_t reserved[2];
+};
+static_assert(sizeof(FileHeader) == 32);
+
+struct FrameHeader {
+    std::uint64_t step;
+    double time;
+    std::uint32_t count;
+    std::uint32_t reserved;
+    std::uint64_t raw_size;
+    std::uint64_t stored_size;
+};
+static_assert(sizeof(FrameHeader) == 40);
+
+// IEEE binary16, rounding to nearest even; out of range values become infinity
+std::uint16_t to_half(float value) {
+    const std::uint32_t bits = std::bit_cast<std::uint32_t>(value);
+    const std::uint32_t sign = (bits >> 16) & 0x8000;
+    const std::uint32_t abs = bits & 0x7fffffff;
+    if (abs >= 0x7f800000) {
+        return static_cast<std::uint16_t>(sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0));
+    }
+    if (abs >= 0x477ff000) { // rounds to at least 65520
+        return static_cast<std::uint16_t>(sign | 0x7c00);
+    }
+    if (abs < 0x38800000) { // subnormal half, in units of 2^-24
+        const float scaled = std::bit_cast<float>(abs) * 0x1p24f;
+        const auto mantissa = static_cast<std::uint32_t>(std::nearbyint(scaled));
+        return static_cast<std::uint16_t>(sign | mantissa);
+    }
+    const std::uint32_t rounded = abs + 0xfff + ((abs >> 13) & 1);
+    return static_cast<std::uint16_t>(sign | ((rounded - 0x38000000) >> 13));
+}
+
+template<class T>
+std::byte* put(std::byte* out, T value) {
+    std::memcpy(out, &value, sizeof(value));
+    return out + sizeof(value);
+}
+
+std::size_t value_size(TrajectoryPrecision precision) {
+    return precision == TrajectoryPrecision::FLOAT32 ? 4 : 2;
+}
+
+std::size_t array_size(TrajectoryPrecision precision, std::size_t count) {
+    const std::size_t range = precision == TrajectoryPrecision::QUANTIZED16 ? 2 * sizeof(float) : 0;
+    return range + count * value_size(precision);
+}
+
+// the writer thread's compression state, kept across frames so that compressing one allocates
+// nothing once the output buffers have grown to size
+class Compressor {
+public:
+    Compressor(TrajectoryCompression compression, [[maybe_unused]] int level) :
+        compression_(compression) {
+#ifdef NBODY_HAVE_ZSTD
+        if (compression_ == TrajectoryCompression::ZSTD) {
+            zstd_ = ZSTD_createCCtx();
+            ZSTD_CCtx_setParameter(zstd_, ZSTD_c_compressionLevel, level);
+        }
+#endif
+    }
+    ~Compressor() {
+#ifdef NBODY_HAVE_ZSTD
+        ZSTD_freeCCtx(zstd_);
+#endif
+    }
+    Compressor(const Compressor&) = delete;
+    Compressor& operator=(const Compressor&) = delete;
+
+    // compresses `raw` into `out`, which is left empty if that fails
+    void compress([[maybe_unused]] std::span<const std::byte> raw,
+                  [[maybe_unused]] std::vector<std::byte>& out) {
+#ifdef NBODY_HAVE_LZ4
+        if (compression_ == TrajectoryCompression::LZ4) {
+            const int raw_size = static_cast<int>(raw.size());
+            out.resize(static_cast<std::size_t>(LZ4_compressBound(raw_size)));
+            const int size = LZ4_compress_default(reinterpret_cast<const char*>(raw.data()),
+                                                  reinterpret_cast<char*>(out.data()), raw_size,
+                                                  static_cast<int>(out.size()));
+            out.resize(static_cast<std::size_t>(std::max(size, 0)));
+        }
+#endif
+#ifdef NBODY_HAVE_ZSTD
+        if (compression_ == TrajectoryCompression::ZSTD) {
+            out.resize(ZSTD_compressBound(raw.size()));
+            const std::size_t size =
+                ZSTD_compress2(zstd_, out.data(), out.size(), raw.data(), raw.size());
+            out.resize(ZSTD_isError(size) ? 0 : size);
+        }
+#endif
+    }
+
+private:
+    TrajectoryCompression compression_;
+#ifdef NBODY_HAVE_ZSTD
+    ZSTD_CCtx* zstd_ = nullptr;
+#endif
+};
+
+} // namespace
+
+const char* trajectory_precision_name(TrajectoryPrecision precision) {
+    switch (precision) {
+        case TrajectoryPrecision::FLOAT32:
+            return "f32";
+        case TrajectoryPrecision::FLOAT16:
+            return "f16";
+        case TrajectoryPrecision::QUANTIZED16:
+            return "q16";
+    }
+    return "?";
+}
+
+const char* trajectory_compression_name(TrajectoryCompression compression) {
+    switch (compression) {
+        case TrajectoryCompression::NONE:
+            return "none";
+        case TrajectoryCompression::LZ4:
+            return "lz4";
+        case TrajectoryCompression::ZSTD:
+            return "zstd";
+    }
+    return "?";
+}
+
+bool trajectory_compression_available(TrajectoryCompression compression) {
+    switch (compression) {
+        case TrajectoryCompression::NONE:
+            return true;
+        case TrajectoryCompression::LZ4:
+#ifdef NBODY_HAVE_LZ4
+            return true;
+#else
+            return false;
+#endif
+        case TrajectoryCompression::ZSTD:
+#ifdef NBODY_HAVE_ZSTD
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+std::expected<std::unique_ptr<TrajectoryWriter>, std::string>
+TrajectoryWriter::open(const std::filesystem::path& path, const TrajectoryOptions& options) {
+    if (!trajectory_compression_available(options.compression)) {
+        return std::unexpected(std::format("{} compression is not built in",
+                                           trajectory_compression_name(options.compression)));
+    }
+    std::FILE* file = std::fopen(path.string().c_str(), "wb");
+    if (file == nullptr) {
+        return std::unexpected(std::format("cannot create {}", path.string()));
+    }
+    FileHeader header {};
+    std::memcpy(header.magic, FileHeader::MAGIC, sizeof(header.magic));
+    header.version = FileHeader::VERSION;
+    header.precision = static_cast<std::uint32_t>(options.precision);
+    header.compression = static_cast<std::uint32_t>(options.compression);
+    header.flags = (options.velocities ? FileHeader::HAS_VELOCITIES : 0) |
+                   (options.ids ? FileHeader::HAS_IDS : 0);
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+        std::fclose(file);
+        return std::unexpected(std::format("cannot write {}", path.string()));
+    }
+    return std::unique_ptr<TrajectoryWriter>(new TrajectoryWriter(file, path.string(), options));
+}
+
+TrajectoryWriter::TrajectoryWriter(std::FILE* file, std::string path,
+                                   const TrajectoryOptions& options) :
+    file_(file), path_(std::move(path)), options_(options) {
+    options_.decimation = std::max<std::uint64_t>(options_.decimation, 1);
+    options_.queue_depth = std::max<std::size_t>(options_.queue_depth, 1);
+    for (std::size_t i = 0; i < options_.queue_depth; i++) {
+        free_.push_back(std::make_unique<Frame>());
+    }
+    thread_ = std::thread(&TrajectoryWriter::run, this);
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+    (void)close();
+}
+
+std::expected<void, std::string> TrajectoryWriter::close() {
+    if (file_ == nullptr) {
+        return {};
+    }
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    ready_.notify_one();
+    thread_.join();
+    const bool closed = std::fclose(std::exchange(file_, nullptr)) == 0;
+    if (!error_.empty()) {
+        return std::unexpected(std::format("{}: {}", path_, error_));
+    }
+    if (!closed) {
+        return std::unexpected(std::format("cannot write {}", path_));
+    }
+    return {};
+}
+
+std::string TrajectoryWriter::error() const {
+    std::lock_guard lock(mutex_);
+    return error_;
+}
+
+void TrajectoryWriter::record(std::uint64_t step, double time, std::span<const Body> bodies,
+                              std::span<const std::uint32_t> ids) {
+    assert(!options_.ids || ids.size() == bodies.size());
+    if (step % options_.decimation != 0) {
+        return;
+    }
+    std::unique_ptr<Frame> frame;
+    {
+        std::lock_guard lock(mutex_);
+        if (stop_) {
+            return;
+        }
+        if (!free_.empty()) {
+            frame = std::move(free_.back());
+            free_.pop_back();
+        }
+    }
+    if (!frame) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    frame->step = step;
+    frame->time = time;
+    frame->count = static_cast<std::uint32_t>(bodies.size());
+    encode(*frame, bodies, ids);
+    {
+        std::lock_guard lock(mutex_);
+        queued_.push_back(std::move(frame));
+    }
+    ready_.notify_one();
+}
+
+void TrajectoryWriter::encode(Frame& frame, std::span<const Body> bodies,
+                              std::span<const std::uint32_t> ids) const {
+    const int arrays = options_.velocities ? 4 : 2;
+    // the pooled buffers only grow, so a steady body count encodes without allocating
+    frame.raw.resize(arrays * array_size(options_.precision, bodies.size()) +
+                     (options_.ids ? ids.size_bytes() : 0));
+
+    std::byte* out = frame.raw.data();
+    for (int array = 0; array < arrays; array++) {
+        const auto value = [array](const Body& body) {
+            const float values[] = {body.pos.x, body.pos.y, body.vel.x, body.vel.y};
+            return values[array];
+        };
+        switch (options_.precision) {
+            case TrajectoryPrecision::FLOAT32:
+                for (const Body& body : bodies) {
+                    out = put(out, value(body));
+                }
+                break;
+            case TrajectoryPrecision::FLOAT16:
+                for (const Body& body : bodies) {
+                    out = put(out, to_half(value(body)));
+                }
+                break;
+            case TrajectoryPrecision::QUANTIZED16: {
+                float lo = INFINITY, hi = -INFINITY;
+                for (const Body& body : bodies) {
+                    lo = std::min(lo, value(body));
+                    hi = std::max(hi, value(body));
+                }
+                if (bodies.empty()) {
+                    lo = hi = 0;
+                }
+                const float scale = (hi - lo) / 65535.0f;
+                const float inv_scale = scale > 0 ? 1 / scale : 0;
+                out = put(out, lo);
+                out = put(out, scale);
+                for (const Body& body : bodies) {
+                    const float q = std::clamp((value(body) - lo) * inv_scale, 0.0f, 65535.0f);
+                    out = put(out, static_cast<std::uint16_t>(q + 0.5f));
+                }
+                break;
+            }
+        }
+    }
+    if (options_.ids && !ids.empty()) {
+        std::memcpy(out, ids.data(), ids.size_bytes());
+    }
+}
+
+void TrajectoryWriter::run() {
+    Compressor compressor(options_.compression, options_.compression_level);
+    std::unique_lock lock(mutex_);
+    while (true) {
+        ready_.wait(lock, [&] { return stop_ || !queued_.empty(); });
+        if (queued_.empty()) {
+            return; // stopped with everything written
+        }
+        std::unique_ptr<Frame> frame = std::move(queued_.front());
+        queued_.pop_front();
+        const bool failed = !error_.empty();
+        lock.unlock();
+
+        std::string error;
+        if (!failed) {
+            compressor.compress(frame->raw, frame->stored);
+            const bool raw = options_.compression == TrajectoryCompression::NONE;
+            const auto& payload = raw ? frame->raw : frame->stored;
+            const FrameHeader header {frame->step, frame->time,      frame->count,
+                                      0,           frame->raw.size(), payload.size()};
+            if (!raw && payload.empty() && !frame->raw.empty()) {
+                error = std::format("cannot compress the frame of step {}", frame->step);
+            } else if (std::fwrite(&header, sizeof(header), 1, file_) != 1 ||
+                       std::fwrite(payload.data(), 1, payload.size(), file_) != payload.size()) {
+                error = std::format("cannot write the frame of step {}", frame->step);
+            } else {
+                written_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        lock.lock();
+        if (error_.empty()) {
+            error_ = std::move(error);
+        }
+        free_.push_back(std::move(frame));
+    }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <expected>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "body.hpp"
+
+enum class TrajectoryPrecision {
+    FLOAT32,
+    FLOAT16,
+    QUANTIZED16, // 16 bit fixed point over the frame's bounding range of each field
+};
+enum class TrajectoryCompression { NONE, LZ4, ZSTD };
+
+const char* trajectory_precision_name(TrajectoryPrecision precision);
+const char* trajectory_compression_name(TrajectoryCompression compression);
+// whether this build can write `compression` (zstd and LZ4 are optional dependencies)
+bool trajectory_compression_available(TrajectoryCompression compression);
+
+struct TrajectoryOptions {
+    // every `decimation`th submitted step is recorded
+    std::uint64_t decimation = 1;
+    TrajectoryPrecision precision = TrajectoryPrecision::FLOAT32;
+    TrajectoryCompression compression = TrajectoryCompression::NONE;
+    int compression_level = 1;
+    bool velocities = true;
+    // with the stable id of every body (Simulation::ids()), which follows a body between frames
+    // however the simulation reorders them
+    bool ids = true;
+    // encoded frames that may wait for the I/O thread; a frame finding none of them free is dropped
+    std::size_t queue_depth = 4;
+};
+
+// Trajectory file, version 1, little-endian: a 32 byte header ("NBODYTRJ", version, precision,
+// compression, flags) followed by frames, each a 40 byte frame header (step, time, body count, raw
+// and stored payload size) and the payload as stored. The raw payload is x, y and optionally vx, vy
+// as arrays of `count` values; QUANTIZED16 arrays are preceded by their float offset and scale
+// (value = offset + q * scale). With the ids flag a uint32 array of the body ids ends the payload.
+//
+// record() encodes a frame on the calling thread into a pooled buffer and queues it; compression
+// and writing happen on the writer's own thread. The caller never waits for the disk: with all the
+// buffers in flight the frame is dropped and counted instead.
+class TrajectoryWriter {
+public:
+    static std::expected<std::unique_ptr<TrajectoryWriter>, std::string>
+    open(const std::filesystem::path& path, const TrajectoryOptions& options);
+    // closes the file like close(), ignoring any error
+    ~TrajectoryWriter();
+    TrajectoryWriter(const TrajectoryWriter&) = delete;
+    TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+    // records the bodies of step `step` if the decimation selects it; `ids` has one id per body
+    // unless the writer was opened without ids
+    void record(std::uint64_t step, double time, std::span<const Body> bodies,
+                std::span<const std::uint32_t> ids = {});
+
+    std::uint64_t frames_written() const {
+        return written_.load(std::memory_order_relaxed);
+    }
+    std::uint64_t frames_dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+    // first I/O error of the writer thread, empty while there is none
+    std::string error() const;
+    // writes the queued frames and closes the file; later frames are ignored
+    std::expected<void, std::string> close();
+
+private:
+    struct Frame {
+        std::uint64_t step;
+        double time;
+        std::uint32_t count;
+        std::vector<std::byte> raw;
+        std::vector<std::byte> stored;
+    };
+
+    TrajectoryWriter(std::FILE* file, std::string path, const TrajectoryOptions& options);
+    void encode(Frame& frame, std::span<const Body> bodies,
+                std::span<const std::uint32_t> ids) const;
+    void run();
+
+    std::FILE* file_;
+    std::string path_;
+    TrajectoryOptions options_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;
+    std::vector<std::unique_ptr<Frame>> free_;
+    std::deque<std::unique_ptr<Frame>> queued_;
+    bool stop_ = false;
+    std::string error_;
+
+    std::atomic<std::uint64_t> written_ = 0;
+    std::atomic<std::uint64_t> dropped_ = 0;
+    std::thread thread_;
+};
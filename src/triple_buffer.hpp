@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// lock-free handoff of the latest value from one writer thread to one reader thread. The writer
+// fills back() and publishes it; the reader picks up the newest published value with update() and
+// reads it through front(). Neither side ever waits for the other, and values the reader did not
+// get to in time are overwritten.
+template<class T>
+class TripleBuffer {
+public:
+    // writer side
+    T& back() {
+        return slots_[back_];
+    }
+    void publish() {
+        back_ = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // reader side; true if front() changed
+    bool update() {
+        if (!(middle_.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+        front_ = middle_.exchange(front_, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    T& front() {
+        return slots_[front_];
+    }
+
+private:
+    static constexpr std::uint8_t INDEX = 3;
+    static constexpr std::uint8_t FRESH = 4;
+
+    T slots_[3] {};
+    // the slot between the two sides, plus FRESH while the reader has not taken it
+    alignas(64) std::atomic<std::uint8_t> middle_ = 1;
+    alignas(64) std::uint8_t back_ = 0;
+    alignas(64) std::uint8_t front_ = 2;
+};
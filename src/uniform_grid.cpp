@@ -0,0 +1,59 @@
+#include "uniform_grid.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+
+void UniformGrid::build(std::span<const Body> bodies, float cell_size) {
+    assert(cell_size > 0.0f);
+    cell_size_ = cell_size;
+    const std::size_t n = bodies.size();
+    const std::uint32_t buckets =
+        std::bit_ceil(static_cast<std::uint32_t>(std::max<std::size_t>(2 * n, 1)));
+    bucket_mask_ = buckets - 1;
+
+    const float inv_size = 1.0f / cell_size;
+    cells_.resize(n);
+    starts_.assign(buckets + 1, 0);
+    for (std::size_t i = 0; i < n; i++) {
+        cells_[i] = {static_cast<std::int32_t>(std::floor(bodies[i].pos.x * inv_size)),
+                     static_cast<std::int32_t>(std::floor(bodies[i].pos.y * inv_size))};
+        starts_[bucket_of(cells_[i]) + 1]++;
+    }
+    for (std::uint32_t b = 0; b < buckets; b++) {
+        starts_[b + 1] += starts_[b];
+    }
+
+    // counting sort by bucket: each start serves as the insertion cursor and is shifted back after
+    entries_.resize(n);
+    for (std::size_t i = 0; i < n; i++) {
+        entries_[starts_[bucket_of(cells_[i])]++] = static_cast<int>(i);
+    }
+    for (std::uint32_t b = buckets; b > 0; b--) {
+        starts_[b] = starts_[b - 1];
+    }
+    starts_[0] = 0;
+}
+
+void find_collision_pairs(std::span<const Body> bodies, UniformGrid& grid,
+                          std::vector<std::pair<int, int>>& pairs) {
+    pairs.clear();
+    float max_radius = 0.0f;
+    for (const auto& body : bodies) {
+        max_radius = std::max(max_radius, body.radius);
+    }
+    // collisions need the radii to overlap by COLL_EPS, so tiny bodies never collide
+    if (2.0f * max_radius <= COLL_EPS) {
+        return;
+    }
+
+    grid.build(bodies, 2.0f * max_radius);
+    grid.for_each_pair([&](int i, int j) {
+        // slightly generous, collision_acceleration makes the exact DIST_EPS-offset test per side
+        const float reach = bodies[i].radius + bodies[j].radius - COLL_EPS + 2.0f * DIST_EPS;
+        if (reach > 0.0f && Vector2DistanceSqr(bodies[i].pos, bodies[j].pos) < reach * reach) {
+            pairs.emplace_back(i, j);
+        }
+    });
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "body.hpp"
+
+// uniform grid over body positions, hashed so that its memory stays O(N) however far apart the
+// bodies are. Any two bodies closer than the cell size end up in the same or adjacent cells.
+class UniformGrid {
+public:
+    void build(std::span<const Body> bodies, float cell_size);
+
+    float cell_size() const {
+        return cell_size_;
+    }
+
+    // calls fn(i, j) once for every unordered pair of bodies in the same or adjacent cells
+    template<class F>
+    void for_each_pair(F&& fn) const {
+        // half of the 3x3 neighbourhood, so that every pair of neighbouring cells is seen once
+        constexpr int STENCIL[][2] = {{0, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+        const int n = static_cast<int>(cells_.size());
+        for (int i = 0; i < n; i++) {
+            const Cell own = cells_[i];
+            for (const auto& offset : STENCIL) {
+                const Cell cell = {own.x + offset[0], own.y + offset[1]};
+                const std::uint32_t bucket = bucket_of(cell);
+                for (std::uint32_t k = starts_[bucket]; k < starts_[bucket + 1]; k++) {
+                    const int j = entries_[k];
+                    // buckets are shared by every cell hashing into them
+                    if (cells_[j] != cell || (offset[0] == 0 && offset[1] == 0 && j <= i)) {
+                        continue;
+                    }
+                    fn(i, j);
+                }
+            }
+        }
+    }
+
+    // calls fn(j) for every other body j in the cell of body i or one of the eight around it
+    template<class F>
+    void for_each_neighbour(int i, F&& fn) const {
+        const Cell own = cells_[i];
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                const Cell cell = {own.x + dx, own.y + dy};
+                const std::uint32_t bucket = bucket_of(cell);
+                for (std::uint32_t k = starts_[bucket]; k < starts_[bucket + 1]; k++) {
+                    const int j = entries_[k];
+                    if (j != i && cells_[j] == cell) {
+                        fn(j);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    struct Cell {
+        std::int32_t x;
+        std::int32_t y;
+        bool operator==(const Cell&) const = default;
+    };
+
+    std::uint32_t bucket_of(Cell cell) const {
+        const std::uint32_t h = static_cast<std::uint32_t>(cell.x) * 0x9E3779B1u ^
+                                static_cast<std::uint32_t>(cell.y) * 0x85EBCA77u;
+        return (h ^ (h >> 15)) & bucket_mask_;
+    }
+
+    float cell_size_ = 1.0f;
+    std::uint32_t bucket_mask_ = 0;
+    std::vector<Cell> cells_;            // cell of every body
+    std::vector<std::uint32_t> starts_;  // entries_ range of every bucket, plus an end marker
+    std::vector<int> entries_;           // body indices grouped by bucket
+};
+
+// candidate pairs (i < j) for the elastic collision response: bodies whose radii overlap, found
+// through a grid whose cells are as wide as the largest body
+void find_collision_pairs(std::span<const Body> bodies, UniformGrid& grid,
+                          std::vector<std::pair<int, int>>& pairs);
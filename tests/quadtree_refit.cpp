@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "quadtree.hpp"
+
+// QuadNode::contains up to a few units in the last place of the coordinates, as the keys cells
+// are cut by are quantized from positions rounded to float
+static bool inside(const QuadNode& node, Vector2 p) {
+    const float scale = std::max({std::abs(p.x), std::abs(p.y), node.half_size});
+    const float slack = 4.0f * std::numeric_limits<float>::epsilon() * scale;
+    return std::abs(p.x - node.center.x) <= node.half_size + slack &&
+           std::abs(p.y - node.center.y) <= node.half_size + slack;
+}
+
+// bodies drifting through a tree that is refitted between rebuilds have to stay inside every cell
+// whose range holds them, as a fresh build would have it
+int main() {
+    constexpr int BODIES = 4000;
+    constexpr int STEPS = 200;
+    constexpr float DT = 1.0f / 60.0f;
+
+    std::mt19937 rng(20);
+    std::uniform_real_distribution<float> pos(0.0f, 1000.0f);
+    std::normal_distribution<float> vel(0.0f, 20.0f);
+    std::vector<Body> bodies(BODIES);
+    for (Body& body : bodies) {
+        body = {.mass = 1.0f,
+                .radius = 1.0f,
+                .pos = {pos(rng), pos(rng)},
+                .vel = {vel(rng), vel(rng)},
+                .color = WHITE};
+    }
+
+    QuadTree tree;
+    int refits = 0;
+    for (int step = 0; step < STEPS; step++) {
+        for (Body& body : bodies) {
+            body.pos += body.vel * DT;
+        }
+        tree.update(bodies, 8, 0.25f);
+        refits += tree.refitted();
+
+        const auto order = tree.order();
+        for (const QuadNode& node : tree.nodes()) {
+            for (int k = node.first; k < node.first + node.count; k++) {
+                const Vector2 p = bodies[order[k]].pos;
+                if (!inside(node, p)) {
+                    std::fprintf(stderr,
+                                 "step %d: body %d at (%g, %g) outside the cell at (%g, %g) of "
+                                 "half size %g, depth %d, %s\n",
+                                 step, order[k], p.x, p.y, node.center.x, node.center.y,
+                                 node.half_size, node.depth,
+                                 tree.refitted() ? "refitted" : "built");
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+    if (refits == 0) {
+        std::fprintf(stderr, "the tree was never refitted\n");
+        return EXIT_FAILURE;
+    }
+    std::printf("%d updates, %d refits\n", STEPS, refits);
+    return EXIT_SUCCESS;
+}